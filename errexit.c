@@ -8,14 +8,17 @@ int warnings_are_fatal = 0;
 int silent_unless_fatal = 0;
 
 const char *progname = "";
-const char *infilename = "";		/* name of current input file */
+__thread const char *infilename = "";	/* name of current input file */
 
-int linenr = 0;
+__thread int linenr = 0;
 int warnct, errct;
 char *((*warn_prefix)()) = 0;
 
-int have_jmpbuf = 0;
-jmp_buf jmpbuf;
+__thread int have_jmpbuf = 0;
+__thread jmp_buf jmpbuf;
+
+/* longjmp also for fatal errors; the caller will exit later */
+__thread int catch_errors = 0;
 
 static void
 mywarn(const char *s, va_list ap) {
@@ -61,7 +64,7 @@ errexit(const char *s, ...) {
 
 skip:
 	errct++;
-	if (have_jmpbuf && ignore_errors)
+	if (have_jmpbuf && (ignore_errors || catch_errors))
 		longjmp(jmpbuf, 1);
 	exit(1);
 }
@@ -2,8 +2,8 @@ extern int ignore_errors;
 extern int warnings_are_fatal;
 extern int silent_unless_fatal;
 extern const char *progname;
-extern const char *infilename;
-extern int linenr;
+extern __thread const char *infilename;
+extern __thread int linenr;
 extern int warnct, errct;
 extern char *((*warn_prefix)());
 extern void errexit(const char *s, ...) __attribute__ ((noreturn));
@@ -11,5 +11,7 @@ extern void fatalexit(const char *s, ...) __attribute__ ((noreturn));
 extern void warn(const char *s, ...);
 
 #include <setjmp.h>
-extern int have_jmpbuf;
-extern jmp_buf jmpbuf;
+/* per thread, so that worker threads can each catch their own errors */
+extern __thread int have_jmpbuf;
+extern __thread jmp_buf jmpbuf;
+extern __thread int catch_errors;
@@ -0,0 +1,257 @@
+/*
+ * extsort.c - sort fixed-size records in bounded memory
+ *
+ * es = extsort_new(recsz, mem, cmp, tmpdir): records of recsz bytes,
+ *  compared by cmp() as for qsort(); at most about mem bytes of them
+ *  are kept in memory. Temporary files go in tmpdir (NULL: $TMPDIR or
+ *  /tmp), and are unlinked as soon as they are made.
+ * extsort_add(es, rec): add a record
+ * extsort_sort(es): done adding
+ * extsort_next(es): the records in sorted order, then NULL; the
+ *  pointer is valid until the next call
+ * extsort_free(es)
+ *
+ * When the memory is full its records are sorted and written out as a
+ * run. extsort_sort() merges the runs (and what is left in memory) on
+ * the fly. When there are MAXRUNS runs they are first merged into one,
+ * so that the number of open files stays bounded.
+ * Not thread-safe: callers with several threads take a lock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "extsort.h"
+
+#define MAXRUNS		128
+#define RUNBUFSZ	(256*1024)
+
+struct run {
+	FILE *f;
+	char *rec;		/* its current record */
+};
+
+struct extsort {
+	size_t recsz;
+	int (*cmp)(const void *, const void *);
+	const char *tmpdir;
+	char *buf;		/* the records in memory */
+	size_t nbuf, maxbuf;
+	struct run runs[MAXRUNS+1];	/* the last one: memory */
+	int nruns;
+	int *heap, nheap;	/* indices in runs[], smallest first */
+	size_t mempos;		/* next record in memory, when merging */
+	char *out;		/* returned by extsort_next() */
+	long long count;
+	int sorted;
+};
+
+struct extsort *
+extsort_new(size_t recsz, size_t mem, int (*cmp)(const void *, const void *),
+	    const char *tmpdir) {
+	struct extsort *es;
+
+	es = xmalloc(sizeof(*es));
+	memset(es, 0, sizeof(*es));
+	es->recsz = recsz;
+	es->cmp = cmp;
+	es->tmpdir = tmpdir ? tmpdir : getenv("TMPDIR");
+	if (es->tmpdir == NULL || *es->tmpdir == 0)
+		es->tmpdir = "/tmp";
+	es->maxbuf = mem / recsz;
+	if (es->maxbuf < 1024)
+		es->maxbuf = 1024;
+	es->buf = xmalloc(es->maxbuf * recsz);
+	es->out = xmalloc(recsz);
+	return es;
+}
+
+static FILE *
+tmp_file(struct extsort *es) {
+	char *name;
+	FILE *f;
+	int fd;
+
+	name = xmalloc(strlen(es->tmpdir) + 20);
+	sprintf(name, "%s/extsortXXXXXX", es->tmpdir);
+	fd = mkstemp(name);
+	if (fd < 0)
+		errexit("cannot create temporary file in %s", es->tmpdir);
+	unlink(name);
+	free(name);
+	f = fdopen(fd, "w+");
+	if (f == NULL)
+		errexit("fdopen failed");
+	setvbuf(f, NULL, _IOFBF, RUNBUFSZ);
+	return f;
+}
+
+static void
+write_rec(struct extsort *es, FILE *f, const void *rec) {
+	if (fwrite(rec, es->recsz, 1, f) != 1)
+		errexit("write error on temporary file (disk full?)");
+}
+
+/* the next record of run r into r->rec; 0 at its end */
+static int
+read_rec(struct extsort *es, struct run *r) {
+	if (r->f == NULL) {		/* memory */
+		if (es->mempos == es->nbuf)
+			return 0;
+		r->rec = es->buf + es->mempos++ * es->recsz;
+		return 1;
+	}
+	if (fread(r->rec, es->recsz, 1, r->f) == 1)
+		return 1;
+	if (ferror(r->f))
+		errexit("read error on temporary file");
+	return 0;
+}
+
+static int
+heap_less(struct extsort *es, int a, int b) {
+	return es->cmp(es->runs[es->heap[a]].rec,
+		       es->runs[es->heap[b]].rec) < 0;
+}
+
+static void
+sift_down(struct extsort *es, int i) {
+	int c, t;
+
+	while ((c = 2*i+1) < es->nheap) {
+		if (c+1 < es->nheap && heap_less(es, c+1, c))
+			c++;
+		if (!heap_less(es, c, i))
+			break;
+		t = es->heap[i];
+		es->heap[i] = es->heap[c];
+		es->heap[c] = t;
+		i = c;
+	}
+}
+
+/* start merging runs[0..n-1] */
+static void
+start_merge(struct extsort *es, int n) {
+	struct run *r;
+	int i;
+
+	es->heap = xrealloc(es->heap, (MAXRUNS+1) * sizeof(int));
+	es->nheap = 0;
+	for (i = 0; i < n; i++) {
+		r = &es->runs[i];
+		if (r->f) {
+			rewind(r->f);
+			if (r->rec == NULL)
+				r->rec = xmalloc(es->recsz);
+		}
+		if (read_rec(es, r))
+			es->heap[es->nheap++] = i;
+	}
+	for (i = es->nheap/2 - 1; i >= 0; i--)
+		sift_down(es, i);
+}
+
+/* the smallest record, and advance its run; NULL at the end */
+static const void *
+merge_next(struct extsort *es, void *out) {
+	struct run *r;
+
+	if (es->nheap == 0)
+		return NULL;
+	r = &es->runs[es->heap[0]];
+	memcpy(out, r->rec, es->recsz);
+	if (!read_rec(es, r))
+		es->heap[0] = es->heap[--es->nheap];
+	sift_down(es, 0);
+	return out;
+}
+
+static void
+close_runs(struct extsort *es, int n) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		fclose(es->runs[i].f);
+		free(es->runs[i].rec);
+		es->runs[i].f = NULL;
+		es->runs[i].rec = NULL;
+	}
+}
+
+/* merge all runs into a single one */
+static void
+merge_runs(struct extsort *es) {
+	char *rec;
+	FILE *f;
+
+	f = tmp_file(es);
+	rec = xmalloc(es->recsz);
+	start_merge(es, es->nruns);
+	while (merge_next(es, rec))
+		write_rec(es, f, rec);
+	free(rec);
+	close_runs(es, es->nruns);
+	es->runs[0].f = f;
+	es->nruns = 1;
+}
+
+/* sort the records in memory and write them out as a run */
+static void
+flush_buf(struct extsort *es) {
+	FILE *f;
+	size_t i;
+
+	if (es->nruns == MAXRUNS)
+		merge_runs(es);
+	qsort(es->buf, es->nbuf, es->recsz, es->cmp);
+	f = tmp_file(es);
+	for (i = 0; i < es->nbuf; i++)
+		write_rec(es, f, es->buf + i * es->recsz);
+	es->runs[es->nruns].f = f;
+	es->runs[es->nruns].rec = NULL;
+	es->nruns++;
+	es->nbuf = 0;
+}
+
+void
+extsort_add(struct extsort *es, const void *rec) {
+	if (es->sorted)
+		fatalexit("extsort_add after extsort_sort");
+	if (es->nbuf == es->maxbuf)
+		flush_buf(es);
+	memcpy(es->buf + es->nbuf++ * es->recsz, rec, es->recsz);
+	es->count++;
+}
+
+void
+extsort_sort(struct extsort *es) {
+	es->sorted = 1;
+	qsort(es->buf, es->nbuf, es->recsz, es->cmp);
+	es->mempos = 0;
+	es->runs[es->nruns].f = NULL;	/* memory as the last run */
+	start_merge(es, es->nruns + 1);
+}
+
+const void *
+extsort_next(struct extsort *es) {
+	if (!es->sorted)
+		fatalexit("extsort_next before extsort_sort");
+	return merge_next(es, es->out);
+}
+
+long long
+extsort_count(struct extsort *es) {
+	return es->count;
+}
+
+void
+extsort_free(struct extsort *es) {
+	close_runs(es, es->nruns);
+	free(es->buf);
+	free(es->out);
+	free(es->heap);
+	free(es);
+}
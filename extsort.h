@@ -0,0 +1,10 @@
+/* sort fixed-size records in bounded memory, spilling to disk */
+struct extsort;
+extern struct extsort *extsort_new(size_t recsz, size_t mem,
+				   int (*cmp)(const void *, const void *),
+				   const char *tmpdir);
+extern void extsort_add(struct extsort *es, const void *rec);
+extern void extsort_sort(struct extsort *es);
+extern const void *extsort_next(struct extsort *es);
+extern long long extsort_count(struct extsort *es);
+extern void extsort_free(struct extsort *es);
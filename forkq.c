@@ -0,0 +1,193 @@
+/*
+ * forkq.c - run numbered jobs in child processes, output in order
+ *
+ * forkq_run(njobs, nprocs, work, arg): call work(job, arg) for
+ *  job = 0, ..., njobs-1 in nprocs forked children, and copy what
+ *  the jobs wrote to stdout and stderr back out in job order, so that
+ *  the output is that of a serial run. The children start with all
+ *  global state of the parent, so work() can use it as it is; what it
+ *  changes is lost, except for the value it returns: forkq_run()
+ *  returns the sum of these.
+ *
+ * A job that ends the child with exit() (say, errexit() without -i)
+ * ends the run there: the output of the jobs before it and its own
+ * output are copied, and the parent exits with the same status.
+ * Jobs after it may have run, but their output is dropped.
+ *
+ * Each child takes the next job from a counter in shared memory,
+ * and appends its output to its own two temporary files; the parent
+ * waits for all children and then copies the pieces.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "forkq.h"
+
+#define NOTRUN	0
+#define RUNNING	1	/* and if still so at the end: exited */
+#define DONE	2
+
+struct forkjob {
+	int state;
+	int proc;		/* the child that ran it */
+	long ret;
+	long outoff, outlen, erroff, errlen;
+};
+
+struct forkq {
+	int next;		/* the next job to take */
+	int stop;		/* no use taking jobs after this one */
+	struct forkjob jobs[1];
+};
+
+static struct forkq *fq;
+static struct forkjob *curjob;	/* in a child */
+
+static long
+position(int fd) {
+	return lseek(fd, 0L, SEEK_CUR);
+}
+
+/* in a child: the end of curjob's output */
+static void
+end_job(void) {
+	fflush(stdout);
+	fflush(stderr);
+	curjob->outlen = position(1) - curjob->outoff;
+	curjob->errlen = position(2) - curjob->erroff;
+}
+
+/* in a child, also when work() calls exit() */
+static void
+at_exit(void) {
+	int stop, job;
+
+	if (curjob == NULL || curjob->state != RUNNING)
+		return;
+	end_job();
+	job = curjob - fq->jobs;
+	while ((stop = fq->stop) > job)
+		__sync_val_compare_and_swap(&fq->stop, stop, job);
+}
+
+static void
+child(int proc, int outfd, int errfd, int njobs,
+      long (*work)(int, void *), void *arg) {
+	struct forkjob *fj;
+	int job;
+
+	if (dup2(outfd, 1) < 0 || dup2(errfd, 2) < 0)
+		_exit(1);
+	setvbuf(stdout, NULL, _IOFBF, 65536);
+	atexit(at_exit);
+
+	while ((job = __sync_fetch_and_add(&fq->next, 1)) < njobs) {
+		if (job > fq->stop)
+			break;
+		fj = curjob = &fq->jobs[job];
+		fj->proc = proc;
+		fj->outoff = position(1);
+		fj->erroff = position(2);
+		fj->state = RUNNING;
+		fj->ret = work(job, arg);
+		end_job();
+		fj->state = DONE;
+	}
+	curjob = NULL;
+	fflush(stdout);
+	fflush(stderr);
+	_exit(0);
+}
+
+static void
+copy_out(FILE *f, int fd, long off, long len) {
+	char buf[65536];
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, (len < sizeof(buf)) ? len : sizeof(buf),
+			  off);
+		if (n <= 0)
+			fatalexit("read error on temporary file");
+		if (fwrite(buf, 1, n, f) != n)
+			fatalexit("output error");
+		off += n;
+		len -= n;
+	}
+}
+
+long
+forkq_run(int njobs, int nprocs, long (*work)(int, void *), void *arg) {
+	struct forkjob *fj;
+	FILE **tmps;
+	pid_t *pids, pid;
+	int *status;
+	size_t sz;
+	long sum = 0;
+	int i, j;
+
+	if (nprocs > njobs)
+		nprocs = njobs;
+	if (nprocs < 1)
+		return 0;
+
+	sz = sizeof(struct forkq) + njobs * sizeof(struct forkjob);
+	fq = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (fq == MAP_FAILED)
+		fatalexit("cannot mmap shared job table");
+	fq->next = 0;
+	fq->stop = njobs;
+	for (j = 0; j < njobs; j++)
+		fq->jobs[j].state = NOTRUN;
+
+	tmps = xmalloc(2 * nprocs * sizeof(FILE *));
+	pids = xmalloc(nprocs * sizeof(pid_t));
+	status = xmalloc(nprocs * sizeof(int));
+	for (i = 0; i < 2*nprocs; i++)
+		if ((tmps[i] = tmpfile()) == NULL)
+			fatalexit("cannot create temporary file");
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < nprocs; i++) {
+		pid = fork();
+		if (pid < 0)
+			fatalexit("cannot fork");
+		if (pid == 0)
+			child(i, fileno(tmps[2*i]), fileno(tmps[2*i+1]),
+			      njobs, work, arg);
+		pids[i] = pid;
+	}
+	for (i = 0; i < nprocs; i++) {
+		while (waitpid(pids[i], &status[i], 0) < 0 && errno == EINTR)
+			;
+	}
+
+	for (j = 0; j < njobs; j++) {
+		fj = &fq->jobs[j];
+		if (fj->state == NOTRUN)
+			fatalexit("job %d was not run", j);
+		i = fj->proc;
+		copy_out(stdout, fileno(tmps[2*i]), fj->outoff, fj->outlen);
+		fflush(stdout);
+		copy_out(stderr, fileno(tmps[2*i+1]), fj->erroff, fj->errlen);
+		if (fj->state == RUNNING)
+			exit(WIFEXITED(status[i]) ? WEXITSTATUS(status[i]) : 1);
+		sum += fj->ret;
+	}
+
+	for (i = 0; i < 2*nprocs; i++)
+		fclose(tmps[i]);
+	free(tmps);
+	free(pids);
+	free(status);
+	munmap(fq, sz);
+	fq = NULL;
+	return sum;
+}
@@ -0,0 +1,6 @@
+/*
+ * Jobs numbered 0..njobs-1, run in forked children, with their
+ * stdout and stderr output copied out in job order.
+ */
+extern long forkq_run(int njobs, int nprocs, long (*work)(int, void *),
+		      void *arg);
@@ -0,0 +1,190 @@
+/*
+ * movehash.c - transformation tables and fast hashes of move sequences
+ *
+ * Moves are as in moves[] of sgfinfo: (x << 8) | y with x, y
+ * lower case letters, possibly with color bits above bit 16.
+ *
+ * transform0(&x, &y, tra, size): apply transformation tra (0-7) to the
+ *  point x,y (from 0) of a board of the given size; the numbering of
+ *  -tra in sgfinfo, also used by -can, -can64 and sgfdup.
+ * movetra_table(size): for board size at most TRAMAX, the table with
+ *  at TRAPT(tra, x*TRAMAX+y) the move code of point x,y (from 0) after
+ *  transformation tra; else NULL.
+ *  The tables are made on first use, and may be shared by threads.
+ * movetra_point(size, mv): the index x*TRAMAX+y of mv in the table,
+ *  or -1 for a pass, tenuki ("zz") or off-board move.
+ *
+ * hash64_moves(moves, n): a 64-bit hash (not cryptographic) of the
+ *  points of moves[0..n-1], colors ignored, as for sgfinfo -md5.
+ *  Four moves are packed in a 64-bit word, and words are mixed as
+ *  in xxHash64.
+ * can64_moves(moves, n, size, &tra): the smallest of the hashes of
+ *  the 8 transformations, all computed in one pass; tra (if not NULL)
+ *  gets the transformation that gives it. Moves without a table
+ *  index are the same in each transformation.
+ */
+#include <stdlib.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "movehash.h"
+
+void
+transform0(int *xx, int *yy, int tra, int size) {
+	int x, y, xn, yn;
+	int sz = size-1;
+
+	x = *xx;
+	y = *yy;
+
+	switch (tra) {
+	case 0:
+		xn = x; yn = y; break;
+	case 1:
+		xn = x; yn = sz-y; break;
+	case 2:
+		xn = y; yn = sz-x; break;
+	case 3:
+		xn = y; yn = x; break;
+	case 4:
+		xn = sz-x; yn = sz-y; break;
+	case 5:
+		xn = sz-x; yn = y; break;
+	case 6:
+		xn = sz-y; yn = x; break;
+	case 7:
+		xn = sz-y; yn = sz-x; break;
+	default:
+		errexit("impossible tra arg in transform0()");
+	}
+
+	*xx = xn;
+	*yy = yn;
+}
+
+static unsigned short *tables[TRAMAX+1];
+
+const unsigned short *
+movetra_table(int size) {
+	unsigned short *tab;
+	int tra, x, y, xn, yn;
+
+	if (size < 1 || size > TRAMAX)
+		return NULL;
+	if (tables[size])
+		return tables[size];
+
+	tab = xmalloc(8*TRAMAX*TRAMAX * sizeof(unsigned short));
+	for (tra=0; tra<8; tra++)
+		for (x=0; x<size; x++)
+			for (y=0; y<size; y++) {
+				xn = x;
+				yn = y;
+				transform0(&xn, &yn, tra, size);
+				tab[TRAPT(tra, x*TRAMAX+y)] =
+					((xn+'a') << 8) | (yn+'a');
+			}
+	/* another thread may have been first */
+	if (!__sync_bool_compare_and_swap(&tables[size], NULL, tab))
+		free(tab);
+	return tables[size];
+}
+
+int
+movetra_point(int size, int mv) {
+	int x, y;
+
+	if (size > TRAMAX)
+		return -1;
+	x = ((mv >> 8) & 0xff) - 'a';
+	y = (mv & 0xff) - 'a';
+	if (x < 0 || x >= size || y < 0 || y >= size)
+		return -1;
+	if (x == y && (x == 't'-'a' || x == 'z'-'a'))
+		return -1;	/* pass or tenuki on a large board */
+	return x*TRAMAX + y;
+}
+
+#define PRIME1	0x9e3779b185ebca87ULL
+#define PRIME2	0xc2b2ae3d27d4eb4fULL
+#define PRIME3	0x165667b19e3779f9ULL
+
+static unsigned long long
+round64(unsigned long long acc, unsigned long long w) {
+	acc += w * PRIME2;
+	acc = (acc << 31) | (acc >> 33);
+	return acc * PRIME1;
+}
+
+static unsigned long long
+avalanche(unsigned long long h) {
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+unsigned long long
+hash64_moves(const int *moves, int n) {
+	unsigned long long h, w;
+	int i;
+
+	h = PRIME3 + n;
+	w = 0;
+	for (i=0; i<n; i++) {
+		w |= (unsigned long long) (moves[i] & 0xffff) << (16*(i&3));
+		if ((i&3) == 3) {
+			h = round64(h, w);
+			w = 0;
+		}
+	}
+	if (n & 3)
+		h = round64(h, w);
+	return avalanche(h);
+}
+
+unsigned long long
+can64_moves(const int *moves, int n, int size, int *tra) {
+	const unsigned short *tab;
+	unsigned long long h[8], w[8], c, min;
+	int i, t, p, mint;
+
+	tab = movetra_table(size);
+	for (t=0; t<8; t++) {
+		h[t] = PRIME3 + n;
+		w[t] = 0;
+	}
+	for (i=0; i<n; i++) {
+		p = (tab ? movetra_point(size, moves[i]) : -1);
+		if (p < 0) {
+			c = (unsigned long long) (moves[i] & 0xffff)
+				<< (16*(i&3));
+			for (t=0; t<8; t++)
+				w[t] |= c;
+		} else {
+			for (t=0; t<8; t++)
+				w[t] |= (unsigned long long) tab[TRAPT(t, p)]
+					<< (16*(i&3));
+		}
+		if ((i&3) == 3 || i == n-1) {
+			for (t=0; t<8; t++) {
+				h[t] = round64(h[t], w[t]);
+				w[t] = 0;
+			}
+		}
+	}
+
+	mint = 0;
+	min = avalanche(h[0]);
+	for (t=1; t<8; t++) {
+		c = avalanche(h[t]);
+		if (c < min) {
+			min = c;
+			mint = t;
+		}
+	}
+	if (tra)
+		*tra = mint;
+	return min;
+}
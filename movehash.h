@@ -0,0 +1,13 @@
+/* transformation tables and fast hashes of move sequences */
+
+/* index of a point in a table: TRAPT(tra, x*TRAMAX+y) */
+#define TRAMAX	26
+#define TRAPT(tra, p)	((tra)*TRAMAX*TRAMAX + (p))
+
+extern void transform0(int *xx, int *yy, int tra, int size);
+extern const unsigned short *movetra_table(int size);
+extern int movetra_point(int size, int mv);
+
+extern unsigned long long hash64_moves(const int *moves, int n);
+extern unsigned long long can64_moves(const int *moves, int n, int size,
+				      int *tra);
@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include "readsgf.h"
+#include "sgfprop.h"
 #include "writesgf.h"
 #include "errexit.h"
 #include "xmalloc.h"
@@ -62,8 +63,10 @@ replace_propid(struct property *p) {
 
 	while (p) {
 		s = replacement(p->id);
-		if (s)
+		if (s) {
 			p->id = xstrdup(s);
+			p->tag = sgfprop_tag(s);
+		}
 		p = p->next;
 	}
 }
@@ -145,7 +148,7 @@ main(int argc, char **argv){
 
 	eof = 0;
 	readquietly = 1;
-	readsgf(NULL, &g);
+	sgf_readsgf(sgf_parser_new(sgf_default_flags()), NULL, &g);
 	handle_gametree_sequence(g);
 	writesgf(g, stdout);
 
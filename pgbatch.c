@@ -0,0 +1,138 @@
+/*
+ * pgbatch.c - replay many games with one call
+ *
+ * pg_replay_batch(games, n, nthreads, ya): replay games[0..n-1],
+ *  on nthreads threads, each with its own engine, and return the
+ *  index of the first game that failed (n if none). The mv[] arrays
+ *  are cut from one block in the arena ya. If hashes is set, the
+ *  mvct+1 position hashes of the game are copied there.
+ *
+ * A game in which an error is found gets failed = 1 (the message was
+ * printed as usual), and games after it are not replayed (failed = -1),
+ * as when they were replayed one by one. With more than one thread
+ * a few games after the failed one may have been replayed already.
+ * With nthreads <= 1 everything happens in the calling thread, so that
+ * a worker of some other thread pool can call this on its own games.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "playgogame.h"
+
+#define CHUNK	16	/* games taken by a thread at a time */
+
+struct batch {
+	struct pg_batchgame *games;
+	int n;
+	int next;		/* first game not yet taken */
+	int firstfail;		/* n if none */
+	pthread_mutex_t lock;
+};
+
+static __thread struct pg_engine *engine;
+
+static void
+replay_one(struct batch *b, int i) {
+	struct pg_batchgame *g = b->games + i;
+	const char *fn = infilename;
+	int ce = catch_errors, hj = have_jmpbuf;
+	jmp_buf jb;
+
+	memcpy(jb, jmpbuf, sizeof(jmp_buf));
+	g->failed = 1;
+	if (g->name)
+		infilename = g->name;
+	catch_errors = 1;
+	if (setjmp(jmpbuf))
+		goto out;
+	have_jmpbuf = 1;
+
+	if (engine == NULL)
+		engine = pg_new();
+	playgogame_r(engine, g->size, g->moves, g->mvct, g->initct, &g->pg);
+	if (g->hashes)
+		memcpy(g->hashes, pg_hashes(engine),
+		       (g->mvct + 1) * sizeof(unsigned long long));
+	g->failed = 0;
+out:
+	memcpy(jmpbuf, jb, sizeof(jmp_buf));
+	have_jmpbuf = hj;
+	catch_errors = ce;
+	infilename = fn;
+
+	if (g->failed) {
+		pthread_mutex_lock(&b->lock);
+		if (i < b->firstfail)
+			b->firstfail = i;
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+static void *
+replay_thread(void *arg) {
+	struct batch *b = arg;
+	int i, end;
+
+	while (1) {
+		pthread_mutex_lock(&b->lock);
+		i = b->next;
+		end = b->next = (i + CHUNK < b->n ? i + CHUNK : b->n);
+		if (i > b->firstfail)
+			i = end;
+		pthread_mutex_unlock(&b->lock);
+		if (i == end)
+			break;
+		for ( ; i < end; i++)
+			replay_one(b, i);
+	}
+	if (engine) {
+		pg_free(engine);
+		engine = NULL;
+	}
+	return NULL;
+}
+
+int
+pg_replay_batch(struct pg_batchgame *games, int n, int nthreads,
+		struct yarena *ya) {
+	struct batch b;
+	pthread_t *tids;
+	short int *mv;
+	long total;
+	int i;
+
+	/* at most one capture per stone placed */
+	total = 0;
+	for (i = 0; i < n; i++)
+		total += 2*games[i].mvct + 1;
+	mv = yamalloc(ya, total * sizeof(short int));
+	for (i = 0; i < n; i++) {
+		games[i].pg.mv = mv;
+		games[i].pg.mvlen = 2*games[i].mvct + 1;
+		mv += games[i].pg.mvlen;
+		games[i].failed = -1;
+	}
+
+	b.games = games;
+	b.n = n;
+	b.next = 0;
+	b.firstfail = n;
+	pthread_mutex_init(&b.lock, NULL);
+
+	if (nthreads <= 1 || n <= CHUNK) {
+		for (i = 0; i < n && b.firstfail == n; i++)
+			replay_one(&b, i);
+	} else {
+		tids = xmalloc(nthreads * sizeof(pthread_t));
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&tids[i], NULL, replay_thread, &b))
+				fatalexit("cannot create replay thread");
+		for (i = 0; i < nthreads; i++)
+			pthread_join(tids[i], NULL);
+		free(tids);
+	}
+	pthread_mutex_destroy(&b.lock);
+	return b.firstfail;
+}
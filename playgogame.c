@@ -21,18 +21,33 @@
  *
 void playgogame(int *moves, int mvct, int initct, struct played_game *pg);
  *
+ * playgogame_r() does the same, using the given engine, so that
+ * several threads can replay games at the same time.
+ *
+ * The engine also keeps a 64-bit Zobrist hash of the board, and
+ * records it after each move; pg_hashes(pe) gives these hashes for the
+ * last replay. With pg_set_canonical(pe, 1) it also keeps the hashes
+ * of the 8 rotations and reflections of the board, and
+ * pg_canonical_hashes(pe) gives the smallest of them, the same for
+ * all symmetric positions. The hashes also serve to detect cycles.
+ *
+ * An illegal move is an error; with pg_set_lenient(pe, 1) the replay
+ * stops there instead, and pg_illegal_move(pe) tells which move it was.
+ *
+ * pg_snapshots_new() keeps the board every K moves of a played game,
+ * and pg_position_at() gives the position after any move from these.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "errexit.h"
+#include "xmalloc.h"
 #include "playgogame.h"
 
-static struct played_game *pgg;
-
 /* board size is at most 31 (5 bits used for coord) */
 #define MAXSZ	31
-#define SZ	19	/* used only in definition of chains[] */
+#define SZ	19	/* larger boards are refused */
 #define D	(MAXSZ+1)
-static int sz, sz1;	/* sz and sz+1, probably 19 and 20 */
 
 #define BOARDSIZE	(D*(D+1))
 #define POS(i,j)	((i)*D+(j))	/* i,j in 1..19 */
@@ -46,20 +61,191 @@ static const int dirs[4] = { -1, 1, -D, D };
 #define WHITE	2
 #define BORDER	3
 
-static unsigned char board[BOARDSIZE];
-static int last_change[BOARDSIZE];	/* record last change for each pos */
-static int current_chain[BOARDSIZE];	/* defined for nonempty positions */
+/*
+ * Zobrist keys: zobrist[color][pos] for a stone, zobrist[EMPTY][size]
+ * for the board size, and zobrist[color][0] for a pass.
+ * Fixed, so that hashes can be stored in a data base.
+ */
+static unsigned long long zobrist[3][BOARDSIZE];
+
+__attribute__ ((constructor))
+static void
+init_zobrist(void) {
+	unsigned long long x = 0x5eed2013, z;
+	int c, i;
+
+	for (c = 0; c < 3; c++) {
+		for (i = 0; i < BOARDSIZE; i++) {
+			/* splitmix64 */
+			z = (x += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			zobrist[c][i] = z ^ (z >> 31);
+		}
+	}
+}
+
+/*
+ * All state of a single replay, so that several threads can
+ * each replay their own games (see sgfdb -j).
+ */
+struct pg_engine {
+	struct played_game *pgg;
+	int sz, sz1;		/* sz and sz+1, probably 19 and 20 */
+	unsigned char board[BOARDSIZE];
+	int last_change[BOARDSIZE];	/* record last change for each pos */
+	int cursz;			/* size of the board as set up */
+	short dirty[BOARDSIZE];		/* positions played on this game */
+	int ndirty;
+	unsigned char isdirty[BOARDSIZE];
+
+	/*
+	 * Chains, defined for nonempty positions. The stones of a chain
+	 * form a ring: next[s] is the next stone, and starting at
+	 * next[tail] they come in the order in which they were added.
+	 * The chain of s is found by following parent[] to the root,
+	 * where tail, the number of stones and the liberties (the sum
+	 * of the liberties of all stones) are kept.
+	 * A chain is identified by its root, so chains need no
+	 * allocation, and merging two chains costs O(1).
+	 */
+	short parent[BOARDSIZE];
+	short next[BOARDSIZE];
+	short tail[BOARDSIZE];
+	short chsz[BOARDSIZE];
+	short liberties[BOARDSIZE];
+
+	unsigned long long hash;	/* of the board */
+	unsigned long long passhash;	/* of the passes, for cycles */
+	int canonical;			/* keep thash[] */
+	int quiet;			/* no check_for_cycles() */
+	int lenient;			/* stop at an illegal move */
+	int illegal;			/* that move, or -1 */
+	unsigned long long thash[8];	/* of the transformed boards */
+	short tra[8][BOARDSIZE];	/* the transformations for trasize */
+	int trasize;
+
+	/* after 0, 1, ... moves */
+	unsigned long long *hashes, *chashes, *ckeys;
+	int hashmax;
+	int *cyctab;			/* for check_for_cycles() */
+	int cyctabsz;
+};
+
+struct pg_engine *
+pg_new(void) {
+	struct pg_engine *pe;
+
+	pe = xmalloc(sizeof(struct pg_engine));
+	pe->cursz = -1;
+	pe->canonical = 0;
+	pe->quiet = 0;
+	pe->lenient = 0;
+	pe->illegal = -1;
+	pe->trasize = 0;
+	pe->hashes = pe->chashes = pe->ckeys = NULL;
+	pe->hashmax = 0;
+	pe->cyctab = NULL;
+	pe->cyctabsz = 0;
+	return pe;
+}
+
+void
+pg_free(struct pg_engine *pe) {
+	free(pe->hashes);
+	free(pe->chashes);
+	free(pe->ckeys);
+	free(pe->cyctab);
+	free(pe);
+}
+
+void
+pg_set_canonical(struct pg_engine *pe, int on) {
+	pe->canonical = on;
+}
+
+void
+pg_set_quiet(struct pg_engine *pe, int on) {
+	pe->quiet = on;
+}
+
+void
+pg_set_lenient(struct pg_engine *pe, int on) {
+	pe->lenient = on;
+}
+
+int
+pg_illegal_move(struct pg_engine *pe) {
+	return pe->illegal;
+}
+
+/* with pg_set_lenient(): remember the move and stop; else give up */
+static int
+stop_lenient(struct pg_engine *pe, int movenr) {
+	if (!pe->lenient)
+		return 0;
+	if (pe->illegal < 0)
+		pe->illegal = movenr;
+	return 1;
+}
+
+const unsigned long long *
+pg_hashes(struct pg_engine *pe) {
+	return pe->hashes;
+}
+
+const unsigned long long *
+pg_canonical_hashes(struct pg_engine *pe) {
+	return pe->canonical ? pe->chashes : NULL;
+}
+
+/* the 8 symmetries of a size x size board */
+static void
+init_tra(struct pg_engine *pe, int size) {
+	int t, x, y, u, v;
+
+	for (t = 0; t < 8; t++) {
+		for (x = 1; x <= size; x++) {
+			for (y = 1; y <= size; y++) {
+				u = ((t & 1) ? size+1-x : x);
+				v = ((t & 2) ? size+1-y : y);
+				pe->tra[t][POS(x,y)] =
+					((t & 4) ? POS(v,u) : POS(u,v));
+			}
+		}
+	}
+	pe->trasize = size;
+}
+
+/* a stone of the given color appears or disappears at s */
+static inline void
+toggle_hash(struct pg_engine *pe, int color, int s) {
+	int t;
+
+	pe->hash ^= zobrist[color][s];
+	if (pe->canonical)
+		for (t = 0; t < 8; t++)
+			pe->thash[t] ^= zobrist[color][pe->tra[t][s]];
+}
 
-/* probably insufficient for large boards... */
-#define CHAINMAX	500
-struct chain {
-	int liberties;		/* sum of liberties for all stones */
-	int sz;			/* number of stones */
-	short int stones[SZ*SZ];/* actual stones */
-} chains[CHAINMAX];		/* < 500 kB */
-int chainct;
+/* the position after c moves (and setup stones) */
+static void
+record_hash(struct pg_engine *pe, int c) {
+	unsigned long long h;
+	int t;
+
+	pe->hashes[c] = pe->hash;
+	pe->ckeys[c] = pe->hash ^ pe->passhash;
+	if (pe->canonical) {
+		h = pe->thash[0];
+		for (t = 1; t < 8; t++)
+			if (pe->thash[t] < h)
+				h = pe->thash[t];
+		pe->chashes[c] = h;
+	}
+}
 
-static void init(int size) {
+static void init(struct pg_engine *pe, int size) {
 	int i, d;
 
 	/*
@@ -68,265 +254,316 @@ static void init(int size) {
 	 */
 	if (size > MAXSZ || size > SZ)
 		errexit("unsupported board size %d", size);
-	sz = size;
-	sz1 = d = size+1;
-
-	for (i=0; i < BOARDSIZE; i++)
-		board[i] = EMPTY;
-	for (i=0; i < d; i++)
-		board[i] = BORDER;
-	for (i=d; i <= D*d; i += D)
-		board[i] = BORDER;
-	for (i=D; i <= D*d; i += D)
-		board[i] = BORDER;
-	for (i=1; i < d; i++)
-		board[D*d+i] = BORDER;
+	pe->sz = size;
+	pe->sz1 = d = size+1;
 
-	for (i=0; i < BOARDSIZE; i++)
-		last_change[i] = 0;
-
-	chainct = 0;
+	/*
+	 * Usually the previous game had the same size, and only
+	 * the positions played on have to be cleared. last_change[]
+	 * is only looked at for positions played on in this game.
+	 */
+	if (size == pe->cursz) {
+		for (i=0; i < pe->ndirty; i++) {
+			pe->board[pe->dirty[i]] = EMPTY;
+			pe->isdirty[pe->dirty[i]] = 0;
+		}
+	} else {
+		for (i=0; i < BOARDSIZE; i++) {
+			pe->board[i] = EMPTY;
+			pe->isdirty[i] = 0;
+			pe->last_change[i] = 0;
+		}
+		for (i=0; i < d; i++)
+			pe->board[i] = BORDER;
+		for (i=d; i <= D*d; i += D)
+			pe->board[i] = BORDER;
+		for (i=D; i <= D*d; i += D)
+			pe->board[i] = BORDER;
+		for (i=1; i < d; i++)
+			pe->board[D*d+i] = BORDER;
+		pe->cursz = size;
+	}
+	pe->ndirty = 0;
+
+	pe->hash = zobrist[EMPTY][size];
+	pe->passhash = 0;
+	if (pe->canonical) {
+		if (pe->trasize != size)
+			init_tra(pe, size);
+		for (i=0; i<8; i++)
+			pe->thash[i] = pe->hash;
+	}
 
 	for (i=0; i<3; i++)
-		pgg->counts[i] = 0;
-	pgg->mvct = 0;
+		pe->pgg->counts[i] = 0;
+	pe->pgg->mvct = 0;
 }
 
 static inline void
-add_mv(short int m) {
-	if (pgg->mvct == pgg->mvlen)
+add_mv(struct pg_engine *pe, short int m) {
+	if (pe->pgg->mvct == pe->pgg->mvlen)
 		errexit("played_game array overflow");
-	pgg->mv[pgg->mvct++] = m;
+	pe->pgg->mv[pe->pgg->mvct++] = m;
 }
 
 static void
-add_move(int s) {
+add_move(struct pg_engine *pe, int s) {
 	int color;
 	short int m;
 
-	color = board[s];
+	color = pe->board[s];
 	m = s | (color << 10);
 
-	pgg->counts[0]++;
+	pe->pgg->counts[0]++;
+	toggle_hash(pe, color, s);
 
-	last_change[s] = pgg->mvct;
-	add_mv(m);
+	pe->last_change[s] = pe->pgg->mvct;
+	add_mv(pe, m);
 }
 
 static void
-add_antimove(int s) {
+add_antimove(struct pg_engine *pe, int s) {
 	int color;
 	short int m;
 
-	color = board[s];
-	board[s] = EMPTY;
+	color = pe->board[s];
+	pe->board[s] = EMPTY;
 	m = s | (color << 10) | PG_CAPTURE;
 
-	pgg->counts[color]++;
+	pe->pgg->counts[color]++;
+	toggle_hash(pe, color, s);
 
-	last_change[s] = pgg->mvct;
-	add_mv(m);
+	pe->last_change[s] = pe->pgg->mvct;
+	add_mv(pe, m);
 }
 
 static void
-add_pass(int color) {
+add_pass(struct pg_engine *pe, int color) {
 	short int m;
 
 	m = (color << 10) | PG_PASS;
-	pgg->counts[0]++;	/* count as a move */
-	add_mv(m);
+	pe->pgg->counts[0]++;	/* count as a move */
+	pe->passhash ^= zobrist[color][0];
+	add_mv(pe, m);
 }
 
 #include <stdio.h>
 
-/* merge ch1 into probably larger ch */
+static inline int
+find_chain(struct pg_engine *pe, int s) {
+	while (pe->parent[s] != s) {
+		pe->parent[s] = pe->parent[pe->parent[s]];
+		s = pe->parent[s];
+	}
+	return s;
+}
+
+/* merge ch1 into ch: the stones of ch1 come after those of ch */
 static int
-merge_chains(int ch, int ch1) {
-	struct chain *chp, *chp1;
-	int i, j, s;
-
-	chp = chains + ch;
-	chp1 = chains + ch1;
-
-	chp->liberties += chp1->liberties;
-	i = chp->sz;
-	for (j = 0; j < chp1->sz; j++) {
-		chp->stones[i++] = s = chp1->stones[j];
-		current_chain[s] = ch;
+merge_chains(struct pg_engine *pe, int ch, int ch1) {
+	int t, t1, h, root, child;
+
+	/* splice the rings */
+	t = pe->tail[ch];
+	t1 = pe->tail[ch1];
+	h = pe->next[t];
+	pe->next[t] = pe->next[t1];
+	pe->next[t1] = h;
+
+	/* the larger chain stays root */
+	if (pe->chsz[ch] >= pe->chsz[ch1]) {
+		root = ch;
+		child = ch1;
+	} else {
+		root = ch1;
+		child = ch;
 	}
-	chp->sz = i;
+	pe->parent[child] = root;
+	pe->tail[root] = t1;
+	pe->chsz[root] = pe->chsz[ch] + pe->chsz[ch1];
+	pe->liberties[root] = pe->liberties[ch] + pe->liberties[ch1];
 
-	return ch;
+	return root;
 }
 
 static void
-remove_chain(int ch) {
-	struct chain *chp;
-	int i, j, s, t;
-
-	chp = chains + ch;
+remove_chain(struct pg_engine *pe, int ch) {
+	int i, s, t, head;
 
-	for (j = 0; j < chp->sz; j++) {
-		s = chp->stones[j];
-		add_antimove(s);
+	head = s = pe->next[pe->tail[ch]];
+	do {
+		add_antimove(pe, s);
 
 		for (i=0; i<4; i++) {
 			t = s + dirs[i];
-			if (board[t] == WHITE || board[t] == BLACK)
-				chains[current_chain[t]].liberties++;
+			if (pe->board[t] == WHITE || pe->board[t] == BLACK)
+				pe->liberties[find_chain(pe, t)]++;
 		}
-	}
+		s = pe->next[s];
+	} while (s != head);
 }
 
-static void check_retake_in_ko(int movenr) {
+static void check_retake_in_ko(struct pg_engine *pe, int movenr) {
 	int hist[4], i;
 
 	/* test situation:
 	   B plays at a and captures a single stone at b
 	   W plays at b and captures a single stone at a */
-	if (pgg->mvct < 4)
+	if (pe->pgg->mvct < 4)
 		return;
 	for (i=0; i<4; i++)
-		hist[i] = pgg->mv[pgg->mvct-4+i];
+		hist[i] = pe->pgg->mv[pe->pgg->mvct-4+i];
 	if ((hist[0] & PG_CAPTURE) || (hist[2] & PG_CAPTURE) ||
 	    !(hist[1] & PG_CAPTURE) || !(hist[3] & PG_CAPTURE))
 		return;
 	if ((hist[0] & 0x3ff) == (hist[3] & 0x3ff) &&
-	    (hist[1] & 0x3ff) == (hist[2] & 0x3ff))
+	    (hist[1] & 0x3ff) == (hist[2] & 0x3ff) &&
+	    !stop_lenient(pe, movenr))
 		errexit("move %d: illegal ko recapture", movenr);
 }
 
-static void do_move(int color, int x, int y, int movenr) {
-	int other_color, xy, i, nbr, *cc, ch, ch2, ll;
+static void do_move(struct pg_engine *pe, int color, int x, int y,
+		    int movenr) {
+	int other_color, xy, i, nbr, ch, ch2, ll;
 	unsigned char *p;
-	struct chain *cp, *cp2;
 
-	if (x == sz1 && y == sz1) {
-		add_pass(color);
+	if (x == pe->sz1 && y == pe->sz1) {
+		add_pass(pe, color);
 		return;
 	}
 
 	/* sometimes 'tt' is also used on smaller boards */
-	if (x == 20 && y == 20 && sz1 < 20) {
-		add_pass(color);
+	if (x == 20 && y == 20 && pe->sz1 < 20) {
+		add_pass(pe, color);
 		return;
 	}
 
-	if (x < 1 || x > sz || y < 1 || y > sz)
+	if (x < 1 || x > pe->sz || y < 1 || y > pe->sz) {
+		if (stop_lenient(pe, movenr))
+			return;
 		errexit("move %d: bad move cordinates %d,%d", movenr, x, y);
+	}
 	xy = POS(x,y);
 
-	p = &(board[xy]);
-	if (*p != EMPTY)
+	p = &(pe->board[xy]);
+	if (*p != EMPTY) {
+		if (stop_lenient(pe, movenr))
+			return;
 		errexit("move %d: play on nonempty position", movenr);
+	}
 	*p = color;
+	if (!pe->isdirty[xy]) {
+		pe->isdirty[xy] = 1;
+		pe->dirty[pe->ndirty++] = xy;
+	}
 
-	add_move(xy);
-
-	/* should re-use chains, so that SZ*SZ suffices */
-	if (chainct == CHAINMAX)
-		errexit("CHAINMAX overflow");
+	add_move(pe, xy);
 
-	cc = &(current_chain[xy]);
-	*cc = ch = chainct++;
-	cp = &(chains[ch]);
-	cp->liberties = 0;
-	cp->sz = 1;
-	cp->stones[0] = xy;
+	/* a new chain, with root xy */
+	ch = xy;
+	pe->parent[xy] = pe->next[xy] = pe->tail[xy] = xy;
+	pe->chsz[xy] = 1;
+	pe->liberties[xy] = 0;
 
 	other_color = (BLACK+WHITE-color);
 
 	for (i=0; i<4; i++) {
 		nbr = p[dirs[i]];
 		if (nbr == EMPTY)
-			cp->liberties++;
+			pe->liberties[ch]++;
 		else if (nbr != BORDER) {
-			ch2 = cc[dirs[i]];
-			cp2 = &(chains[ch2]);
-			ll = --(cp2->liberties);
+			ch2 = find_chain(pe, xy + dirs[i]);
+			ll = --(pe->liberties[ch2]);
 
 			if (nbr == other_color) {
 				if (ll == 0)
-					remove_chain(ch2);
-				check_retake_in_ko(movenr);
+					remove_chain(pe, ch2);
+				check_retake_in_ko(pe, movenr);
 			} else {
-				if (ch2 != ch) {
-					ch = merge_chains(ch2, ch);
-					cp = &(chains[ch]);
-				}
+				if (ch2 != ch)
+					ch = merge_chains(pe, ch2, ch);
 			}
 		}
 	}
-	if (cp->liberties == 0) {
-		if (cp->sz == 1) {
+	if (pe->liberties[ch] == 0) {
+		if (stop_lenient(pe, movenr))
+			return;
+		if (pe->chsz[ch] == 1) {
 			/* this seems to be forbidden in all rulesets */
 			errexit("move %d: suicide", movenr);
 		} else {
 			/* maybe warn(), depending on the rules,
 			   but so far I have not seen any examples */
 			errexit("move %d: mass suicide", movenr);
-			remove_chain(ch);
+			remove_chain(pe, ch);
 		}
 	}
 }
 
-static void check_for_cycles() {
-	int i, j, k, m, ct, nri, nrj;
-	int diff[2*SZ*SZ], diffct;
-
-	/* we already checked for ko - check here for longer cycles;
-	   this is allowed under Japanese but not under Chinese rules
-	   (so only warn) */
-
-	ct = pgg->mvct;
-	nri = 0;
-
-	for (i = 0; i < ct; i++) {
-		if (pgg->mv[i] & PG_CAPTURE)
-			continue;
-		nri++;
-		diffct = 0;
-
-		/* see whether the situation at the start of move i
-		   occurs later */
-		nrj = nri-1;
-		for (j=i; j<ct; j++) {
-			m = pgg->mv[j];
-			if (!(m & PG_CAPTURE))
-				nrj++;
-			for (k=0; k<diffct; k++) {
-				/* same color, same position? */
-				if ((diff[k] & 0xfff) == (m & 0xfff)) {
-					diff[k] = diff[--diffct];
-					goto check;
-				}
-			}
-			if (m & PG_PERMANENT)
+/*
+ * We already checked for ko - check here for longer cycles;
+ * this is allowed under Japanese but not under Chinese rules
+ * (so only warn). Report the earliest position that recurs,
+ * and where it first recurs.
+ *
+ * A position is compared by its hash, together with the passes
+ * made so far (two passes by the same player cancel).
+ */
+static void check_for_cycles(struct pg_engine *pe, int n) {
+	unsigned long long h;
+	int c, e, i, mask, first, again;
+
+	if (pe->cyctabsz < 2*(n+1)) {
+		while (pe->cyctabsz < 2*(n+1))
+			pe->cyctabsz = (pe->cyctabsz ? 2*pe->cyctabsz : 1024);
+		free(pe->cyctab);
+		pe->cyctab = xmalloc(pe->cyctabsz * sizeof(int));
+	}
+	mask = pe->cyctabsz - 1;
+	memset(pe->cyctab, 0, pe->cyctabsz * sizeof(int));
+
+	first = again = -1;
+	for (c = 0; c <= n; c++) {
+		h = pe->ckeys[c];
+		i = h & mask;
+		while (pe->cyctab[i]) {
+			e = pe->cyctab[i] - 1;
+			if (pe->ckeys[e] == h)
 				break;
-			diff[diffct++] = m;
-			continue;
-		check:
-			if (diffct)
-				continue;
-			if (j+1 < ct && (pgg->mv[j+1] & PG_CAPTURE))
-				continue;
-			warn("cycle: position after move %d "
-			     "equals that after move %d",
-			     nrj, nri-1);
-			return;
+			i = (i+1) & mask;
+		}
+		if (!pe->cyctab[i])
+			pe->cyctab[i] = c+1;
+		else if (first < 0 || e < first) {
+			first = e;
+			again = c;
 		}
 	}
+	if (first >= 0)
+		warn("cycle: position after move %d "
+		     "equals that after move %d",
+		     again, first);
 }
 
-void playgogame(int size, int *moves, int mvct, int initct,
-		struct played_game *pg) {
-	int i, m, s, ct;
+void playgogame_r(struct pg_engine *pe, int size, int *moves, int mvct,
+		  int initct, struct played_game *pg) {
+	int i, m, s, ct, n;
 	short int color;
 	unsigned char x, y;
 
-	pgg = pg;
+	pe->pgg = pg;
+	pe->illegal = -1;
 
-	init(size);
+	init(pe, size);
+
+	if (mvct+1 > pe->hashmax) {
+		pe->hashmax = mvct+1;
+		n = pe->hashmax * sizeof(unsigned long long);
+		pe->hashes = xrealloc(pe->hashes, n);
+		pe->chashes = xrealloc(pe->chashes, n);
+		pe->ckeys = xrealloc(pe->ckeys, n);
+	}
+	record_hash(pe, 0);
 
 	for (i=0; i<mvct; i++) {
 		m = moves[i];
@@ -335,16 +572,199 @@ void playgogame(int size, int *moves, int mvct, int initct,
 		y = m;
 		x -= ('a' - 1);
 		y -= ('a' - 1);
-		do_move(color, x, y, (i >= initct) ? i-initct+1 : 0);
+		do_move(pe, color, x, y, (i >= initct) ? i-initct+1 : 0);
+		if (pe->illegal >= 0)
+			return;		/* pg->mv[] is incomplete */
+		record_hash(pe, i+1);
 	}
 
-	ct = pgg->mvct;
+	ct = pe->pgg->mvct;
 	for (i = 0; i < ct; i++) {
-		m = pgg->mv[i];
+		m = pe->pgg->mv[i];
 		s = (m & 0x3ff);
-		if (last_change[s] == i)
-			pgg->mv[i] = m | PG_PERMANENT;
+		if (pe->last_change[s] == i)
+			pe->pgg->mv[i] = m | PG_PERMANENT;
 	}
 
-	check_for_cycles();
+	if (!pe->quiet)
+		check_for_cycles(pe, mvct);
+}
+
+/* single-threaded callers share one engine */
+void playgogame(int size, int *moves, int mvct, int initct,
+		struct played_game *pg) {
+	static struct pg_engine *pe;
+
+	if (pe == NULL)
+		pe = pg_new();
+	playgogame_r(pe, size, moves, mvct, initct, pg);
+}
+
+/*
+ * The hash of the position with the given stones (in the format
+ * of moves[]), as it would be found by pg_hashes(), or with
+ * canonical set, by pg_canonical_hashes().
+ */
+unsigned long long
+pg_position_hash(int size, int *stones, int n, int canonical) {
+	struct pg_engine *pe;
+	struct played_game game;
+	unsigned long long h;
+
+	pe = pg_new();
+	pg_set_canonical(pe, canonical);
+	pg_set_quiet(pe, 1);
+	game.mvlen = 2*n+1;
+	game.mv = xmalloc(game.mvlen * sizeof(short int));
+	playgogame_r(pe, size, stones, n, n, &game);
+	h = (canonical ? pe->chashes[n] : pe->hashes[n]);
+	free(game.mv);
+	pg_free(pe);
+	return h;
+}
+
+/*
+ * Snapshots: the board after 0, K, 2K, ... moves and after the last
+ * move, 2 bits per point.
+ * The position after move m is found from the nearest snapshot,
+ * going forward through mv[], or backward using the antimoves:
+ * a capture puts the stone back, a move removes it.
+ */
+struct pg_snapshots {
+	int size, every, ct, nmoves;
+	const short int *mv;
+	int mvct;
+	int *mvidx;		/* snapshot c is the board before mv[mvidx[c]] */
+	unsigned char *boards;	/* ct boards of bsz bytes */
+	int bsz;
+};
+
+/* play (or with undo set, take back) a single entry of mv[] */
+static inline void
+snap_apply(unsigned char *board, int m, int undo) {
+	if (m & PG_PASS)
+		return;
+	if (((m & PG_CAPTURE) != 0) == undo)
+		board[m & 0x3ff] = ((m >> 10) & 3);
+	else
+		board[m & 0x3ff] = EMPTY;
+}
+
+static void
+snap_save(struct pg_snapshots *ps, unsigned char *board, int i) {
+	unsigned char *b;
+	int x, y, k;
+
+	ps->mvidx[ps->ct] = i;
+	b = ps->boards + ps->ct * ps->bsz;
+	memset(b, 0, ps->bsz);
+	k = 0;
+	for (x = 1; x <= ps->size; x++)
+		for (y = 1; y <= ps->size; y++, k++)
+			b[k/4] |= board[POS(x,y)] << (2*(k%4));
+	ps->ct++;
+}
+
+static void
+snap_restore(struct pg_snapshots *ps, int c, unsigned char *board) {
+	unsigned char *b;
+	int x, y, k;
+
+	memset(board, 0, PG_BOARDSZ);
+	b = ps->boards + c * ps->bsz;
+	k = 0;
+	for (x = 1; x <= ps->size; x++)
+		for (y = 1; y <= ps->size; y++, k++)
+			board[POS(x,y)] = (b[k/4] >> (2*(k%4))) & 3;
+}
+
+struct pg_snapshots *
+pg_snapshots_new(int size, const short int *mv, int mvct, int initct,
+		 int every) {
+	struct pg_snapshots *ps;
+	unsigned char board[PG_BOARDSZ];
+	int i, n, nmoves;
+
+	if (size < 1 || size > MAXSZ)
+		errexit("snapshots: bad board size %d", size);
+	if (every < 1)
+		every = 1;
+
+	nmoves = -initct;
+	for (i = 0; i < mvct; i++)
+		if (!(mv[i] & PG_CAPTURE))
+			nmoves++;
+	if (nmoves < 0)
+		nmoves = 0;
+
+	ps = xmalloc(sizeof(struct pg_snapshots));
+	ps->size = size;
+	ps->every = every;
+	ps->nmoves = nmoves;
+	ps->mv = mv;
+	ps->mvct = mvct;
+	ps->bsz = (size*size + 3)/4;
+	ps->ct = 0;
+	n = nmoves/every + 2;
+	ps->mvidx = xmalloc(n * sizeof(int));
+	ps->boards = xmalloc(n * ps->bsz);
+
+	memset(board, 0, sizeof(board));
+	n = -initct;
+	for (i = 0; i < mvct; i++) {
+		if (!(mv[i] & PG_CAPTURE)) {
+			if (n >= 0 && n % every == 0)
+				snap_save(ps, board, i);
+			n++;
+		}
+		snap_apply(board, mv[i], 0);
+	}
+	snap_save(ps, board, mvct);	/* the final position */
+	return ps;
+}
+
+void
+pg_snapshots_free(struct pg_snapshots *ps) {
+	free(ps->mvidx);
+	free(ps->boards);
+	free(ps);
+}
+
+int
+pg_position_at(struct pg_snapshots *ps, int m, unsigned char *board) {
+	int c, i, n, e;
+
+	if (m < 0)
+		m = 0;
+	if (m > ps->nmoves)
+		m = ps->nmoves;
+	/* snapshot c is at move c*K, except the last one, at nmoves */
+	c = m / ps->every;
+	n = c * ps->every;
+	if (c+1 < ps->ct) {
+		e = (c+1 == ps->ct-1) ? ps->nmoves : n + ps->every;
+		if (e - m < m - n) {
+			c++;
+			n = e;
+		}
+	}
+
+	snap_restore(ps, c, board);
+	i = ps->mvidx[c];
+	while (n > m) {
+		e = ps->mv[--i];
+		snap_apply(board, e, 1);
+		if (!(e & PG_CAPTURE))
+			n--;
+	}
+	for ( ; i < ps->mvct; i++) {
+		e = ps->mv[i];
+		if (!(e & PG_CAPTURE)) {
+			if (n == m)
+				break;
+			n++;
+		}
+		snap_apply(board, e, 0);
+	}
+	return m;
 }
@@ -13,3 +13,53 @@ struct played_game {
 
 void playgogame(int size, int *moves, int mvct, int initct,
 		struct played_game *pg);
+
+/* board and chain state of a replay; one per thread */
+struct pg_engine;
+extern struct pg_engine *pg_new(void);
+extern void pg_free(struct pg_engine *pe);
+void playgogame_r(struct pg_engine *pe, int size, int *moves, int mvct,
+		  int initct, struct played_game *pg);
+
+/* stop at an illegal move; its number (0: setup), or -1 if none */
+extern void pg_set_lenient(struct pg_engine *pe, int on);
+extern int pg_illegal_move(struct pg_engine *pe);
+
+/* Zobrist hashes of the positions after 0, 1, ..., mvct moves */
+extern void pg_set_canonical(struct pg_engine *pe, int on);
+extern void pg_set_quiet(struct pg_engine *pe, int on);	/* no warnings */
+extern const unsigned long long *pg_hashes(struct pg_engine *pe);
+extern const unsigned long long *pg_canonical_hashes(struct pg_engine *pe);
+extern unsigned long long pg_position_hash(int size, int *stones, int n,
+					   int canonical);
+
+/*
+ * Board checkpoints every K moves of a played game (K = every) and
+ * after its last move, so that the position after move m is found by
+ * replaying or taking back at most K/2 moves (with their captures)
+ * of mv[]. The mv[] array is not copied and must stay around.
+ * pg_position_at() fills board[32*x+y] (x,y in 1..size) with
+ * 0 (empty), 1 (black), 2 (white), and returns m, clamped to the
+ * number of moves.
+ */
+#define PG_BOARDSZ	1024
+struct pg_snapshots;
+extern struct pg_snapshots *pg_snapshots_new(int size, const short int *mv,
+					     int mvct, int initct, int every);
+extern void pg_snapshots_free(struct pg_snapshots *ps);
+extern int pg_position_at(struct pg_snapshots *ps, int m,
+			  unsigned char *board);
+
+/* replay many games at once (pgbatch.c); see there */
+struct yarena;
+struct pg_batchgame {
+	const char *name;		/* for error messages, or NULL */
+	int size;
+	int *moves;
+	int mvct, initct;
+	unsigned long long *hashes;	/* mvct+1 entries, or NULL */
+	struct played_game pg;		/* output; pg.mv from the arena */
+	int failed;
+};
+extern int pg_replay_batch(struct pg_batchgame *g, int n, int nthreads,
+			   struct yarena *ya);
@@ -0,0 +1,776 @@
+/*
+ * raster.c - draw go diagrams in memory, and write them as PNG
+ *
+ * r = raster_new(w, h, bg): a w x h image filled with color bg
+ *  (NULL if out of memory)
+ * raster_dup(r): a copy of r (NULL if out of memory)
+ * raster_clip(r, x1, y1, x2, y2): draw only inside this rectangle
+ *  (initially the whole image)
+ * raster_copy(r, src, x1, y1, x2, y2): copy a rectangle from src,
+ *  an image of the same size
+ * raster_line(r, x1, y1, x2, y2, color): a line of width 1
+ * raster_rect(r, x1, y1, x2, y2, color): a filled rectangle
+ * raster_circle(r, cx, cy, rad, fill, stroke): a disk filled with fill
+ *  and an outline of width 1 in stroke (either may be NOCOLOR)
+ * raster_text(r, cx, cy, s, size, color): the string s centered
+ *  at cx,cy; size is as a pointsize for convert (about 10 pixels
+ *  of digit height for size 14)
+ * raster_write_png(r, f): returns 0, or -1 on an error
+ * a = raster_anim_start(f, w, h), raster_anim_frame(a, r, x1, y1, x2, y2,
+ *  delay), raster_anim_end(a): write an animated PNG, frame by frame;
+ *  a frame after the first need only give the rectangle that changed
+ * raster_color(name): black, white, red, none or #rrggbb (possibly
+ *  quoted, as in a convert command), or NOCOLOR
+ *
+ * Integer coordinates are pixel centers. Circles and text are
+ * antialiased by their pixel coverage; text uses a built-in 5x7 font,
+ * scaled. The PNG encoder needs only zlib.
+ *
+ * All functions may be called from several threads at once, on
+ * different rasters. The coverage of a disk centered at a pixel is
+ * computed once per radius, that of a string centered at a pixel once
+ * per string and size, and shared.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+#include "raster.h"
+
+struct raster *
+raster_new(int w, int h, int bg) {
+	struct raster *r;
+	unsigned char *p;
+	int i;
+
+	r = malloc(sizeof(*r));
+	if (r == NULL)
+		return NULL;
+	r->w = w;
+	r->h = h;
+	raster_clip(r, 0, 0, w-1, h-1);
+	r->pix = malloc((size_t) 3*w*h);
+	if (r->pix == NULL) {
+		free(r);
+		return NULL;
+	}
+	for (i = 0, p = r->pix; i < w*h; i++) {
+		*p++ = bg >> 16;
+		*p++ = bg >> 8;
+		*p++ = bg;
+	}
+	return r;
+}
+
+struct raster *
+raster_dup(struct raster *r) {
+	struct raster *d;
+
+	d = malloc(sizeof(*d));
+	if (d == NULL)
+		return NULL;
+	*d = *r;
+	d->pix = malloc((size_t) 3*r->w*r->h);
+	if (d->pix == NULL) {
+		free(d);
+		return NULL;
+	}
+	memcpy(d->pix, r->pix, (size_t) 3*r->w*r->h);
+	raster_clip(d, 0, 0, r->w-1, r->h-1);
+	return d;
+}
+
+void
+raster_clip(struct raster *r, int x1, int y1, int x2, int y2) {
+	r->cx1 = (x1 < 0) ? 0 : x1;
+	r->cy1 = (y1 < 0) ? 0 : y1;
+	r->cx2 = (x2 >= r->w) ? r->w - 1 : x2;
+	r->cy2 = (y2 >= r->h) ? r->h - 1 : y2;
+}
+
+void
+raster_copy(struct raster *r, struct raster *src, int x1, int y1,
+	    int x2, int y2) {
+	int y;
+
+	if (x1 < 0)
+		x1 = 0;
+	if (y1 < 0)
+		y1 = 0;
+	if (x2 >= r->w)
+		x2 = r->w - 1;
+	if (y2 >= r->h)
+		y2 = r->h - 1;
+	for (y = y1; y <= y2 && x1 <= x2; y++)
+		memcpy(r->pix + 3*((long) y*r->w + x1),
+		       src->pix + 3*((long) y*r->w + x1), 3*(x2-x1+1));
+}
+
+void
+raster_free(struct raster *r) {
+	free(r->pix);
+	free(r);
+}
+
+int
+raster_color(const char *name) {
+	static const struct { const char *name; int color; } colors[] = {
+		{ "black", 0x000000 },
+		{ "white", 0xffffff },
+		{ "red", 0xff0000 },
+		{ "none", NOCOLOR },
+	};
+	char buf[20], *end;
+	int i, n;
+
+	n = strlen(name);
+	if (n >= 2 && n < sizeof(buf) &&
+	    (*name == '\'' || *name == '"') && name[n-1] == *name) {
+		memcpy(buf, name+1, n-2);
+		buf[n-2] = 0;
+		name = buf;
+	}
+	for (i = 0; i < sizeof(colors)/sizeof(colors[0]); i++)
+		if (!strcmp(name, colors[i].name))
+			return colors[i].color;
+	if (*name == '#' && strlen(name) == 7) {
+		n = strtol(name+1, &end, 16);
+		if (*end == 0)
+			return n;
+	}
+	return NOCOLOR;
+}
+
+/* mix color into pixel x,y with weight a (0..1) */
+static inline void
+blend(struct raster *r, int x, int y, int color, double a) {
+	unsigned char *p;
+	int k, c;
+
+	if (x < r->cx1 || y < r->cy1 || x > r->cx2 || y > r->cy2 || a <= 0)
+		return;
+	if (a > 1)
+		a = 1;
+	p = r->pix + 3*(y*r->w + x);
+	for (k = 0; k < 3; k++) {
+		c = (color >> (16 - 8*k)) & 0xff;
+		p[k] = p[k] + a*(c - p[k]) + 0.5;
+	}
+}
+
+void
+raster_rect(struct raster *r, int x1, int y1, int x2, int y2, int color) {
+	int x, y;
+
+	if (color == NOCOLOR)
+		return;
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++)
+			blend(r, x, y, color, 1);
+}
+
+void
+raster_line(struct raster *r, int x1, int y1, int x2, int y2, int color) {
+	int dx, dy, sx, sy, err, e2;
+
+	if (color == NOCOLOR)
+		return;
+	dx = abs(x2 - x1);
+	dy = -abs(y2 - y1);
+	sx = (x1 < x2) ? 1 : -1;
+	sy = (y1 < y2) ? 1 : -1;
+	err = dx + dy;
+	while (1) {
+		blend(r, x1, y1, color, 1);
+		if (x1 == x2 && y1 == y2)
+			break;
+		e2 = 2*err;
+		if (e2 >= dy) {
+			err += dy;
+			x1 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y1 += sy;
+		}
+	}
+}
+
+static inline double
+clamp01(double a) {
+	return (a < 0) ? 0 : (a > 1) ? 1 : a;
+}
+
+/*
+ * The coverage of a disk of radius rad centered at a pixel, for the
+ * (2k+1) x (2k+1) square around it: solo when there is no outline,
+ * otherwise fill and stroke. Computed once per radius; the list only
+ * grows, and a new entry is pushed with compare-and-swap, so that
+ * readers need no lock (two threads may both add the same radius,
+ * which is harmless).
+ */
+struct disk {
+	double rad;
+	int k;
+	double *solo, *fill, *stroke;
+	struct disk *next;
+};
+
+static struct disk *disks;
+
+static struct disk *
+get_disk(double rad) {
+	struct disk *dk;
+	double d;
+	int n, x, y, i;
+
+	for (dk = disks; dk; dk = dk->next)
+		if (dk->rad == rad)
+			return dk;
+
+	dk = malloc(sizeof(*dk));
+	if (dk == NULL)
+		return NULL;
+	dk->rad = rad;
+	dk->k = ceil(rad + 1);
+	n = 2*dk->k + 1;
+	dk->solo = malloc(3 * n*n * sizeof(double));
+	if (dk->solo == NULL) {
+		free(dk);
+		return NULL;
+	}
+	dk->fill = dk->solo + n*n;
+	dk->stroke = dk->fill + n*n;
+	for (y = -dk->k, i = 0; y <= dk->k; y++)
+		for (x = -dk->k; x <= dk->k; x++, i++) {
+			d = hypot(x, y);
+			dk->solo[i] = clamp01(rad + 0.5 - d);
+			dk->fill[i] = clamp01(rad - d);
+			/* the outline covers rad-0.5 .. rad+0.5 */
+			dk->stroke[i] = clamp01(rad + 1 - d);
+		}
+
+	do {
+		dk->next = disks;
+	} while (!__sync_bool_compare_and_swap(&disks, dk->next, dk));
+	return dk;
+}
+
+void
+raster_circle(struct raster *r, double cx, double cy, double rad,
+	      int fill, int stroke) {
+	struct disk *dk;
+	int x, y, x1, x2, y1, y2, i;
+	double d;
+
+	if (cx == floor(cx) && cy == floor(cy) && (dk = get_disk(rad))) {
+		for (y = -dk->k, i = 0; y <= dk->k; y++)
+			for (x = -dk->k; x <= dk->k; x++, i++) {
+				if (stroke == NOCOLOR) {
+					if (fill != NOCOLOR)
+						blend(r, cx+x, cy+y, fill,
+						      dk->solo[i]);
+					continue;
+				}
+				blend(r, cx+x, cy+y, stroke, dk->stroke[i]);
+				if (fill != NOCOLOR)
+					blend(r, cx+x, cy+y, fill,
+					      dk->fill[i]);
+			}
+		return;
+	}
+
+	x1 = floor(cx - rad - 1);
+	x2 = ceil(cx + rad + 1);
+	y1 = floor(cy - rad - 1);
+	y2 = ceil(cy + rad + 1);
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++) {
+			d = hypot(x - cx, y - cy);
+			if (stroke == NOCOLOR) {
+				if (fill != NOCOLOR)
+					blend(r, x, y, fill,
+					      clamp01(rad + 0.5 - d));
+				continue;
+			}
+			/* the outline covers rad-0.5 .. rad+0.5 */
+			blend(r, x, y, stroke, clamp01(rad + 1 - d));
+			if (fill != NOCOLOR)
+				blend(r, x, y, fill, clamp01(rad - d));
+		}
+}
+
+/*
+ * The 5x7 font, for the characters ' ' .. '~': five columns per
+ * character, bit 0 is the top row.
+ */
+#define FONTW	5
+#define FONTH	7
+static const unsigned char font5x7[95][FONTW] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5f, 0x00, 0x00 },
+	{ 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7f, 0x14, 0x7f, 0x14 },
+	{ 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+	{ 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },
+	{ 0x00, 0x1c, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1c, 0x00 },
+	{ 0x08, 0x2a, 0x1c, 0x2a, 0x08 }, { 0x08, 0x08, 0x3e, 0x08, 0x08 },
+	{ 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 },
+	{ 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },
+	{ 0x3e, 0x51, 0x49, 0x45, 0x3e }, { 0x00, 0x42, 0x7f, 0x40, 0x00 },
+	{ 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4b, 0x31 },
+	{ 0x18, 0x14, 0x12, 0x7f, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 },
+	{ 0x3c, 0x4a, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1e },
+	{ 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },
+	{ 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+	{ 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },
+	{ 0x32, 0x49, 0x79, 0x41, 0x3e }, { 0x7e, 0x11, 0x11, 0x11, 0x7e },
+	{ 0x7f, 0x49, 0x49, 0x49, 0x36 }, { 0x3e, 0x41, 0x41, 0x41, 0x22 },
+	{ 0x7f, 0x41, 0x41, 0x22, 0x1c }, { 0x7f, 0x49, 0x49, 0x49, 0x41 },
+	{ 0x7f, 0x09, 0x09, 0x09, 0x01 }, { 0x3e, 0x41, 0x49, 0x49, 0x7a },
+	{ 0x7f, 0x08, 0x08, 0x08, 0x7f }, { 0x00, 0x41, 0x7f, 0x41, 0x00 },
+	{ 0x20, 0x40, 0x41, 0x3f, 0x01 }, { 0x7f, 0x08, 0x14, 0x22, 0x41 },
+	{ 0x7f, 0x40, 0x40, 0x40, 0x40 }, { 0x7f, 0x02, 0x0c, 0x02, 0x7f },
+	{ 0x7f, 0x04, 0x08, 0x10, 0x7f }, { 0x3e, 0x41, 0x41, 0x41, 0x3e },
+	{ 0x7f, 0x09, 0x09, 0x09, 0x06 }, { 0x3e, 0x41, 0x51, 0x21, 0x5e },
+	{ 0x7f, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 },
+	{ 0x01, 0x01, 0x7f, 0x01, 0x01 }, { 0x3f, 0x40, 0x40, 0x40, 0x3f },
+	{ 0x1f, 0x20, 0x40, 0x20, 0x1f }, { 0x3f, 0x40, 0x38, 0x40, 0x3f },
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 },
+	{ 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7f, 0x41, 0x41, 0x00 },
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7f, 0x00 },
+	{ 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 },
+	{ 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },
+	{ 0x7f, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 },
+	{ 0x38, 0x44, 0x44, 0x48, 0x7f }, { 0x38, 0x54, 0x54, 0x54, 0x18 },
+	{ 0x08, 0x7e, 0x09, 0x01, 0x02 }, { 0x0c, 0x52, 0x52, 0x52, 0x3e },
+	{ 0x7f, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7d, 0x40, 0x00 },
+	{ 0x20, 0x40, 0x44, 0x3d, 0x00 }, { 0x7f, 0x10, 0x28, 0x44, 0x00 },
+	{ 0x00, 0x41, 0x7f, 0x40, 0x00 }, { 0x7c, 0x04, 0x18, 0x04, 0x78 },
+	{ 0x7c, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 },
+	{ 0x7c, 0x14, 0x14, 0x14, 0x08 }, { 0x08, 0x14, 0x14, 0x18, 0x7c },
+	{ 0x7c, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+	{ 0x04, 0x3f, 0x44, 0x40, 0x20 }, { 0x3c, 0x40, 0x40, 0x20, 0x7c },
+	{ 0x1c, 0x20, 0x40, 0x20, 0x1c }, { 0x3c, 0x40, 0x30, 0x40, 0x3c },
+	{ 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0c, 0x50, 0x50, 0x50, 0x3c },
+	{ 0x44, 0x64, 0x54, 0x4c, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 },
+	{ 0x00, 0x00, 0x7f, 0x00, 0x00 }, { 0x00, 0x41, 0x36, 0x08, 0x00 },
+	{ 0x08, 0x04, 0x08, 0x10, 0x08 },
+};
+
+/* the glyph of the next (UTF-8) character of *sp; '?' if not ASCII */
+static const unsigned char *
+next_glyph(const char **sp) {
+	const unsigned char *s = (const unsigned char *) *sp;
+	int c = *s++;
+
+	if (c >= 0x80) {
+		while ((*s & 0xc0) == 0x80)
+			s++;
+		c = '?';
+	} else if (c < ' ' || c > '~')
+		c = '?';
+	*sp = (const char *) s;
+	return font5x7[c - ' '];
+}
+
+static int
+glyph_count(const char *s) {
+	int n = 0;
+
+	while (*s) {
+		next_glyph(&s);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Each font pixel is an sx x sy rectangle; a pixel gets the color
+ * with weight the part of its area that is covered.
+ * The coverage of the w x h pixels from px0,py0 on goes to cover.
+ */
+#define MAXTEXTW	256
+#define MAXTEXTH	64
+
+static void
+text_cover(double cx, double cy, const char *s, int n, double size,
+	   float cover[MAXTEXTH][MAXTEXTW], int *px0p, int *py0p,
+	   int *wp, int *hp) {
+	const unsigned char *g;
+	double sx, sy, x0, y0, fx, fy, ox, oy;
+	int i, j, k, x, y, px0, py0, w, h;
+
+	sy = size / 10;
+	sx = 0.8 * sy;
+	x0 = cx + 0.5 - (n*(FONTW+1) - 1) * sx / 2;	/* pixel edges */
+	y0 = cy + 0.5 - FONTH * sy / 2;
+	px0 = floor(x0);
+	py0 = floor(y0);
+	w = ceil(x0 + (n*(FONTW+1) - 1) * sx) - px0;
+	h = ceil(y0 + FONTH * sy) - py0;
+	if (w > MAXTEXTW)
+		w = MAXTEXTW;
+	if (h > MAXTEXTH)
+		h = MAXTEXTH;
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++)
+			cover[y][x] = 0;
+
+	for (k = 0; k < n; k++) {
+		g = next_glyph(&s);
+		for (i = 0; i < FONTW; i++)
+			for (j = 0; j < FONTH; j++) {
+				if (!(g[i] & (1 << j)))
+					continue;
+				fx = x0 + (k*(FONTW+1) + i) * sx - px0;
+				fy = y0 + j * sy - py0;
+				for (y = floor(fy); y < fy + sy && y < h; y++) {
+					oy = fmin(y+1, fy+sy) - fmax(y, fy);
+					for (x = floor(fx); x < fx + sx &&
+						     x < w; x++) {
+						ox = fmin(x+1, fx+sx) -
+							fmax(x, fx);
+						cover[y][x] += ox * oy;
+					}
+				}
+			}
+	}
+	*px0p = px0;
+	*py0p = py0;
+	*wp = w;
+	*hp = h;
+}
+
+/*
+ * The coverage of a string centered at pixel 0,0 (the numbers on the
+ * stones, mostly), kept in a hash table shared by all threads; as
+ * for the disks, entries are only added, with compare-and-swap.
+ */
+struct sprite {
+	char *s;
+	double size;
+	int dx, dy, w, h;
+	float *cover;
+	struct sprite *next;
+};
+
+#define SPRITEHASH	256
+static struct sprite *sprites[SPRITEHASH];
+
+static struct sprite *
+get_sprite(const char *s, int n, double size) {
+	static __thread float cover[MAXTEXTH][MAXTEXTW];
+	struct sprite *sp, **head;
+	const unsigned char *t;
+	unsigned int hash;
+	int y;
+
+	hash = size;
+	for (t = (const unsigned char *) s; *t; t++)
+		hash = 31*hash + *t;
+	head = &sprites[hash % SPRITEHASH];
+	for (sp = *head; sp; sp = sp->next)
+		if (sp->size == size && !strcmp(sp->s, s))
+			return sp;
+
+	sp = malloc(sizeof(*sp));
+	if (sp == NULL)
+		return NULL;
+	text_cover(0, 0, s, n, size, cover, &sp->dx, &sp->dy, &sp->w, &sp->h);
+	sp->s = strdup(s);
+	sp->cover = malloc(sp->w * sp->h * sizeof(float) + 1);
+	if (sp->s == NULL || sp->cover == NULL) {
+		free(sp->s);
+		free(sp->cover);
+		free(sp);
+		return NULL;
+	}
+	for (y = 0; y < sp->h; y++)
+		memcpy(sp->cover + y*sp->w, cover[y], sp->w * sizeof(float));
+	sp->size = size;
+
+	do {
+		sp->next = *head;
+	} while (!__sync_bool_compare_and_swap(head, sp->next, sp));
+	return sp;
+}
+
+void
+raster_text(struct raster *r, double cx, double cy, const char *s,
+	    double size, int color) {
+	static __thread float cover[MAXTEXTH][MAXTEXTW];
+	struct sprite *sp;
+	int n, x, y, px0, py0, w, h;
+
+	if (color == NOCOLOR || (n = glyph_count(s)) == 0)
+		return;
+
+	if (cx == floor(cx) && cy == floor(cy) && (sp = get_sprite(s, n, size))) {
+		for (y = 0; y < sp->h; y++)
+			for (x = 0; x < sp->w; x++)
+				blend(r, cx + sp->dx + x, cy + sp->dy + y,
+				      color, sp->cover[y*sp->w + x]);
+		return;
+	}
+
+	text_cover(cx, cy, s, n, size, cover, &px0, &py0, &w, &h);
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++)
+			blend(r, px0 + x, py0 + y, color, cover[y][x]);
+}
+
+/* PNG */
+
+static int
+put_chunk(FILE *f, const char *type, const unsigned char *data,
+	  unsigned long len) {
+	unsigned char buf[4];
+	unsigned long crc;
+
+	buf[0] = len >> 24;
+	buf[1] = len >> 16;
+	buf[2] = len >> 8;
+	buf[3] = len;
+	crc = crc32(0, (const unsigned char *) type, 4);
+	if (len)
+		crc = crc32(crc, data, len);
+	if (fwrite(buf, 4, 1, f) != 1 || fwrite(type, 4, 1, f) != 1 ||
+	    (len && fwrite(data, len, 1, f) != 1))
+		return -1;
+	buf[0] = crc >> 24;
+	buf[1] = crc >> 16;
+	buf[2] = crc >> 8;
+	buf[3] = crc;
+	return (fwrite(buf, 4, 1, f) == 1) ? 0 : -1;
+}
+
+static void
+put_be32(unsigned char *p, unsigned long v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/*
+ * Filter each row of the w x h rectangle at x0,y0 with None, Sub or Up,
+ * whichever gives the smallest sum of absolute values (the usual
+ * heuristic).
+ */
+static void
+filter_rows(struct raster *r, int x0, int y0, int w, int h,
+	    unsigned char *out) {
+	unsigned char *row, *prev, *best;
+	int y, i, f, n, bpr = 3*w;
+	long sum, bestsum;
+	unsigned char tmp[3][1 + 3*4096], *cand;
+
+	prev = NULL;
+	for (y = 0; y < h; y++) {
+		row = r->pix + 3*((long) (y0+y) * r->w + x0);
+		best = out + (long) y * (bpr+1);
+		if (bpr > 3*4096) {		/* very wide: no filter */
+			best[0] = 0;
+			memcpy(best+1, row, bpr);
+			prev = row;
+			continue;
+		}
+		bestsum = -1;
+		for (f = 0; f < 3; f++) {
+			cand = tmp[f];
+			cand[0] = f;
+			sum = 0;
+			for (i = 0; i < bpr; i++) {
+				n = row[i];
+				if (f == 1 && i >= 3)
+					n -= row[i-3];
+				else if (f == 2 && prev)
+					n -= prev[i];
+				cand[i+1] = n;
+				sum += (cand[i+1] < 128) ? cand[i+1] :
+					256 - cand[i+1];
+			}
+			if (bestsum < 0 || sum < bestsum) {
+				bestsum = sum;
+				memcpy(best, cand, bpr+1);
+			}
+		}
+		prev = row;
+	}
+}
+
+/*
+ * The compressed image data of a rectangle, in malloced memory
+ * (leaving room for the sequence number of an fdAT chunk in front)
+ */
+#define SEQROOM		4
+
+static unsigned char *
+compress_rect(struct raster *r, int x0, int y0, int w, int h,
+	      unsigned long *zlenp) {
+	unsigned char *raw, *z;
+	unsigned long rawlen, zlen;
+
+	rawlen = (unsigned long) h * (3*w + 1);
+	zlen = compressBound(rawlen);
+	raw = malloc(rawlen);
+	z = malloc(SEQROOM + zlen);
+	if (raw == NULL || z == NULL)
+		goto err;
+	filter_rows(r, x0, y0, w, h, raw);
+	if (compress2(z + SEQROOM, &zlen, raw, rawlen,
+		      Z_BEST_COMPRESSION) != Z_OK)
+		goto err;
+	free(raw);
+	*zlenp = zlen;
+	return z;
+err:
+	free(raw);
+	free(z);
+	return NULL;
+}
+
+static const unsigned char png_sig[8] =
+	{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void
+make_ihdr(unsigned char *ihdr, int w, int h) {
+	put_be32(ihdr, w);
+	put_be32(ihdr+4, h);
+	ihdr[8] = 8;		/* bit depth */
+	ihdr[9] = 2;		/* RGB */
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+}
+
+int
+raster_write_png(struct raster *r, FILE *f) {
+	unsigned char ihdr[13], *z;
+	unsigned long zlen;
+	int res;
+
+	make_ihdr(ihdr, r->w, r->h);
+	z = compress_rect(r, 0, 0, r->w, r->h, &zlen);
+	if (z == NULL)
+		return -1;
+	res = -1;
+	if (fwrite(png_sig, sizeof(png_sig), 1, f) == 1 &&
+	    put_chunk(f, "IHDR", ihdr, sizeof(ihdr)) == 0 &&
+	    put_chunk(f, "IDAT", z + SEQROOM, zlen) == 0 &&
+	    put_chunk(f, "IEND", NULL, 0) == 0)
+		res = 0;
+	free(z);
+	return res;
+}
+
+/*
+ * Animated PNG (APNG): the first frame is the ordinary image, so
+ * that viewers that do not know APNG show it. Each later frame is
+ * a rectangle that replaces the pixels there (dispose_op NONE,
+ * blend_op SOURCE). The number of frames goes into the acTL chunk
+ * at the start, which is rewritten at the end, so f must be seekable.
+ */
+struct raster_anim {
+	FILE *f;
+	int w, h;
+	long actl;		/* file offset of the acTL chunk */
+	unsigned int frames;
+	unsigned int seq;	/* sequence number of the next fcTL/fdAT */
+	int err;
+};
+
+static int
+put_actl(struct raster_anim *a) {
+	unsigned char actl[8];
+
+	put_be32(actl, a->frames);
+	put_be32(actl+4, 0);		/* loop forever */
+	return put_chunk(a->f, "acTL", actl, sizeof(actl));
+}
+
+struct raster_anim *
+raster_anim_start(FILE *f, int w, int h) {
+	struct raster_anim *a;
+	unsigned char ihdr[13];
+
+	a = malloc(sizeof(*a));
+	if (a == NULL)
+		return NULL;
+	a->f = f;
+	a->w = w;
+	a->h = h;
+	a->frames = a->seq = 0;
+	a->err = 0;
+	make_ihdr(ihdr, w, h);
+	if (fwrite(png_sig, sizeof(png_sig), 1, f) != 1 ||
+	    put_chunk(f, "IHDR", ihdr, sizeof(ihdr)) ||
+	    (a->actl = ftell(f)) < 0 || put_actl(a))
+		a->err = 1;
+	return a;
+}
+
+/* delay in hundredths of a second, as for convert */
+int
+raster_anim_frame(struct raster_anim *a, struct raster *r,
+		  int x1, int y1, int x2, int y2, int delay) {
+	unsigned char fctl[26], *z;
+	unsigned long zlen;
+
+	if (a->err)
+		return -1;
+	if (a->frames == 0) {
+		x1 = y1 = 0;
+		x2 = a->w - 1;
+		y2 = a->h - 1;
+	}
+	if (x1 < 0)
+		x1 = 0;
+	if (y1 < 0)
+		y1 = 0;
+	if (x2 >= a->w)
+		x2 = a->w - 1;
+	if (y2 >= a->h)
+		y2 = a->h - 1;
+	if (x2 < x1 || y2 < y1)		/* nothing changed: one pixel */
+		x1 = y1 = x2 = y2 = 0;	/* (x1,y1 may be past the edge) */
+
+	put_be32(fctl, a->seq++);
+	put_be32(fctl+4, x2-x1+1);
+	put_be32(fctl+8, y2-y1+1);
+	put_be32(fctl+12, x1);
+	put_be32(fctl+16, y1);
+	fctl[20] = delay >> 8;
+	fctl[21] = delay;
+	fctl[22] = 0;
+	fctl[23] = 100;
+	fctl[24] = 0;			/* APNG_DISPOSE_OP_NONE */
+	fctl[25] = 0;			/* APNG_BLEND_OP_SOURCE */
+
+	z = compress_rect(r, x1, y1, x2-x1+1, y2-y1+1, &zlen);
+	if (z == NULL || put_chunk(a->f, "fcTL", fctl, sizeof(fctl)))
+		a->err = 1;
+	else if (a->frames == 0) {
+		if (put_chunk(a->f, "IDAT", z + SEQROOM, zlen))
+			a->err = 1;
+	} else {
+		put_be32(z, a->seq++);
+		if (put_chunk(a->f, "fdAT", z, SEQROOM + zlen))
+			a->err = 1;
+	}
+	free(z);
+	a->frames++;
+	return a->err ? -1 : 0;
+}
+
+int
+raster_anim_end(struct raster_anim *a) {
+	int res;
+
+	if (put_chunk(a->f, "IEND", NULL, 0) ||
+	    fseek(a->f, a->actl, SEEK_SET) || put_actl(a) ||
+	    fseek(a->f, 0, SEEK_END))
+		a->err = 1;
+	res = a->err ? -1 : 0;
+	free(a);
+	return res;
+}
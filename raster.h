@@ -0,0 +1,35 @@
+/* an RGB framebuffer with antialiased drawing, written as PNG */
+
+struct raster {
+	int w, h;
+	unsigned char *pix;	/* h rows of w RGB triples */
+	int cx1, cy1, cx2, cy2;	/* the clip rectangle */
+};
+
+/* colors are 0xrrggbb; NOCOLOR means: do not draw */
+#define NOCOLOR		(-1)
+
+extern struct raster *raster_new(int w, int h, int bg);
+extern struct raster *raster_dup(struct raster *r);
+extern void raster_clip(struct raster *r, int x1, int y1, int x2, int y2);
+extern void raster_copy(struct raster *r, struct raster *src,
+			int x1, int y1, int x2, int y2);
+extern void raster_free(struct raster *r);
+extern int raster_color(const char *name);
+
+extern void raster_line(struct raster *r, int x1, int y1, int x2, int y2,
+			int color);
+extern void raster_rect(struct raster *r, int x1, int y1, int x2, int y2,
+			int color);
+extern void raster_circle(struct raster *r, double cx, double cy, double rad,
+			  int fill, int stroke);
+extern void raster_text(struct raster *r, double cx, double cy,
+			const char *s, double size, int color);
+
+extern int raster_write_png(struct raster *r, FILE *f);
+
+struct raster_anim;
+extern struct raster_anim *raster_anim_start(FILE *f, int w, int h);
+extern int raster_anim_frame(struct raster_anim *a, struct raster *r,
+			     int x1, int y1, int x2, int y2, int delay);
+extern int raster_anim_end(struct raster_anim *a);
@@ -1,35 +1,164 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "errexit.h"
 #include "xmalloc.h"
 #include "readsgf.h"
+#include "sgfprop.h"
+#include "sgfscan.h"
 
 /* read in larger chunks than a single character */
 // #define TRACING
 
 #define PB	3
 #define INBUFSZ	65536
-unsigned char inbuf[PB+INBUFSZ];
-unsigned char *inbufp;
-int inbufct;
-int notracect;
+#define IDHASH	256
+
+#define STREAM_NONE	0
+#define STREAM_START	1	/* nothing read yet */
+#define STREAM_GAMES	2	/* another game follows */
+#define STREAM_END	3
 
 int multiin = 0;		/* expect multiple games (+garbage) */
 int tracein = 0;		/* print input as it is being read */
 int readquietly = 0;		/* suppress "skipping initial garbage" */
 int fullprop = 0;		/* don't delete lower case letters in
 				   property names */
-static int eof, peekc;
+
+/*
+ * All state of a parse lives in the parser context, so that
+ * independent parsers can run at the same time (in different threads).
+ * Errors leave through sp->jb, never through the global jmpbuf.
+ */
+struct sgf_parser {
+	int flags;
+	const char *name;		/* for messages */
+	int linenr;
+
+	/* input: a file descriptor, a FILE, or a buffer in memory */
+	int fd;
+	FILE *f;
+	unsigned char *inbuf;		/* INBUFSZ, for fd and FILE input */
+	const unsigned char *inbufp;
+	size_t inbufct;
+	int eof, peekc;
+	int pb[PB], pbct;		/* pushback */
+
+	char *propvaluebuf;
+	int propvaluebufsz;
+	int propvaluestep;
+
+	struct yarena arena;		/* holds the parse trees */
+
+	/* SGF_MMAP: values are slices of the mapped input */
+	int views;
+	struct mapping {
+		void *addr;
+		size_t len;
+		struct mapping *next;
+	} *maps;
+	char *ids[IDHASH];		/* interned unknown property ids */
+	int nids;
+
+	/* sgf_stream_path(): one game at a time */
+	int stream;			/* STREAM_xx */
+	int streamfd;			/* closed by sgf_parser_clear() */
+	size_t dropped;			/* SGF_MMAP: released part of maps */
+
+	jmp_buf jb;
+	char errmsg[200];
+};
+
+int
+sgf_default_flags(void) {
+	return (multiin ? SGF_MULTIIN : 0) |
+		(tracein ? SGF_TRACEIN : 0) |
+		(readquietly ? SGF_QUIET : 0) |
+		(fullprop ? SGF_FULLPROP : 0);
+}
+
+struct sgf_parser *
+sgf_parser_new(int flags) {
+	struct sgf_parser *sp = xmalloc(sizeof(*sp));
+
+	memset(sp, 0, sizeof(*sp));
+	sp->flags = flags;
+	sp->fd = -1;
+	sp->streamfd = -1;
+	sp->propvaluestep = 10000;
+	sp->arena.huge = ((flags & SGF_HUGEPAGES) != 0);
+	return sp;
+}
+
+/* release all parse trees read so far (the arena keeps one chunk) */
+void
+sgf_parser_clear(struct sgf_parser *sp) {
+	struct mapping *m;
+
+	if (sp->streamfd >= 0) {
+		close(sp->streamfd);
+		sp->streamfd = sp->fd = -1;
+	}
+	sp->stream = STREAM_NONE;
+	sp->f = NULL;
+	while ((m = sp->maps) != NULL) {
+		sp->maps = m->next;
+		munmap(m->addr, m->len);
+		free(m);
+	}
+	memset(sp->ids, 0, sizeof(sp->ids));
+	sp->nids = 0;
+	yarelease(&sp->arena, NULL);
+}
+
+void
+sgf_parser_free(struct sgf_parser *sp) {
+	sgf_parser_clear(sp);
+	yafree(&sp->arena);
+	free(sp->inbuf);
+	free(sp->propvaluebuf);
+	free(sp);
+}
+
+const char *
+sgf_parser_error(struct sgf_parser *sp) {
+	return sp->errmsg;
+}
+
+int
+sgf_parser_linenr(struct sgf_parser *sp) {
+	return sp->linenr;
+}
+
+static void parse_error(struct sgf_parser *sp, const char *s, ...)
+	__attribute__ ((noreturn));
+
+static void
+parse_error(struct sgf_parser *sp, const char *s, ...) {
+	va_list ap;
+
+	va_start(ap, s);
+	vsnprintf(sp->errmsg, sizeof(sp->errmsg), s, ap);
+	va_end(ap);
+	longjmp(sp->jb, 1);
+}
+
+static inline void *
+pmalloc(struct sgf_parser *sp, int n) {
+	return yamalloc(&sp->arena, n);
+}
 
 /* we guarantee PB characters of pushback */
 static inline void
-my_pushback(int c) {
-	inbufct++;
-	*--inbufp = c;
-#ifdef TRACING
-	notracect++;
-#endif
+my_pushback(struct sgf_parser *sp, int c) {
+	sp->pb[sp->pbct++] = c;
 }
 
 /* "White space (space, tab, carriage return, line feed, vertical tab
@@ -41,41 +170,58 @@ iswhitespace(int c) {
 		c == '\f' || c == '\v');
 }
 
+static void
+refill(struct sgf_parser *sp) {
+	ssize_t n;
+
+	if (sp->f) {
+		n = fread(sp->inbuf, 1, INBUFSZ, sp->f);
+	} else if (sp->fd >= 0) {
+		do {
+			n = read(sp->fd, sp->inbuf, INBUFSZ);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0)
+			parse_error(sp, "read error");
+	} else
+		n = 0;		/* buffer input: nothing more */
+
+	sp->inbufp = sp->inbuf;
+	sp->inbufct = n;
+}
+
 static int
-mygetchar() {
+mygetchar(struct sgf_parser *sp) {
 	int c;
 
-	if (peekc) {
-		c = peekc;
-		peekc = 0;
+	if (sp->peekc) {
+		c = sp->peekc;
+		sp->peekc = 0;
 		return c;
 	}
 
-	if (eof)
-		errexit("mygetchar called after eof");
+	if (sp->pbct)
+		return sp->pb[--sp->pbct];
 
-	if (inbufct == 0) {
-		inbufp = inbuf+PB;
-		inbufct = fread((char *) inbuf+PB, 1, INBUFSZ, stdin);
-		if (inbufct == 0) {
-			eof = 1;
+	if (sp->eof)
+		parse_error(sp, "mygetchar called after eof");
+
+	if (sp->inbufct == 0) {
+		refill(sp);
+		if (sp->inbufct == 0) {
+			sp->eof = 1;
 			return 0;
 		}
 	}
 
-	inbufct--;
-	c = *inbufp++;
+	sp->inbufct--;
+	c = *sp->inbufp++;
 
 	if (c == '\n')
-		linenr++;
+		sp->linenr++;
 
 #ifdef TRACING
-	if (tracein) {
-		if (notracect)
-			notracect--;
-		else
-			putchar(c);
-	}
+	if (sp->flags & SGF_TRACEIN)
+		putchar(c);
 #endif
 
 	return c;
@@ -88,12 +234,12 @@ mygetchar() {
  * (and possibly when inside a property identifier)
  */
 static inline int
-mygetsym() {
+mygetsym(struct sgf_parser *sp) {
 	int c;
 
-	c = mygetchar();
+	c = mygetchar(sp);
 	while (iswhitespace(c))
-		c = mygetchar();
+		c = mygetchar(sp);
 	return c;
 }
 
@@ -118,98 +264,130 @@ mygetsym() {
  * We should recognize this.
  */
 static void
-skip_initial_BOM() {
+skip_initial_BOM(struct sgf_parser *sp) {
 	int c;
 
-	if (!eof) {
-		c = mygetsym();
-		if (c != 0xef || eof) {
-			my_pushback(c);
+	if (!sp->eof) {
+		c = mygetsym(sp);
+		if (c != 0xef || sp->eof) {
+			my_pushback(sp, c);
 			return;
 		}
-		c = mygetsym();
-		if (c != 0xbb || eof) {
-			my_pushback(c);
-			my_pushback(0xef);
+		c = mygetsym(sp);
+		if (c != 0xbb || sp->eof) {
+			my_pushback(sp, c);
+			my_pushback(sp, 0xef);
 			return;
 		}
-		c = mygetsym();
+		c = mygetsym(sp);
 		if (c != 0xbf) {
-			my_pushback(c);
-			my_pushback(0xbb);
-			my_pushback(0xef);
+			my_pushback(sp, c);
+			my_pushback(sp, 0xbb);
+			my_pushback(sp, 0xef);
 			return;
 		}
 	}
-	if (!readquietly)
-		fprintf(stderr, "%s: skipped initial BOM\n", infilename);
+	if (!(sp->flags & SGF_QUIET))
+		fprintf(stderr, "%s: skipped initial BOM\n", sp->name);
 }
 
 static void
-skip_initial_garbage() {
+skip_initial_garbage(struct sgf_parser *sp) {
 	int c;
 	int msg = 0;
 
 	/* skip until (; */
-	while (!eof) {
-		c = mygetsym();
+	while (!sp->eof) {
+		c = mygetsym(sp);
 		if (c == '(') {
-			c = mygetsym();
+			c = mygetsym(sp);
 			if (c == ';') {
-				my_pushback(';');
-				my_pushback('(');
+				my_pushback(sp, ';');
+				my_pushback(sp, '(');
 				return;
 			}
 			if (c == 'T') {
-				if (!readquietly)
+				if (!(sp->flags & SGF_QUIET))
 					fprintf(stderr, "%s: SGF2-style\n",
-						infilename);
-				my_pushback('T');
-				my_pushback(';');
-				my_pushback('(');
+						sp->name);
+				my_pushback(sp, 'T');
+				my_pushback(sp, ';');
+				my_pushback(sp, '(');
 				return;
 			}
-			peekc = c;
+			sp->peekc = c;
 		}
-		if (!msg++ && !eof && !readquietly)
+		if (!msg++ && !sp->eof && !(sp->flags & SGF_QUIET))
 			fprintf(stderr, "skipping initial garbage in %s ...\n",
-				infilename);
+				sp->name);
 	}
 }
 
-static char *propvaluebuf = NULL;
-int propvaluebufsz = 0;
-int propvaluestep = 10000;
+/*
+ * Number of characters, starting at the next one, that are neither
+ * ']' nor '\\' and are already in the input buffer.
+ * These can be taken in one go instead of by mygetchar().
+ */
+static inline int
+plain_run(struct sgf_parser *sp) {
+	if (sp->peekc || sp->pbct)
+		return 0;
+#ifdef TRACING
+	if (sp->flags & SGF_TRACEIN)
+		return 0;
+#endif
+	return sgf_scan_value(sp->inbufp, sp->inbufp + sp->inbufct)
+		- sp->inbufp;
+}
+
+static inline void
+skip_run(struct sgf_parser *sp, int n) {
+	sp->linenr += sgf_count_nl(sp->inbufp, sp->inbufp + n);
+	sp->inbufp += n;
+	sp->inbufct -= n;
+}
+
+/* make room for n more chars at p in propvaluebuf */
+static char *
+propvalue_room(struct sgf_parser *sp, char *p, int n) {
+	int poffset = p - sp->propvaluebuf;
+
+	if (sp->propvaluebufsz - poffset >= n)
+		return p;
+	while (sp->propvaluebufsz - poffset < n) {
+		sp->propvaluestep *= 2;
+		sp->propvaluebufsz += sp->propvaluestep;
+	}
+	sp->propvaluebuf = xrealloc(sp->propvaluebuf, sp->propvaluebufsz);
+	return sp->propvaluebuf + poffset;
+}
 
 /* <propvalue> :: "[" stuff "]" */
 /* non-NULL */
 static struct propvalue *
-read_propvalue_following_sq(void) {
-	int c;
-	char *p = propvaluebuf;
-	int propvalueroomleft;
-	struct propvalue *res = (struct propvalue *) ymalloc(sizeof(*res));
+read_propvalue_following_sq(struct sgf_parser *sp) {
+	int c, n;
+	char *p = sp->propvaluebuf;
+	struct propvalue *res = (struct propvalue *) pmalloc(sp, sizeof(*res));
 
 	/* do not skip whitespace here: mygetchar, not mygetsym */
 	while (1) {
-		propvalueroomleft = propvaluebufsz - (p - propvaluebuf);
-		if (propvalueroomleft < 3) {
-			int poffset = p - propvaluebuf;
-			propvaluestep *= 2;
-			propvalueroomleft += propvaluestep;
-			propvaluebufsz += propvaluestep;
-			propvaluebuf = xrealloc(propvaluebuf, propvaluebufsz);
-			p = propvaluebuf + poffset;
+		n = plain_run(sp);
+		p = propvalue_room(sp, p, n+3);
+		if (n) {
+			memcpy(p, sp->inbufp, n);
+			p += n;
+			skip_run(sp, n);
 		}
 
-		c = mygetchar();
+		c = mygetchar(sp);
 		if (c == ']') {
 #if 0
 			break;
 #else
 			/* maybe it should have been escaped but wasn't? */
-			int d = mygetsym();
-			peekc = d;
+			int d = mygetsym(sp);
+			sp->peekc = d;
 			if (d == ';' || d == '(' || d == ')' || d == '[' ||
 			    (d >= 'A' && d <= 'Z') || (d >= 'a' && d <= 'z')) {
 				/* lower case occurs in a context like
@@ -224,9 +402,9 @@ read_propvalue_following_sq(void) {
 			   But a test requires more than a single-character
 			   peekc. */
 
-			if (!readquietly)
+			if (!(sp->flags & SGF_QUIET))
 				fprintf(stderr, "%s: warning: unescaped ]\n",
-					infilename);
+					sp->name);
 //			errexit("unescaped ] followed by '%c' (0x%02x)", d, d);
 //			break;
 			/* note: we may have lost whitespace here */
@@ -234,27 +412,98 @@ read_propvalue_following_sq(void) {
 		}
 		*p++ = c;
 		if (c == '\\') {
-			c = mygetchar();
+			c = mygetchar(sp);
 			*p++ = c;
 		}
 	}
 	*p = 0;
 
-	res->val = ystrdup(propvaluebuf);
+	res->len = p - sp->propvaluebuf;
+	res->val = pmalloc(sp, res->len + 1);
+	memcpy(res->val, sp->propvaluebuf, res->len + 1);
+	res->raw = res->val;
+	res->next = NULL;
+	return res;
+}
+
+static inline int
+ends_propvalue(int d) {
+	return (d == ';' || d == '(' || d == ')' || d == '[' ||
+		(d >= 'A' && d <= 'Z') || (d >= 'a' && d <= 'z'));
+}
+
+/*
+ * The same, for SGF_MMAP: leave the value in the input and only
+ * remember where it is. Whenever the copy would not be an exact
+ * slice of the input (an unescaped ']' followed by whitespace,
+ * or end of input) we let read_propvalue_following_sq() do it.
+ */
+static struct propvalue *
+read_propvalue_view(struct sgf_parser *sp) {
+	const unsigned char *s, *q, *r, *end;
+	struct propvalue *res;
+	int unescaped = 0;
+
+	if (sp->peekc || sp->pbct)
+		return read_propvalue_following_sq(sp);
+
+	s = q = sp->inbufp;
+	end = s + sp->inbufct;
+	while (1) {
+		if (q < end)
+			q = sgf_scan_value(q, end);
+		if (q >= end)
+			return read_propvalue_following_sq(sp);
+		if (*q == '\\') {
+			q += 2;
+			continue;
+		}
+		r = q+1;
+		while (r < end && iswhitespace(*r))
+			r++;
+		if (r < end && ends_propvalue(*r))
+			break;
+		if (r != q+1 || r == end || *r == 0)
+			return read_propvalue_following_sq(sp);
+		unescaped++;
+		q++;
+	}
+
+	skip_run(sp, q+1-s);
+
+	while (unescaped-- && !(sp->flags & SGF_QUIET))
+		fprintf(stderr, "%s: warning: unescaped ]\n", sp->name);
+
+	res = (struct propvalue *) pmalloc(sp, sizeof(*res));
+	res->val = NULL;
+	res->raw = (const char *) s;
+	res->len = q-s;
 	res->next = NULL;
 	return res;
 }
 
+/* the text of a value; made on first use for SGF_MMAP values */
+char *
+sgf_value(struct sgf_parser *sp, struct propvalue *pv) {
+	if (pv->val == NULL) {
+		pv->val = pmalloc(sp, pv->len + 1);
+		memcpy(pv->val, pv->raw, pv->len);
+		pv->val[pv->len] = 0;
+	}
+	return pv->val;
+}
+
 /* possibly NULL */
 static struct propvalue *
-read_propvalue_sequence(void){
+read_propvalue_sequence(struct sgf_parser *sp) {
 	int c;
 	struct propvalue *rh, *rt, *r;
 
 	rh = NULL;
 	rt = NULL;	/* for gcc only */
-	while ((c = mygetsym()) == '[') {
-		r = read_propvalue_following_sq();
+	while ((c = mygetsym(sp)) == '[') {
+		r = sp->views ? read_propvalue_view(sp)
+			: read_propvalue_following_sq(sp);
 		if (rh) {
 			rt->next = r;
 			rt = r;
@@ -262,7 +511,7 @@ read_propvalue_sequence(void){
 			rh = rt = r;
 		}
 	}
-	peekc = c;
+	sp->peekc = c;
 	return rh;
 }
 
@@ -276,19 +525,43 @@ is_lower_case(int c) {
 	return ('a' <= c && c <= 'z');
 }
 
+/*
+ * unknown ids: all properties with the same id share the string;
+ * when the table is 3/4 full, further new ids get a copy of their own
+ */
+static char *
+intern_propid(struct sgf_parser *sp, char *id) {
+	unsigned int h = 0;
+	char *s;
+
+	for (s = id; *s; s++)
+		h = h*31 + *s;
+	h %= IDHASH;
+	while ((s = sp->ids[h]) != NULL) {
+		if (!strcmp(s, id))
+			return s;
+		h = (h+1) % IDHASH;
+	}
+	if (4*(sp->nids+1) > 3*IDHASH)
+		return yastrdup(&sp->arena, id);
+	sp->nids++;
+	return sp->ids[h] = yastrdup(&sp->arena, id);
+}
+
 /* <propid> :: <ucletter> <ucletter>* */
 /* Called only in read_property(), from read_property_sequence()
    so we know that there is at least one letter. */
 /* non-NULL */
 static char *
-read_propid(void) {
+read_propid(struct sgf_parser *sp, int *tag) {
 	int c;
 	char propid[104];	/* so far, 10 suffices */
 	char fullpropid[104];
 	char *p = propid, *q = fullpropid;
+	int fullprop = (sp->flags & SGF_FULLPROP);
 
 	while (1) {
-		c = mygetsym();
+		c = mygetsym(sp);
 		if (!(is_upper_case(c) || is_lower_case(c)))
 			break;
 		if (q < fullpropid + sizeof(fullpropid) - 1)
@@ -297,27 +570,30 @@ read_propid(void) {
 		    (is_upper_case(c) || fullprop))
 			*p++ = c;
 	}
-	peekc = c;
+	sp->peekc = c;
 	*p = *q = 0;
 
 	if (p == propid)
-		errexit("propid '%s' is lower case only", fullpropid);
+		parse_error(sp, "propid '%s' is lower case only", fullpropid);
 
 	if (p >= propid + sizeof(propid))
-		errexit("propid too long");
-	return ystrdup(propid);
+		parse_error(sp, "propid too long");
+	*tag = sgfprop_tag(propid);
+	if (*tag != PROP_UNKNOWN)
+		return sgfprop_name[*tag];
+	return intern_propid(sp, propid);
 }
 
 /* <property> :: <propid> <propvalue> <propvalue>* */
 /* non-NULL */
 static struct property *
-read_property(void) {
-	struct property *res = (struct property *) ymalloc(sizeof(*res));
+read_property(struct sgf_parser *sp) {
+	struct property *res = (struct property *) pmalloc(sp, sizeof(*res));
 
-	res->id = read_propid();
-	res->val = read_propvalue_sequence();
+	res->id = read_propid(sp, &res->tag);
+	res->val = read_propvalue_sequence(sp);
 	if (res->val == NULL)
-		errexit("missing propvalue for %s", res->id);
+		parse_error(sp, "missing propvalue for %s", res->id);
 	res->next = NULL;
 	return res;
 }
@@ -331,18 +607,18 @@ read_property(void) {
  */
 /* non-NULL */
 static struct node *
-read_property_sequence(void) {
-	struct node *res = (struct node *) ymalloc(sizeof(*res));
+read_property_sequence(struct sgf_parser *sp) {
+	struct node *res = (struct node *) pmalloc(sp, sizeof(*res));
 	struct property *pt, *p;
 	int c;
 
 	res->p = pt = NULL;
 	while (1) {
-		c = mygetsym();
-		peekc = c;
+		c = mygetsym(sp);
+		sp->peekc = c;
 		if (!(is_upper_case(c) || is_lower_case(c)))
 			break;
-		p = read_property();
+		p = read_property(sp);
 		if (pt) {
 			pt->next = p;
 			pt = p;
@@ -358,14 +634,14 @@ read_property_sequence(void) {
 /* <node> :: ";" <property>* */
 /* possibly NULL */
 static struct node *
-read_node_sequence(void) {
+read_node_sequence(struct sgf_parser *sp) {
 	struct node *nh, *nt, *n;
 	int c;
 
 	nh = NULL;
 	nt = NULL;	/* gcc only */
-	while ((c = mygetsym()) == ';') {
-		n = read_property_sequence();
+	while ((c = mygetsym(sp)) == ';') {
+		n = read_property_sequence(sp);
 		if (nh) {
 			nt->next = n;
 			nt = n;
@@ -373,23 +649,23 @@ read_node_sequence(void) {
 			nh = nt = n;
 		}
 	}
-	peekc = c;
+	sp->peekc = c;
 	return nh;
 }
 
 /* variation without ; - starts with RN or N property */
 static struct node *
-read_korean_node_sequence() {
+read_korean_node_sequence(struct sgf_parser *sp) {
 	struct node *nh, *n;
 
-	nh = n = read_property_sequence();
+	nh = n = read_property_sequence(sp);
 	if (!n || !n->p || !n->p->id ||
 	    (strcmp(n->p->id, "RN") && strcmp(n->p->id, "RF") &&
 	     strcmp(n->p->id, "N") && strcmp(n->p->id, "C"))) {
-		errexit("empty node_sequence: `(' not followed by `;'"
-			" (and not by RN[] or N[] or C[])");
+		parse_error(sp, "empty node_sequence: `(' not followed by `;'"
+			    " (and not by RN[] or N[] or C[])");
 	}
-	n = read_node_sequence();
+	n = read_node_sequence(sp);
 	nh->next = n;
 	return nh;
 }
@@ -397,22 +673,22 @@ read_korean_node_sequence() {
 /* <sequence> :: <node> <node>* */
 /* non-NULL */
 static struct node *
-read_sequence(void) {
+read_sequence(struct sgf_parser *sp) {
 	struct node *n;
 
-	n = read_node_sequence();
+	n = read_node_sequence(sp);
 	if (n == NULL) {
-		if (peekc == 'R' || peekc == 'N' || peekc == 'C')
-			read_korean_node_sequence();
+		if (sp->peekc == 'R' || sp->peekc == 'N' || sp->peekc == 'C')
+			read_korean_node_sequence(sp);
 		else
-			errexit("empty node_sequence: "
-				"`(' not followed by `;'");
+			parse_error(sp, "empty node_sequence: "
+				    "`(' not followed by `;'");
 	}
 	return n;
 }
 
 /* forward declaration */
-static struct gametree *read_gametree_sequence(void);
+static struct gametree *read_gametree_sequence(struct sgf_parser *sp);
 
 /*
  * FF[4] says:
@@ -423,31 +699,31 @@ static struct gametree *read_gametree_sequence(void);
  */
 
 static struct gametree *
-read_baretree(void) {
-	struct gametree *res = (struct gametree *) ymalloc(sizeof(*res));
+read_baretree(struct sgf_parser *sp) {
+	struct gametree *res = (struct gametree *) pmalloc(sp, sizeof(*res));
 
-	res->nodesequence = read_sequence();
-	res->firstchild = read_gametree_sequence();
+	res->nodesequence = read_sequence(sp);
+	res->firstchild = read_gametree_sequence(sp);
 	res->nextsibling = NULL;
 	return res;
 }
 
 /* possibly NULL, namely when following char is not one of ;CR */
 static struct gametree *
-read_baretree_sequence(void) {
+read_baretree_sequence(struct sgf_parser *sp) {
 	struct gametree *gh, *g;
 	int c;
 
-	c = mygetsym();
-	peekc = c;
+	c = mygetsym(sp);
+	sp->peekc = c;
 	if (c != ';' && c != 'R' && c != 'N' && c != 'C')
 		return NULL;
 
-	gh = read_baretree();
-	c = mygetsym();
-	peekc = c;
+	gh = read_baretree(sp);
+	c = mygetsym(sp);
+	sp->peekc = c;
 	if (c == ';' || c == 'C' || c == 'R') {
-		g = read_baretree_sequence();
+		g = read_baretree_sequence(sp);
 		g->nextsibling = gh->firstchild;
 		gh->firstchild = g;
 	}
@@ -456,14 +732,14 @@ read_baretree_sequence(void) {
 
 /* possibly NULL */
 static struct gametree *
-read_gametree_sequence(void) {
+read_gametree_sequence(struct sgf_parser *sp) {
 	struct gametree *gh, *gt, *g;
 	int c;
 
 	gh = NULL;
 	gt = NULL;	/* gcc only */
-	while ((c = mygetsym()) == '(') {
-		g = read_baretree_sequence();
+	while ((c = mygetsym(sp)) == '(') {
+		g = read_baretree_sequence(sp);
 
 		if (g == NULL) {
 			/* ignore () */
@@ -473,29 +749,30 @@ read_gametree_sequence(void) {
 		} else {
 			gh = gt = g;
 		}
-		if ((c = mygetsym()) != ')')
-			errexit("gametree does not end with ')' - got '%c'", c);
+		if ((c = mygetsym(sp)) != ')')
+			parse_error(sp, "gametree does not end with ')'"
+				    " - got '%c'", c);
 	}
-	peekc = c;
+	sp->peekc = c;
 	return gh;
 }
 
 /* <collection> :: <gametree> <gametree>* */
 /* non-NULL */
 static struct gametree *
-read_collection() {
+read_collection(struct sgf_parser *sp) {
 	struct gametree *g, *gh, *gn;
 
-	g = read_gametree_sequence();
+	g = read_gametree_sequence(sp);
 	if (g == NULL)
-		errexit("empty gametree_sequence");
-	if (multiin) {
+		parse_error(sp, "empty gametree_sequence");
+	if (sp->flags & SGF_MULTIIN) {
 		gh = g;
 		while (gh) {
-			skip_initial_garbage();
-			if (eof)
+			skip_initial_garbage(sp);
+			if (sp->eof)
 				break;
-			gn = read_gametree_sequence();
+			gn = read_gametree_sequence(sp);
 			gh->nextsibling = gn;
 			gh = gn;
 		}
@@ -503,28 +780,309 @@ read_collection() {
 	return g;
 }
 
-/* read and parse an sgf file */
-int readsgf(const char *fn, struct gametree **gg) {
+/* parse the input set up by one of the sgf_parse_* routines */
+static int
+parse(struct sgf_parser *sp, const char *name, struct gametree **gg) {
+	sp->name = name;
+	sp->eof = sp->peekc = sp->pbct = 0;
+	sp->linenr = 1;	/* report linenr on error */
+	sp->errmsg[0] = 0;
+	*gg = NULL;
+
+	if (setjmp(sp->jb))
+		return -1;
+
+	skip_initial_BOM(sp);
+	skip_initial_garbage(sp);
+	if (sp->eof)
+		parse_error(sp, "no game found");
+
+	*gg = read_collection(sp);
+	return 0;
+}
 
-	infilename = (fn ? fn : "-");
+static void
+need_inbuf(struct sgf_parser *sp) {
+	if (sp->inbuf == NULL)
+		sp->inbuf = xmalloc(INBUFSZ);
+	sp->inbufct = 0;
+}
+
+int
+sgf_parse_fd(struct sgf_parser *sp, int fd, const char *name,
+	     struct gametree **gg) {
+	int ret;
+
+	need_inbuf(sp);
+	sp->fd = fd;
+	sp->f = NULL;
+	sp->views = 0;
+	ret = parse(sp, name, gg);
+	sp->fd = -1;
+	return ret;
+}
+
+int
+sgf_parse_file(struct sgf_parser *sp, FILE *f, const char *name,
+	       struct gametree **gg) {
+	int ret;
+
+	need_inbuf(sp);
+	sp->fd = -1;
+	sp->f = f;
+	sp->views = 0;
+	ret = parse(sp, name, gg);
+	sp->f = NULL;
+	return ret;
+}
+
+/*
+ * The buffer is not copied, and must stay around during the parse,
+ * and with SGF_MMAP as long as the trees are used.
+ */
+int
+sgf_parse_buffer(struct sgf_parser *sp, const char *buf, size_t len,
+		 const char *name, struct gametree **gg) {
+	sp->fd = -1;
+	sp->f = NULL;
+	sp->views = (sp->flags & SGF_MMAP);
+#ifdef TRACING
+	if (sp->flags & SGF_TRACEIN)
+		sp->views = 0;
+#endif
+	sp->inbufp = (const unsigned char *) buf;
+	sp->inbufct = len;
+	return parse(sp, name, gg);
+}
+
+/* map fd for SGF_MMAP, or NULL; the mapping stays until sgf_parser_clear() */
+static void *
+map_input(struct sgf_parser *sp, int fd, size_t *len) {
+	struct stat st;
+	struct mapping *m;
+	void *addr;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return NULL;
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	m = xmalloc(sizeof(*m));
+	m->addr = addr;
+	m->len = st.st_size;
+	m->next = sp->maps;
+	sp->maps = m;
+	*len = st.st_size;
+	return addr;
+}
+
+static int
+parse_mapped(struct sgf_parser *sp, int fd, const char *fn,
+	     struct gametree **gg) {
+	void *addr;
+	size_t len;
+
+	addr = map_input(sp, fd, &len);
+	if (addr == NULL)
+		return sgf_parse_fd(sp, fd, fn, gg);
+	return sgf_parse_buffer(sp, addr, len, fn, gg);
+}
 
-	if (strcmp(infilename, "-")) {
-		FILE *f = freopen(fn, "r", stdin);
-		if (!f)
-			errexit("cannot open %s", fn);
+/* fn NULL or "-" is stdin */
+int
+sgf_parse_path(struct sgf_parser *sp, const char *fn, struct gametree **gg) {
+	int fd, ret;
+
+	if (fn == NULL || !strcmp(fn, "-"))
+		return sgf_parse_file(sp, stdin, "-", gg);
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		sp->name = fn;
+		sp->linenr = 0;
+		snprintf(sp->errmsg, sizeof(sp->errmsg), "cannot open %s", fn);
+		return -1;
 	}
+	if (sp->flags & SGF_MMAP)
+		ret = parse_mapped(sp, fd, fn, gg);
+	else
+		ret = sgf_parse_fd(sp, fd, fn, gg);
+	close(fd);
+	return ret;
+}
 
-	eof = peekc = 0;
-	inbufct = 0;
-	linenr = 1;	/* report linenr on error */
+/*
+ * Streaming: read a collection one game at a time, so that only the
+ * current game is in memory. After sgf_stream_path(), each call of
+ * sgf_next_game() releases the game it returned before, and parses
+ * the next top-level gametree. It returns 1 with *gg set (a single
+ * game, without nextsibling), 0 when there are no more games, or -1
+ * after an error. sgf_more_games() tells whether another game follows
+ * the one just returned.
+ */
+int
+sgf_stream_path(struct sgf_parser *sp, const char *fn) {
+	void *addr;
+	size_t len;
+	int fd;
+
+	sgf_parser_clear(sp);
+	sp->name = fn;
+	sp->eof = sp->peekc = sp->pbct = 0;
+	sp->linenr = 1;
+	sp->errmsg[0] = 0;
+	sp->fd = -1;
+	sp->views = 0;
+	sp->dropped = 0;
+
+	if (fn == NULL || !strcmp(fn, "-")) {
+		sp->name = "-";
+		need_inbuf(sp);
+		sp->f = stdin;
+		sp->stream = STREAM_START;
+		return 0;
+	}
 
-	skip_initial_BOM();
-	skip_initial_garbage();
-	if (eof)
-		errexit("no game found");
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		sp->linenr = 0;
+		snprintf(sp->errmsg, sizeof(sp->errmsg), "cannot open %s", fn);
+		return -1;
+	}
+	addr = ((sp->flags & SGF_MMAP) ? map_input(sp, fd, &len) : NULL);
+	if (addr) {
+		close(fd);
+		sp->views = 1;
+#ifdef TRACING
+		if (sp->flags & SGF_TRACEIN)
+			sp->views = 0;
+#endif
+		sp->inbufp = addr;
+		sp->inbufct = len;
+	} else {
+		need_inbuf(sp);
+		sp->fd = sp->streamfd = fd;
+	}
+	sp->stream = STREAM_START;
+	return 0;
+}
+
+/* free the previous game, and the part of the mapping it used */
+static void
+release_game(struct sgf_parser *sp) {
+	struct mapping *m = sp->maps;
+	size_t done;
+
+	memset(sp->ids, 0, sizeof(sp->ids));
+	sp->nids = 0;
+	yarelease(&sp->arena, NULL);
+	if (sp->views && m) {
+		done = (const char *) sp->inbufp - (const char *) m->addr;
+		done &= ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+		if (done > sp->dropped) {
+			madvise((char *) m->addr + sp->dropped,
+				done - sp->dropped, MADV_DONTNEED);
+			sp->dropped = done;
+		}
+	}
+}
+
+/* after a game: leave the '(' of the next one in peekc, or stop */
+static void
+find_next_game(struct sgf_parser *sp) {
+	int c;
 
-	*gg = read_collection();
+	c = mygetsym(sp);
+	sp->peekc = c;
+	if (c == '(')
+		return;
+	if (sp->flags & SGF_MULTIIN) {
+		skip_initial_garbage(sp);
+		if (!sp->eof)
+			return;
+	}
+	sp->stream = STREAM_END;
+}
+
+int
+sgf_next_game(struct sgf_parser *sp, struct gametree **gg) {
+	struct gametree *g;
+	int c, first;
+
+	*gg = NULL;
+	if (sp->stream == STREAM_NONE || sp->stream == STREAM_END)
+		return 0;
+	release_game(sp);
+	if (setjmp(sp->jb)) {
+		sp->stream = STREAM_END;
+		return -1;
+	}
+
+	first = (sp->stream == STREAM_START);
+	if (first) {
+		skip_initial_BOM(sp);
+		skip_initial_garbage(sp);
+		if (sp->eof)
+			parse_error(sp, "no game found");
+		sp->stream = STREAM_GAMES;
+	}
 
+	g = NULL;
+	while (g == NULL && sp->stream == STREAM_GAMES) {
+		c = mygetsym(sp);	/* the '(' left by find_next_game() */
+		g = read_baretree_sequence(sp);
+		if ((c = mygetsym(sp)) != ')')
+			parse_error(sp, "gametree does not end with ')'"
+				    " - got '%c'", c);
+		find_next_game(sp);
+	}
+	if (g == NULL && first)
+		parse_error(sp, "empty gametree_sequence");
+	*gg = g;
+	return (g != NULL);
+}
+
+int
+sgf_more_games(struct sgf_parser *sp) {
+	return (sp->stream == STREAM_GAMES);
+}
+
+/* report the error of a failed parse in the usual way */
+void
+sgf_parser_errexit(struct sgf_parser *sp) {
+	linenr = sp->linenr;
+	errexit("%s", sp->errmsg);
+}
+
+/*
+ * Read and parse an sgf file, as the old readsgf() did:
+ * set infilename, and call errexit() on errors.
+ */
+void
+sgf_readsgf(struct sgf_parser *sp, const char *fn, struct gametree **gg) {
+	infilename = (fn ? fn : "-");
+	if (sgf_parse_path(sp, fn, gg) < 0)
+		sgf_parser_errexit(sp);
 	linenr = 0;	/* avoid error messages with linenr now */
-	return 0;
+}
+
+/* the same for streaming: sgf_stream_path() and sgf_next_game() */
+void
+sgf_readsgf_stream(struct sgf_parser *sp, const char *fn) {
+	infilename = (fn ? fn : "-");
+	if (sgf_stream_path(sp, fn) < 0)
+		sgf_parser_errexit(sp);
+}
+
+int
+sgf_readgame(struct sgf_parser *sp, struct gametree **gg) {
+	int ret;
+
+	ret = sgf_next_game(sp, gg);
+	if (ret < 0)
+		sgf_parser_errexit(sp);
+	linenr = 0;
+	return ret;
 }
@@ -12,16 +12,67 @@ struct node {
 };
 
 struct property {
-	char *id;
+	char *id;		/* shared between properties, do not change */
+	int tag;		/* PROP_xx from sgfprop.h */
 	struct propvalue *val;
 	struct property *next;
 };
 
 struct propvalue {
-	char *val;
+	char *val;		/* with SGF_MMAP NULL until sgf_value() */
 	struct propvalue *next;
+	const char *raw;	/* the len bytes of the value, not 0-terminated */
+	int len;
 };
 
-extern int readsgf(const char *fn, struct gametree **gg);
+/*
+ * Parser contexts: each holds its own input buffer, error state and
+ * the arena with the parse trees, so that several may be used at once.
+ * The sgf_parse_* routines return 0, or -1 after an error, with
+ * sgf_parser_error() and sgf_parser_linenr() saying what went wrong.
+ * The trees live until sgf_parser_clear() or sgf_parser_free().
+ */
+#define SGF_MULTIIN	1	/* expect multiple games (+garbage) */
+#define SGF_TRACEIN	2	/* print input as it is being read */
+#define SGF_QUIET	4	/* suppress "skipping initial garbage" */
+#define SGF_FULLPROP	8	/* keep lower case letters in property names */
+#define SGF_MMAP	16	/* map input files and do not copy values */
+#define SGF_HUGEPAGES	32	/* parse trees in huge page chunks */
+
+struct sgf_parser;
+
+extern struct sgf_parser *sgf_parser_new(int flags);
+extern void sgf_parser_clear(struct sgf_parser *sp);
+extern void sgf_parser_free(struct sgf_parser *sp);
+extern int sgf_parse_path(struct sgf_parser *sp, const char *fn,
+			  struct gametree **gg);
+extern int sgf_parse_fd(struct sgf_parser *sp, int fd, const char *name,
+			struct gametree **gg);
+extern int sgf_parse_file(struct sgf_parser *sp, FILE *f, const char *name,
+			  struct gametree **gg);
+extern int sgf_parse_buffer(struct sgf_parser *sp, const char *buf,
+			    size_t len, const char *name,
+			    struct gametree **gg);
+extern const char *sgf_parser_error(struct sgf_parser *sp);
+extern int sgf_parser_linenr(struct sgf_parser *sp);
+extern void sgf_parser_errexit(struct sgf_parser *sp);
+extern char *sgf_value(struct sgf_parser *sp, struct propvalue *pv);
+
+/* one game at a time, freeing each before reading the next */
+extern int sgf_stream_path(struct sgf_parser *sp, const char *fn);
+extern int sgf_next_game(struct sgf_parser *sp, struct gametree **gg);
+extern int sgf_more_games(struct sgf_parser *sp);
+
+/* parse fn (NULL or "-" for stdin), errexit() on errors */
+extern void sgf_readsgf(struct sgf_parser *sp, const char *fn,
+			struct gametree **gg);
+extern void sgf_readsgf_stream(struct sgf_parser *sp, const char *fn);
+extern int sgf_readgame(struct sgf_parser *sp, struct gametree **gg);
+
+/* the flags from the options below */
+extern int sgf_default_flags(void);
 extern int multiin, tracein, readquietly, fullprop;
 
+/* the old interface, now only in readsgf0.c */
+extern int readsgf(const char *fn, struct gametree **gg);
+
@@ -20,6 +20,7 @@
 #include <string.h>
 #include "errexit.h"
 #include "readsgf.h"
+#include "sgfprop.h"
 #include "xmalloc.h"
 
 int splittofiles = 0;
@@ -173,6 +174,7 @@ newprop(struct property **prev, char *id, char *val) {
 	p = xmalloc(sizeof(*p));
 	p->val = pv;
 	p->id = id;
+	p->tag = sgfprop_tag(id);
 	p->next = (*prev)->next;
 	(*prev)->next = p;
 	*prev = p;
@@ -433,7 +435,7 @@ write_property_sequence(struct property *p) {
 		/* check for C[] in root node and try to parse */
 		/* note: this will reparse things just added */
 		for (q=p; q; q=q->next) {
-			if (!strcmp(q->id, "C"))
+			if (q->tag == PROP_C)
 				parse_comment(q);
 		}
 	}
@@ -483,17 +485,17 @@ write_property_sequence(struct property *p) {
 
 	for (q=p; q; q=q->next) {
 		/* normalize some known things */
-		if (!strcmp(q->id, "BR")) /* B rank */
+		if (q->tag == PROP_BR) /* B rank */
 			normalize_rank(q->val);
-		if (!strcmp(q->id, "WR")) /* W rank */
+		if (q->tag == PROP_WR) /* W rank */
 			normalize_rank(q->val);
-		if (!strcmp(q->id, "TM")) /* time */
+		if (q->tag == PROP_TM) /* time */
 			normalize_time(q->val);
-		if (!strcmp(q->id, "KM")) /* komi */
+		if (q->tag == PROP_KM) /* komi */
 			normalize_komi(q->val);
-		if (!strcmp(q->id, "RE")) /* result */
+		if (q->tag == PROP_RE) /* result */
 			normalize_result(q, q->val);
-		if (!strcmp(q->id, "DT")) { /* date */
+		if (q->tag == PROP_DT) { /* date */
 			if (dateck) {
 				char *od, *nd;
 				od = q->val->val;
@@ -547,7 +549,7 @@ write_property_sequence(struct property *p) {
 		sameline = 0;
 
 		/* are there other empty properties that should be kept? */
-		if (single && empty && strcmp(p->id, "VW"))
+		if (single && empty && p->tag != PROP_VW)
 			goto skip;
 
 		for (i=0; i<SIZE(known); i++)
@@ -581,7 +583,7 @@ write_property_sequence(struct property *p) {
 static int
 is_move(struct property *p) {
 	return (p && p->val->next == NULL &&
-		(!strcmp(p->id, "B") || !strcmp(p->id, "W")));
+		(p->tag == PROP_B || p->tag == PROP_W));
 }
 
 static void
@@ -2353,6 +2355,7 @@ usage() {
 int
 main(int argc, char **argv){
 	struct gametree *g;
+	struct sgf_parser *sp;
 	int i, inct;
 
 	progname = "sgf";
@@ -2418,19 +2421,24 @@ main(int argc, char **argv){
 	/* sgf will leave non-understood dates, and warn only */
 	warnings_are_fatal = 0;
 
+	/* one game at a time, so that large collections fit in memory */
+	sp = sgf_parser_new(sgf_default_flags());
 	if (inct == 0) {
-		readsgf(NULL, &g);		/* read stdin */
-
-		write_init();
-		write_gametree_sequence(g);
+		sgf_readsgf_stream(sp, NULL);	/* read stdin */
+		while (sgf_readgame(sp, &g)) {
+			write_init();
+			write_gametree_sequence(g);
+		}
 	} else {
 		/* output a game collection */
 		for (i=1; i<argc; i++) {
 			if (argv[i][0] == '-')
 				continue;
-			readsgf(argv[i], &g);
-			write_init();
-			write_gametree_sequence(g);
+			sgf_readsgf_stream(sp, argv[i]);
+			while (sgf_readgame(sp, &g)) {
+				write_init();
+				write_gametree_sequence(g);
+			}
 		}
 	}
 
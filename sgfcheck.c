@@ -749,7 +749,9 @@ get_number_of_games(struct gametree *g) {
 static void
 do_stdin(const char *fn) {
 	struct gametree *g;
+	struct yamark m;
 
+	ymark(&m);	/* readsgf() allocates with ymalloc() */
 	if (setjmp(jmpbuf))
 		goto ret;
 	have_jmpbuf = 1;
@@ -769,6 +771,7 @@ do_stdin(const char *fn) {
 ret:
 	warn_prefix = 0;
 	have_jmpbuf = 0;
+	yrelease(&m);
 }
 
 void
@@ -184,6 +184,8 @@ int align = 1;
 
 int boardsize = SZ;
 
+static struct sgf_parser *parser;
+
 /* perform one of 8 transformations; coords in 0..(size-1) */
 static void transform0(int *xx, int *yy, int tra, int size) {
         int x, y, xn, yn;
@@ -551,8 +553,8 @@ set_size(int *sz, struct gametree *g) {
 		p = node->p;
 		while (p) {
 			if (p->id && !strcmp(p->id, "SZ") &&
-			    p->val && p->val->val) {
-				*sz = atoi(p->val->val);
+			    p->val) {
+				*sz = atoi(sgf_value(parser, p->val));
 				return;
 			}
 			p = p->next;
@@ -630,13 +632,13 @@ colors_ok(char *fn, int n, int *moves) {
 
 static int
 getmove(struct property *p) {
-	char *m = p->val->val;
+	const char *m = p->val->raw;
 	int highbit;
 
-	if (*m == 0)
+	if (p->val->len == 0)
 		m = "tt";	/* %% PASS */
-	else if (strlen(m) != 2)
-		errexit("move %s does not have length 2", m);
+	else if (p->val->len != 2)
+		errexit("move %.*s does not have length 2", p->val->len, m);
 	highbit = ((p->id[0] == 'W') ? HIGHBIT : 0);
 		
 	return (highbit + (m[0] << 8) + m[1]);
@@ -666,7 +668,9 @@ static void
 prepare_cmp(char *fn, struct gametree **g, int *sz) {
 	int n;
 
-	readsgf(fn, g);
+	if (parser == NULL)
+		parser = sgf_parser_new(sgf_default_flags() | SGF_MMAP);
+	sgf_readsgf(parser, fn, g);
 
 	n = number_of_games(*g);
 	if (n != 1)
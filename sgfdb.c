@@ -3,7 +3,8 @@
  * (store moves and filename and gamenumber)
  * aeb - 2013-05-23
  *
- * Call: sgfdb [-i] [-o outfile] [-t] [-r] [-e .sgf] infiles
+ * Call: sgfdb [-i] [-o outfile] [-t] [-r] [-e .sgf] [-x] [-z] [-M MB]
+ *	[-T dir] infiles
  *
  * -o: set outputfile; default is "out.sgfdb"
  * -i: ignore errors
@@ -13,7 +14,24 @@
  *     are searched for .sgf files)
  * -e: set the extension used by -r; default is ".sgf"
  *     -e "" does not impose any condition and will take all files
+ * -j N: parse and replay the input files on N threads (the games
+ *     are still written in the order in which the files were found);
+ *     with a single input file, replay its games on N threads
+ * -x: also write an index of the moves, for fast -p and -pat searches
+ * -z: also write an index of the positions, for fast -pos searches
+ * -M MB: keep at most about MB megabytes (default 256) of index
+ *     entries in memory; the rest is sorted on disk
+ * -T dir: directory for those temporary files (default $TMPDIR or /tmp)
  *
+ * The output is a version 3 data base (see sgfdb.h): the records,
+ * then the filenames, then an index of the records, then the columns
+ * and the can64 hash of each game (and with -x the move index, with -z
+ * the position index), then the games sorted by hash, player and date,
+ * and finally the header is filled in.
+ * The entries of the move, position, hash, player and date indices
+ * are sorted by an external sort (extsort.c), so that beyond the
+ * records themselves (written as they come) memory is needed only
+ * for the names, the record offsets, the columns and the hashes.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,94 +39,223 @@
 #include <errno.h>
 #include "errexit.h"
 #include "readsgf.h"
+#include "sgfprop.h"
 #include "sgfdb.h"
 #include "ftw.h"
 #include "playgogame.h"
+#include "xmalloc.h"
+#include "workq.h"
+#include "movehash.h"
+#include "sgfdbread.h"
+#include "extsort.h"
 
-struct bingame bg;
 char *outfilename = "out.sgfdb";
-FILE *outf;
+FILE *dbf;		/* the output data base */
 int recursive = 0;
 char *file_extension = ".sgf";
+int nthreads = 0;	/* -j: number of worker threads */
+int optx = 0;		/* -x: write SECT_MOVES */
+int optz = 0;		/* -z: write SECT_POSITIONS */
+long memlimit = 256;	/* -M: megabytes for sorting */
+char *tmpdir = NULL;	/* -T: directory for temporary files */
+int totalgames;
 
 #define BLACK_MASK  0x10000
 #define WHITE_MASK  0x20000
 
+/*
+ * The state below is per thread. Each input file is turned into
+ * records in a memory buffer (outf); with -j this happens in worker
+ * threads, and the writer thread copies the buffers to dbf in the
+ * order of the input files.
+ */
 #define MAXMOVES	10000
-int moves[MAXMOVES], mvct;
-int size, movect, handct, abct, awct;
+__thread FILE *outf;
+__thread FILE *metaf;		/* root node strings for the columns */
+__thread FILE *posf;		/* positions, with -z */
+__thread struct node *rootnode;
+__thread int moves[MAXMOVES], mvct;
+__thread int size, movect, handct, abct, awct;
 
-int number_of_games;
-int gamenr;		/* serial number (from 1) of current game */
-int gtlevel;		/* nesting depth of parens */
-int skipping;		/* true if not the main game line */
-int outgames;
+__thread int gamenr;		/* serial number (from 1) of current game */
+__thread int gtlevel;		/* nesting depth of parens */
+__thread int skipping;		/* true if not the main game line */
+__thread int outgames;
+__thread int failed;		/* an error occurred in this file */
+__thread struct sgf_parser *parser;
+
+/*
+ * The games of a file are read one at a time, and collected (up to
+ * BATCHMAX at a time) to be replayed with one call of pg_replay_batch(),
+ * on replaythreads threads (when there is only one input file),
+ * before their records are written. The parse tree of a game is gone
+ * when the next is read, so what is needed of it is copied.
+ */
+#define BATCHMAX	4096
+int replaythreads = 1;
+__thread struct pg_batchgame *batch;
+__thread struct batchinfo {
+	char *rootstrings[4];
+	int gamenr;		/* in bingame3 */
+	int abct, awct;
+} *batchinfo;
+__thread int batchct, batchmax;
+__thread struct yarena batcharena;
+
+/* the values for COL_PB, COL_PW, COL_DT, COL_RE */
+static void
+get_rootstrings(char **ss) {
+	static const int tags[] = { PROP_PB, PROP_PW, PROP_DT, PROP_RE };
+	struct property *p;
+	char *s;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		s = "";
+		for (p = rootnode->p; p; p = p->next) {
+			if (p->tag == tags[i] && p->val) {
+				s = sgf_value(parser, p->val);
+				break;
+			}
+		}
+		ss[i] = yastrdup(&batcharena, s);
+	}
+}
+
+/* the same, NUL-terminated, to metaf */
+static void
+put_rootstrings(char **ss) {
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (fwrite(ss[i], strlen(ss[i])+1, 1, metaf) != 1)
+			errexit("output error");
+}
+
+/* the positions of this game, with game the index in this file */
+static void
+put_positions(struct pg_batchgame *g) {
+	const unsigned long long *h = g->hashes;
+	struct sgfdb_position sp;
+	int c;
+
+	sp.game = outgames;
+	for (c = g->initct; c <= g->mvct; c++) {
+		if (c > g->initct && h[c] == h[c-1])
+			continue;
+		sp.hash = h[c];
+		sp.movenr = c - g->initct;
+		if (fwrite(&sp, sizeof(sp), 1, posf) != 1)
+			errexit("output error");
+	}
+}
 
 static void
 report_on_single_game() {
-	struct played_game game;
-	short int mv[MAXMOVES];
-
-	game.mv = mv;
-	game.mvlen = MAXMOVES;
-
-	/* should make gamenr available to playgogame() for better errmsgs */
-	playgogame(size, moves, mvct, abct+awct, &game);
-
-	bg.gamenr = ((number_of_games == 1) ? 0 : gamenr);
-	bg.movect = mvct - abct - awct;
-	bg.size = size;
-	bg.abct = abct;
-	bg.awct = awct;
-	bg.bcapt = game.counts[1];	/* test for overflow? */
-	bg.wcapt = game.counts[2];
-	bg.mvct = game.mvct;	/* this includes captures */
-	bg.filenamelen = (strlen(infilename) + 2) & ~1;
-	bg.sz = sizeof(bg) + bg.filenamelen + bg.mvct * sizeof(short int);
+	struct pg_batchgame *g;
+
+	if (batchct == batchmax) {
+		batchmax = (batchmax ? 2*batchmax : 64);
+		batch = xrealloc(batch, batchmax * sizeof(*batch));
+		batchinfo = xrealloc(batchinfo,
+				     batchmax * sizeof(*batchinfo));
+	}
+	get_rootstrings(batchinfo[batchct].rootstrings);
+	batchinfo[batchct].gamenr =
+		((gamenr == 1 && !sgf_more_games(parser)) ? 0 : gamenr);
+	batchinfo[batchct].abct = abct;
+	batchinfo[batchct].awct = awct;
+	g = &batch[batchct++];
+	g->name = infilename;
+	g->size = size;
+	g->moves = yamalloc(&batcharena, mvct * sizeof(int));
+	memcpy(g->moves, moves, mvct * sizeof(int));
+	g->mvct = mvct;
+	g->initct = abct+awct;
+	g->hashes = (optz ? yamalloc(&batcharena, (mvct+1) *
+				     sizeof(unsigned long long)) : NULL);
+}
+
+static void
+put_game(int i) {
+	struct pg_batchgame *g = &batch[i];
+	struct bingame3 bg;
+	static const char zeros[8];
+	int len;
+
+	memset(&bg, 0, sizeof(bg));
+	bg.gamenr = batchinfo[i].gamenr;
+	bg.fnoff = 0;		/* filled in by write_job() */
+	bg.movect = g->mvct - g->initct;
+	bg.size = g->size;
+	bg.abct = batchinfo[i].abct;
+	bg.awct = batchinfo[i].awct;
+	bg.bcapt = g->pg.counts[1];
+	bg.wcapt = g->pg.counts[2];
+	bg.mvct = g->pg.mvct;	/* this includes captures */
+	len = sizeof(bg) + bg.mvct * sizeof(short int);
+	bg.sz = (len + 7) & ~7;
 
 	if (fwrite(&bg, sizeof(bg), 1, outf) != 1)
 		errexit("output error");
-	if (fwrite(mv, sizeof(short int), bg.mvct, outf) != bg.mvct)
+	if (fwrite(g->pg.mv, sizeof(short int), bg.mvct, outf) != bg.mvct)
 		errexit("output error");
-	if (fwrite(infilename, bg.filenamelen, 1, outf) != 1)
+	if (bg.sz > len && fwrite(zeros, bg.sz - len, 1, outf) != 1)
 		errexit("output error");
+	put_rootstrings(batchinfo[i].rootstrings);
+	if (optz)
+		put_positions(g);
 	outgames++;
 }
 
+/* replay the games collected so far, and write those before the first
+   that failed; -1 if one failed */
+static int
+write_games(void) {
+	int i, n, ct = batchct;
+
+	batchct = 0;
+	n = pg_replay_batch(batch, ct, replaythreads, &batcharena);
+	for (i = 0; i < n; i++)
+		put_game(i);
+	yarelease(&batcharena, NULL);
+	return (n < ct) ? -1 : 0;
+}
+
 static int
 is_move(struct property *p) {
 	return (p && p->val->next == NULL &&
-		(!strcmp(p->id, "B") || !strcmp(p->id, "W")));
+		(p->tag == PROP_B || p->tag == PROP_W));
 }
 
 #define PASS (('t'<<8) | 't')
 
 static int
-move_to_int(char *s) {
-	if (*s == 0)
+move_to_int(const char *s, int n) {
+	if (n == 0)
 		return PASS;
-	if (s[1] == 0 || s[2] != 0)
-		errexit("unexpected move _%s_", s);
+	if (n != 2)
+		errexit("unexpected move _%.*s_", n, s);
 	return (s[0]<<8) + s[1];
 }
 
 static void
 put_move(struct propvalue *pv, int mask) {
-	char *s, *t;
+	const char *s;
+	int n;
 
 	if (!pv)
 		errexit("missing move value");
-	s = pv->val;	/* something like "dp" */
+	s = pv->raw;	/* something like "dp" */
+	n = pv->len;
 
 	/* strip trailing whitespace */
-	t = s;
-	while (*t) t++;
-	while (--t >= s && (*t == ' ' || *t == '\n' || *t == '\r'))
-		*t = 0;
+	while (n > 0 && (s[n-1] == ' ' || s[n-1] == '\n' || s[n-1] == '\r'))
+		n--;
 
 	if (mvct == MAXMOVES)
 		errexit("too many moves");
-	moves[mvct++] = move_to_int(s) | mask;
+	moves[mvct++] = move_to_int(s, n) | mask;
 }
 
 static void
@@ -121,7 +268,7 @@ put_nodesequence(struct node *n) {
 		/* a move should be the only property in its node */
 		p = n->p;
 		if (is_move(p)) {
-			mask = (p->id[0] == 'B') ? BLACK_MASK : WHITE_MASK;
+			mask = (p->tag == PROP_B) ? BLACK_MASK : WHITE_MASK;
 			put_move(p->val, mask);
 		}
 #else
@@ -130,7 +277,7 @@ put_nodesequence(struct node *n) {
 		p = n->p;
 		while (p) {
 			if (is_move(p)) {
-				mask = (p->id[0] == 'B')
+				mask = (p->tag == PROP_B)
 					? BLACK_MASK : WHITE_MASK;
 				put_move(p->val, mask);
 			}
@@ -148,14 +295,14 @@ get_setup_stones(struct node *node) {
 
 	p = node->p;
 	while (p) {
-		if (!strcmp(p->id, "AB")) {
+		if (p->tag == PROP_AB) {
 			pv = p->val;
 			while (pv) {
 				abct++;
 				put_move(pv, BLACK_MASK);
 				pv = pv->next;
 			}
-		} else if (!strcmp(p->id, "AW")) {
+		} else if (p->tag == PROP_AW) {
 			pv = p->val;
 			while (pv) {
 				awct++;
@@ -201,10 +348,10 @@ setsize(struct node *node) {
 	struct property *p = node->p;
 
 	while (p) {
-		if (!strcmp(p->id, "SZ")) {
+		if (p->tag == PROP_SZ) {
 			if (!p->val || p->val->next)
 				errexit("strange SZ property");
-			size = atoi(p->val->val);
+			size = atoi(sgf_value(parser, p->val));
 			if (size < 0 || size > MAXSZ)
 				errexit("SZ[%d] out of bounds", size);
 			if (size > SZ)
@@ -218,6 +365,7 @@ setsize(struct node *node) {
 static void
 init_single_game(struct gametree *g) {
 	gamenr++;
+	rootnode = g->nodesequence;
 	size = DEFAULTSZ;
 	mvct = abct = awct = 0;
 
@@ -252,36 +400,550 @@ put_gametree_sequence(struct gametree *g) {
 	}
 }
 
-static int
-get_number_of_games(struct gametree *g) {
-	int n = 0;
-
-	while (g) {
-		g = g->nextsibling;
-		n++;
-	}
-	return n;
-}
-
 static void
 do_stdin(const char *fn) {
 	struct gametree *g;
 
+	failed = 1;
 	if (setjmp(jmpbuf))
 		goto ret;
 	have_jmpbuf = 1;
 
-	readsgf(fn, &g);
-	number_of_games = get_number_of_games(g);
+	if (parser == NULL) {
+		parser = sgf_parser_new(sgf_default_flags() | SGF_MMAP |
+					SGF_HUGEPAGES);
+		batcharena.huge = 1;
+	}
+	sgf_readsgf_stream(parser, fn);
 	gamenr = gtlevel = skipping = 0;
-	put_gametree_sequence(g);
+	while (sgf_readgame(parser, &g)) {
+		put_gametree_sequence(g);
+		if (batchct == BATCHMAX && write_games() < 0)
+			goto ret;
+	}
+	failed = 0;
 ret:
 	have_jmpbuf = 0;
+	if (write_games() < 0)
+		failed = 1;
+	sgf_parser_clear(parser);
+}
+
+struct dbjob {
+	char *fn;		/* NULL for stdin */
+	char *buf;		/* the records for this file */
+	size_t len;
+	char *meta;		/* four strings per record */
+	size_t metalen;
+	char *pos;		/* struct sgfdb_position, with -z */
+	size_t poslen;
+	int games;
+	int failed;
+};
+
+static struct workq *wq;
+
+/*
+ * In a worker thread, or directly when serial. Errors come back here
+ * also without -i, so that write_job() can stop at the same point
+ * as a serial run.
+ */
+static void
+parse_job(void *arg) {
+	struct dbjob *job = arg;
+
+	outf = open_memstream(&job->buf, &job->len);
+	metaf = open_memstream(&job->meta, &job->metalen);
+	posf = open_memstream(&job->pos, &job->poslen);
+	if (outf == NULL || metaf == NULL || posf == NULL)
+		fatalexit("open_memstream failed");
+	outgames = 0;
+	catch_errors = 1;
+	do_stdin(job->fn);
+	fclose(outf);
+	fclose(metaf);
+	fclose(posf);
+	job->games = outgames;
+	job->failed = failed;
+}
+
+/*
+ * The rest of the output is collected by write_job(), that only
+ * runs in one thread at a time, and written by finish_db().
+ */
+static long long dbpos;		/* bytes written to dbf */
+static long long *gameoffs;	/* SECT_INDEX */
+static int *columns[DB_NCOLS];	/* SECT_COLUMNS */
+static unsigned long long *gamehashes;	/* SECT_HASHES */
+static int maxgames;
+
+static char *names;		/* SECT_NAMES */
+static int nameslen, namesmax, nnames;
+static int *namehash;		/* 1 + offset in names, or 0 */
+static int namehashsz;
+
+static unsigned int
+hashname(const char *s) {
+	unsigned int h = 0;
+
+	while (*s)
+		h = h*31 + (unsigned char) *s++;
+	return h;
+}
+
+static void
+rehash_names(void) {
+	int i, off;
+	unsigned int h;
+
+	namehashsz = (namehashsz ? 2*namehashsz : 1024);
+	free(namehash);
+	namehash = xmalloc(namehashsz * sizeof(int));
+	for (i = 0; i < namehashsz; i++)
+		namehash[i] = 0;
+	for (off = 0; off < nameslen; off += strlen(names+off)+1) {
+		h = hashname(names+off) & (namehashsz-1);
+		while (namehash[h])
+			h = (h+1) & (namehashsz-1);
+		namehash[h] = off+1;
+	}
+}
+
+/* offset of fn in the names section, adding it if new */
+static int
+add_name(const char *fn) {
+	unsigned int h;
+	int n, off;
+
+	if (2*(nnames+1) > namehashsz)
+		rehash_names();
+	h = hashname(fn) & (namehashsz-1);
+	while (namehash[h]) {
+		off = namehash[h]-1;
+		if (!strcmp(names+off, fn))
+			return off;
+		h = (h+1) & (namehashsz-1);
+	}
+
+	n = strlen(fn) + 1;
+	while (nameslen + n > namesmax) {
+		namesmax = (namesmax ? 2*namesmax : 65536);
+		names = xrealloc(names, namesmax);
+	}
+	off = nameslen;
+	memcpy(names+off, fn, n);
+	nameslen += n;
+	nnames++;
+	namehash[h] = off+1;
+	return off;
+}
+
+/* offset of the next string at *pp in the names section, or -1 if empty */
+static int
+add_string(char **pp, char *end) {
+	char *s = *pp;
+
+	if (s >= end)
+		return -1;
+	*pp += strlen(s) + 1;
+	return (*s ? add_name(s) : -1);
+}
+
+/* the memory for one external sort */
+static size_t
+sortmem(void) {
+	return (memlimit << 20) / ((optx && optz) ? 2 : 1);
+}
+
+/* the entries of SECT_MOVES, sorted by finish_db() */
+struct posting {
+	int key, game, movenr;
+};
+static struct extsort *postings;
+
+static int
+compar_postings(const void *aa, const void *bb) {
+	const struct posting *a = aa, *b = bb;
+
+	if (a->key != b->key)
+		return a->key - b->key;
+	if (a->game != b->game)
+		return a->game - b->game;
+	return a->movenr - b->movenr;
+}
+
+/* SECT_POSITIONS, sorted by finish_db() */
+static struct extsort *positions;
+
+static int
+compar_positions(const void *aa, const void *bb) {
+	const struct sgfdb_position *a = aa, *b = bb;
+
+	if (a->hash != b->hash)
+		return (a->hash < b->hash) ? -1 : 1;
+	if (a->game != b->game)
+		return a->game - b->game;
+	return a->movenr - b->movenr;
+}
+
+/* the positions of a job, renumbering its games from g */
+static void
+add_positions(int g, struct dbjob *job) {
+	struct sgfdb_position *sp;
+	long i, n;
+
+	if (positions == NULL)
+		positions = extsort_new(sizeof(*sp), sortmem(),
+					compar_positions, tmpdir);
+	n = job->poslen / sizeof(*sp);
+	sp = (struct sgfdb_position *) job->pos;
+	for (i = 0; i < n; i++) {
+		sp[i].game += g;
+		extsort_add(positions, &sp[i]);
+	}
+}
+
+/* the stones placed in game g (from 0) */
+static void
+add_postings(int g, struct bingame3 *bg) {
+	struct posting pp;
+	int i, m, n, initct;
+
+	if (postings == NULL)
+		postings = extsort_new(sizeof(pp), sortmem(),
+				       compar_postings, tmpdir);
+
+	initct = bg->abct + bg->awct;
+	n = 0;
+	for (i = 0; i < bg->mvct; i++) {
+		m = bg->mv[i];
+		if (m & PG_CAPTURE)
+			continue;
+		if (i >= initct)
+			n++;
+		if (m & PG_PASS)
+			continue;
+		pp.key = m & (DB_NKEYS-1);
+		pp.game = g;
+		pp.movenr = n;
+		extsort_add(postings, &pp);
+	}
+}
+
+/* the can64 of a record, from its moves as sgfdbinfo sees them */
+static unsigned long long
+record_hash(struct bingame3 *bg) {
+	static int *mvs, maxmvs;
+	int n;
+
+	if (bg->mvct > maxmvs) {
+		maxmvs = 2*bg->mvct;
+		mvs = xrealloc(mvs, maxmvs * sizeof(int));
+	}
+	n = sgfdb_moves(bg, mvs);
+	return can64_moves(mvs, n, bg->size, NULL);
+}
+
+static void
+write_out(const void *p, long long len) {
+	if (len && fwrite(p, len, 1, dbf) != 1)
+		fatalexit("output error writing %s", outfilename);
+	dbpos += len;
+}
+
+static void
+pad_out(void) {
+	static const char zeros[8];
+
+	write_out(zeros, (8 - (dbpos & 7)) & 7);
+}
+
+static void
+set_section(struct sgfdb3 *db, int i, int type, long long off) {
+	db->sect[i].type = type;
+	db->sect[i].offset = off;
+	db->sect[i].len = dbpos - off;
+}
+
+static void
+seek_out(long long off) {
+	if (fseeko(dbf, off, SEEK_SET) != 0)
+		fatalexit("seek error on %s", outfilename);
+}
+
+/* write the varint lists of SECT_MOVES from the sorted postings */
+static void
+write_postings(void) {
+	long long offs[DB_NKEYS+1];
+	const struct posting *pp;
+	unsigned char buf[4096];
+	unsigned int v;
+	long long start;
+	int key, lastgame, len, k;
+
+	start = dbpos;
+	memset(offs, 0, sizeof(offs));
+	write_out(offs, sizeof(offs));		/* filled in below */
+	offs[0] = sizeof(offs);
+	key = lastgame = len = 0;
+	if (postings)
+		extsort_sort(postings);
+	while (postings && (pp = extsort_next(postings)) != NULL) {
+		for ( ; key < pp->key; key++) {
+			write_out(buf, len);
+			len = 0;
+			offs[key+1] = dbpos - start;
+			lastgame = 0;
+		}
+		if (len > sizeof(buf) - 10) {
+			write_out(buf, len);
+			len = 0;
+		}
+		for (k = 0; k < 2; k++) {
+			v = (k ? pp->movenr : pp->game - lastgame);
+			while (v >= 0x80) {
+				buf[len++] = (v & 0x7f) | 0x80;
+				v >>= 7;
+			}
+			buf[len++] = v;
+		}
+		lastgame = pp->game;
+	}
+	write_out(buf, len);
+	for ( ; key < DB_NKEYS; key++)
+		offs[key+1] = dbpos - start;
+	if (postings)
+		extsort_free(postings);
+
+	seek_out(start);
+	if (fwrite(offs, sizeof(offs), 1, dbf) != 1)
+		fatalexit("output error writing %s", outfilename);
+	seek_out(dbpos);
+}
+
+static void
+write_positions(void) {
+	const struct sgfdb_position *sp;
+
+	if (positions == NULL)
+		return;
+	extsort_sort(positions);
+	while ((sp = extsort_next(positions)) != NULL)
+		write_out(sp, sizeof(*sp));
+	extsort_free(positions);
+}
+
+/* for SECT_BYHASH: games by hash */
+struct hashref {
+	unsigned long long hash;
+	int game, pad;
+};
+
+static int
+compar_hashrefs(const void *aa, const void *bb) {
+	const struct hashref *a = aa, *b = bb;
+
+	if (a->hash != b->hash)
+		return (a->hash < b->hash) ? -1 : 1;
+	return a->game - b->game;
+}
+
+static void
+write_byhash(void) {
+	const struct hashref *hp;
+	struct extsort *es;
+	struct hashref h;
+	int i;
+
+	es = extsort_new(sizeof(h), memlimit << 20, compar_hashrefs, tmpdir);
+	h.pad = 0;
+	for (i = 0; i < totalgames; i++) {
+		h.hash = gamehashes[i];
+		h.game = i;
+		extsort_add(es, &h);
+	}
+	extsort_sort(es);
+	while ((hp = extsort_next(es)) != NULL)
+		write_out(&hp->game, sizeof(int));
+	extsort_free(es);
+}
+
+/* for SECT_BYPLAYER and SECT_BYDATE: games by a string in names */
+static int
+compar_namerefs(const void *aa, const void *bb) {
+	const struct sgfdb_nameref *a = aa, *b = bb;
+	int c;
+
+	if (a->name != b->name && (c = strcmp(names + a->name,
+					       names + b->name)) != 0)
+		return c;
+	return a->game - b->game;
+}
+
+static void
+write_bystring(int col1, int col2) {
+	const struct sgfdb_nameref *rp;
+	struct sgfdb_nameref r;
+	struct extsort *es;
+	int i;
+
+	es = extsort_new(sizeof(r), memlimit << 20, compar_namerefs, tmpdir);
+	for (i = 0; i < totalgames; i++) {
+		r.game = i;
+		if ((r.name = columns[col1][i]) >= 0)
+			extsort_add(es, &r);
+		if (col2 >= 0 && (r.name = columns[col2][i]) >= 0 &&
+		    r.name != columns[col1][i])
+			extsort_add(es, &r);
+	}
+	extsort_sort(es);
+	while ((rp = extsort_next(es)) != NULL)
+		write_out(rp, sizeof(*rp));
+	extsort_free(es);
+}
+
+/* write the names, the index and the columns, and fill in the header */
+static void
+finish_db(void) {
+	struct sgfdb3 db;
+	int i;
+
+	memset(&db, 0, sizeof(db));
+	db.headerlen = sizeof(db);
+	db.magic = DB_MAGIC;
+	db.version = DB_VERSION;
+	db.ngames = totalgames;
+	db.nsections = DB_MAXSECT;
+	set_section(&db, 0, SECT_GAMES, sizeof(db));
+
+	pad_out();
+	db.sect[1].offset = dbpos;
+	write_out(names, nameslen);
+	set_section(&db, 1, SECT_NAMES, db.sect[1].offset);
+
+	pad_out();
+	db.sect[2].offset = dbpos;
+	write_out(gameoffs, totalgames * sizeof(long long));
+	set_section(&db, 2, SECT_INDEX, db.sect[2].offset);
+
+	pad_out();
+	db.sect[3].offset = dbpos;
+	for (i = 0; i < DB_NCOLS; i++)
+		write_out(columns[i], totalgames * sizeof(int));
+	set_section(&db, 3, SECT_COLUMNS, db.sect[3].offset);
+
+	pad_out();
+	db.sect[6].offset = dbpos;
+	write_out(gamehashes, totalgames * sizeof(unsigned long long));
+	set_section(&db, 6, SECT_HASHES, db.sect[6].offset);
+
+	if (optx) {
+		pad_out();
+		db.sect[4].offset = dbpos;
+		write_postings();
+		set_section(&db, 4, SECT_MOVES, db.sect[4].offset);
+	}
+
+	if (optz) {
+		pad_out();
+		db.sect[5].offset = dbpos;
+		write_positions();
+		set_section(&db, 5, SECT_POSITIONS, db.sect[5].offset);
+	}
+
+	pad_out();
+	db.sect[7].offset = dbpos;
+	write_byhash();
+	set_section(&db, 7, SECT_BYHASH, db.sect[7].offset);
+
+	pad_out();
+	db.sect[8].offset = dbpos;
+	write_bystring(COL_PB, COL_PW);
+	set_section(&db, 8, SECT_BYPLAYER, db.sect[8].offset);
+
+	pad_out();
+	db.sect[9].offset = dbpos;
+	write_bystring(COL_DT, -1);
+	set_section(&db, 9, SECT_BYDATE, db.sect[9].offset);
+
+	if (fseek(dbf, 0L, SEEK_SET) != 0 ||
+	    fwrite(&db, sizeof(db), 1, dbf) != 1 || fclose(dbf) != 0)
+		fatalexit("output error writing header of %s", outfilename);
+}
+
+/* in the writer thread, in input order */
+static void
+write_job(void *arg) {
+	struct dbjob *job = arg;
+	struct bingame3 *bgp;
+	char *p, *q, *qend;
+	int fnoff, i, n;
+
+	if (job->games) {
+		if (optz)
+			add_positions(totalgames, job);
+		fnoff = add_name(job->fn ? job->fn : "-");
+		if (totalgames + job->games > maxgames) {
+			maxgames = 2*(totalgames + job->games) + 1024;
+			gameoffs = xrealloc(gameoffs,
+					    maxgames * sizeof(long long));
+			for (i = 0; i < DB_NCOLS; i++)
+				columns[i] = xrealloc(columns[i],
+						      maxgames * sizeof(int));
+			gamehashes = xrealloc(gamehashes, maxgames *
+					      sizeof(unsigned long long));
+		}
+		q = job->meta;
+		qend = q + job->metalen;
+		for (p = job->buf; p < job->buf + job->len; p += bgp->sz) {
+			bgp = (struct bingame3 *) p;
+			bgp->fnoff = fnoff;
+			n = totalgames++;
+			gameoffs[n] = dbpos + (p - job->buf);
+			columns[COL_SIZE][n] = bgp->size;
+			columns[COL_MOVECT][n] = bgp->movect;
+			columns[COL_ABCT][n] = bgp->abct;
+			columns[COL_AWCT][n] = bgp->awct;
+			columns[COL_BCAPT][n] = bgp->bcapt;
+			columns[COL_WCAPT][n] = bgp->wcapt;
+			columns[COL_PB][n] = add_string(&q, qend);
+			columns[COL_PW][n] = add_string(&q, qend);
+			columns[COL_DT][n] = add_string(&q, qend);
+			columns[COL_RE][n] = add_string(&q, qend);
+			gamehashes[n] = record_hash(bgp);
+			if (optx)
+				add_postings(n, bgp);
+		}
+	}
+	write_out(job->buf, job->len);
+
+	if (job->failed && !ignore_errors) {
+		finish_db();
+		exit(1);
+	}
+	free(job->buf);
+	free(job->meta);
+	free(job->pos);
+	free(job->fn);
+	free(job);
 }
 
 void
 do_input(const char *fn) {
-	do_stdin(fn);
+	struct dbjob *job;
+
+	job = xmalloc(sizeof(*job));
+	job->fn = (fn ? xstrdup((char *) fn) : NULL);
+	job->buf = job->meta = job->pos = NULL;
+	job->len = job->metalen = job->poslen = 0;
+	job->games = job->failed = 0;
+
+	if (wq)
+		workq_submit(wq, job);
+	else {
+		parse_job(job);
+		write_job(job);
+	}
 }
 
 static int
@@ -298,25 +960,24 @@ has_extension(char *fn, char *s) {
 static void
 open_outfile() {
 	char *mode;
-	struct sgfdb db;
+	struct sgfdb3 db;
 
 	/* try not to overwrite some random file */
 	mode = (has_extension(outfilename, ".sgfdb") ? "w" : "wx");
-	outf = fopen(outfilename, mode);
-	if (outf == NULL) {
+	dbf = fopen(outfilename, mode);
+	if (dbf == NULL) {
 		errexit((errno == EEXIST)
 			? "will not overwrite existing file %s"
 			: "could not create outputfile %s", outfilename);
 	}
 
-	/* write header */
-	db.headerlen = sizeof(struct sgfdb);
-	db.magic = DB_MAGIC;
-	db.version = DB_VERSION;
-	if (fwrite(&db, sizeof(db), 1, outf) != 1)
+	/* room for the header, written by finish_db() */
+	memset(&db, 0, sizeof(db));
+	if (fwrite(&db, sizeof(db), 1, dbf) != 1)
 		errexit("output error writing header of %s", outfilename);
+	dbpos = sizeof(db);
 
-	outgames = 0;
+	totalgames = 0;
 }
 
 static inline char *plur(int n) {
@@ -347,6 +1008,47 @@ main(int argc, char **argv){
 			opti = 1;
 			goto next;
 		}
+		if (!strncmp(argv[1], "-j", 2)) {
+			if (argv[1][2])
+				nthreads = atoi(argv[1]+2);
+			else {
+				if (argc == 2)
+					errexit("-j needs following number");
+				nthreads = atoi(argv[2]);
+				argc--; argv++;
+			}
+			if (nthreads < 1)
+				errexit("-j needs a positive number");
+			goto next;
+		}
+		if (!strcmp(argv[1], "-x")) {
+			optx = 1;
+			goto next;
+		}
+		if (!strcmp(argv[1], "-z")) {
+			optz = 1;
+			goto next;
+		}
+		if (!strncmp(argv[1], "-M", 2)) {
+			if (argv[1][2])
+				memlimit = atol(argv[1]+2);
+			else {
+				if (argc == 2)
+					errexit("-M needs following number");
+				memlimit = atol(argv[2]);
+				argc--; argv++;
+			}
+			if (memlimit < 1)
+				errexit("-M needs a positive number");
+			goto next;
+		}
+		if (!strcmp(argv[1], "-T")) {
+			if (argc == 2)
+				errexit("-T needs following directory");
+			tmpdir = argv[2];
+			argc--; argv++;
+			goto next;
+		}
 		if (!strcmp(argv[1], "-o")) {
 			if (argc == 1)
 				errexit("-o needs following filename");
@@ -368,8 +1070,10 @@ main(int argc, char **argv){
 			goto next;
 		}
 		errexit("Unknown option %s\n\n"
-	"Call: sgfdb [-i] [-o foo.sgfdb] [files]\n"
-	"or:   sgfdb [-i] [-o foo.sgfdb] -r [-e .mgt] [files/dirs]\n",
+	"Call: sgfdb [-i] [-j N] [-x] [-z] [-M MB] [-T dir] [-o foo.sgfdb] "
+	"[files]\n"
+	"or:   sgfdb [-i] [-j N] [-x] [-z] [-M MB] [-T dir] [-o foo.sgfdb] "
+	"-r [-e .mgt] [files/dirs]\n",
 			argv[1]);
 	next:
 		argc--; argv++;
@@ -380,21 +1084,32 @@ main(int argc, char **argv){
 		if (recursive)
 			errexit("refuse to read from stdin when recursive");
 		open_outfile();
-		do_stdin(NULL);
+		replaythreads = nthreads;
+		do_input(NULL);
+		finish_db();
 		return 0;
 	}
 
 	open_outfile();
 
+	ignore_errors = opti;
+	/* one file: replay its games in parallel instead */
+	if (nthreads > 1 && (argc > 2 || recursive))
+		wq = workq_start(nthreads, parse_job, write_job);
+	else
+		replaythreads = nthreads;
+
 	while (argc > 1) {
-		ignore_errors = opti;
 		do_infile(argv[1]);
 		argc--; argv++;
 	}
 
-	fclose(outf);
+	if (wq)
+		workq_finish(wq);
+
+	finish_db();
 	fprintf(stderr, "%s contains %d game%s\n", outfilename,
-		outgames, plur(outgames));
+		totalgames, plur(totalgames));
 
 	return 0;
 }
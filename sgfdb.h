@@ -1,4 +1,4 @@
-/* data base record, of variable length */
+/* data base record of version 2, of variable length */
 
 struct bingame {
 	short int sz;		/* total size of this record in bytes */
@@ -39,4 +39,114 @@ struct sgfdb {
 };
 
 #define DB_MAGIC	0x6a11
-#define DB_VERSION	2
+#define DB_VERSION2	2
+
+/*
+ * Version 3. The header has a fixed table of sections, each given by
+ * its type, offset from the start of the file, and length in bytes.
+ * All sections start at a multiple of 8.
+ *
+ * SECT_GAMES: the records, struct bingame3, each a multiple of 8 long
+ * SECT_INDEX: ngames file offsets (long long) of these records,
+ *   so that game i can be found directly
+ * SECT_NAMES: the filenames, NUL-terminated; each name occurs once,
+ *   and a record refers to its name by the offset fnoff in this section.
+ *   The strings of the COL_PB etc. columns are also kept here.
+ * SECT_COLUMNS: DB_NCOLS columns of ngames ints each, one after the
+ *   other, so that selections can be made without reading the records.
+ *   Column COL_xx has the value of field xx for each game; COL_PB,
+ *   COL_PW, COL_DT, COL_RE are offsets in SECT_NAMES of the value of
+ *   that property in the root node, or -1 if absent (or empty).
+ * SECT_MOVES (only with sgfdb -x): an inverted index of the moves.
+ *   For each key (color << 10 | point, as in mv[], so less than
+ *   DB_NKEYS) the list of the games where such a stone was placed.
+ *   The section starts with DB_NKEYS+1 long long offsets (relative
+ *   to the section) of these lists. A list is a sequence of pairs
+ *   (game index difference with the previous pair, move number) in
+ *   varint format (7 bits per byte, least significant first, high bit
+ *   set when more follow). Move numbers count as in sgfinfo -p,
+ *   setup stones have move number 0. Captures and passes are not listed.
+ * SECT_POSITIONS (only with sgfdb -z): for each game the positions
+ *   after move 0 (the setup stones), 1, 2, ... as struct sgfdb_position,
+ *   sorted by hash, game, movenr. The hash is the Zobrist hash of
+ *   pg_hashes() in playgogame.c. A position that is the same as that
+ *   after the previous move (after a pass) is not listed again.
+ * SECT_HASHES: for each game the unsigned long long can64_moves()
+ *   (see movehash.c) of its moves, as sgfinfo -can64 gives it, so that
+ *   duplicates can be found without decoding the records.
+ * SECT_BYHASH: the ngames game indices (int), sorted by the value in
+ *   SECT_HASHES and then by index, for lookup by binary search.
+ * SECT_BYPLAYER: struct sgfdb_nameref for each non-empty PB and PW,
+ *   sorted by the name (strcmp) and then by game.
+ * SECT_BYDATE: struct sgfdb_nameref for each non-empty DT, sorted
+ *   by the date string (strcmp) and then by game.
+ *   These three are built by an external sort (extsort.c), so that
+ *   sgfdb needs bounded memory for them, as for SECT_MOVES and
+ *   SECT_POSITIONS.
+ *
+ * Sections of unknown type are ignored by readers.
+ */
+#define DB_VERSION	3
+
+#define SECT_GAMES	1
+#define SECT_INDEX	2
+#define SECT_NAMES	3
+#define SECT_COLUMNS	4
+#define SECT_MOVES	5
+#define SECT_POSITIONS	6
+#define SECT_HASHES	7
+#define SECT_BYHASH	8
+#define SECT_BYPLAYER	9
+#define SECT_BYDATE	10
+
+#define DB_NKEYS	0x1000
+
+#define DB_MAXSECT	16
+
+struct sgfdb_section {
+	int type;		/* 0: unused slot */
+	int pad;
+	long long offset;
+	long long len;
+};
+
+struct sgfdb3 {
+	int headerlen;		/* sizeof(struct sgfdb3) */
+	short int magic;
+	short int version;
+	int ngames;
+	int nsections;		/* DB_MAXSECT */
+	struct sgfdb_section sect[DB_MAXSECT];
+};
+
+struct bingame3 {
+	int sz;			/* total size of this record in bytes */
+	int gamenr;
+	int fnoff;		/* filename: offset in SECT_NAMES */
+	int movect;		/* number of moves */
+	int mvct;		/* length of array mv[] */
+	unsigned char size;	/* size of board */
+	unsigned char pad[3];
+	unsigned short abct;	/* initial number of black stones */
+	unsigned short awct;	/* initial number of white stones */
+	unsigned short bcapt;	/* number of black stones captured */
+	unsigned short wcapt;	/* number of white stones captured */
+	short int mv[0];	/* starts at offset 32 */
+};
+
+enum sgfdb_column {
+	COL_SIZE, COL_MOVECT, COL_ABCT, COL_AWCT, COL_BCAPT, COL_WCAPT,
+	COL_PB, COL_PW, COL_DT, COL_RE,
+	DB_NCOLS
+};
+
+struct sgfdb_position {
+	unsigned long long hash;
+	int game;		/* index, from 0 */
+	int movenr;
+};
+
+struct sgfdb_nameref {
+	int name;		/* offset in SECT_NAMES */
+	int game;		/* index, from 0 */
+};
@@ -3,44 +3,42 @@
 /*
  * void do_dbin(char *fn): open and mmap data base, and call
  *  report_on_single_game() for each game found
+ *
+ * For version 3 there is also random access (see sgfdbread.c), and
+ * sgfdb_setgame(dm, bg) sets the globals as do_dbin does.
+ *
+ * When the data base has columns, the selection options on size,
+ * movect, handicap and captures are first tried on the columns, and
+ * with a move or position index also -p, -pat and -pos, and with the
+ * hash, player and date indexes -same, -who and -date (see
+ * preselect_games()), and only the games that pass are decoded.
+ *
+ * With -j N the games are split over N processes (see forkq.c).
  */
 
 #include <stdio.h>		/* for NULL */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "errexit.h"
+#include "xmalloc.h"
 #include "sgfdb.h"
 #include "sgfinfo.h"
+#include "tests.h"
 #include "playgogame.h"
+#include "sgfdbread.h"
 #include "sgfdbinput.h"
+#include "forkq.h"
 
+/* set moves[] and extmoves[] from the mv[] of a record */
 static void
-do_bgin(struct bingame *bg) {
+set_moves(short *bgm) {
 	int i, m, n;
-	short *bgm;
-	char *bgc;
-
-	if (bg->gamenr) {
-		gamenr = bg->gamenr;
-		number_of_games = 2;	/* larger than 1 */
-	} else {
-		gamenr = number_of_games = 1;
-	}
-
-	size = bg->size;
-	movect = bg->movect;
-	initct = bg->abct + bg->awct;
-	mvct = initct + movect;
-	handct = (bg->awct ? 0 : bg->abct);
-	extmvct = bg->mvct;
-	bcaptct = bg->bcapt;
-	wcaptct = bg->wcapt;
-
-	bgm = (short *)(((char *) bg) + sizeof(struct bingame));
-	bgc = (char *)(bgm + extmvct);
 
 	n = 0;
 	for (i=0; i<extmvct; i++) {
@@ -59,21 +57,236 @@ do_bgin(struct bingame *bg) {
 			moves[n++] = ((m & 0xc00) << 6) + (x << 8) + y;
 		}
 	}
+}
+
+static void
+set_gamenr(int nr) {
+	if (nr) {
+		gamenr = nr;
+		number_of_games = 2;	/* larger than 1 */
+	} else {
+		gamenr = number_of_games = 1;
+	}
+}
+
+/* version 2 */
+static void
+do_bgin(struct bingame *bg) {
+	short *bgm;
+	char *bgc;
+
+	set_gamenr(bg->gamenr);
+	size = bg->size;
+	movect = bg->movect;
+	initct = bg->abct + bg->awct;
+	mvct = initct + movect;
+	handct = (bg->awct ? 0 : bg->abct);
+	extmvct = bg->mvct;
+	bcaptct = bg->bcapt;
+	wcaptct = bg->wcapt;
+
+	bgm = (short *)(((char *) bg) + sizeof(struct bingame));
+	bgc = (char *)(bgm + extmvct);
+	set_moves(bgm);
 
 	infilename = bgc;
 	report_on_single_game();
 }
 
+/* returns -1 for a bad data base */
+static int
+do_dbin2(char *db, char *mmend) {
+	char *bg;
+
+	bg = db + sizeof(struct sgfdb);
+
+	while (bg < mmend) {
+		struct bingame *bga;
+
+		bga = (struct bingame *) bg;
+
+		/* check that entry looks ok - avoid segfaults */
+		if (bga->sz < 0 || bg + bga->sz > mmend ||
+		    bga->mvct < 0 || bga->filenamelen < 0 ||
+		    sizeof(*bga) + 2*bga->mvct + bga->filenamelen > bga->sz)
+			return -1;
+
+		do_bgin(bga);
+		bg += bga->sz;
+	}
+	return 0;
+}
+
+/* set the globals for report_on_single_game() from a record */
+void
+sgfdb_setgame(struct sgfdbmap *dm, struct bingame3 *bg) {
+	set_gamenr(bg->gamenr);
+	size = bg->size;
+	movect = bg->movect;
+	initct = bg->abct + bg->awct;
+	mvct = initct + movect;
+	handct = (bg->awct ? 0 : bg->abct);
+	extmvct = bg->mvct;
+	bcaptct = bg->bcapt;
+	wcaptct = bg->wcapt;
+	set_moves(bg->mv);
+	infilename = sgfdb_filename(dm, bg);
+}
+
+/*
+ * Clear ok[i] when col[i] is outside [min,max]. No branches, so that
+ * the compiler can vectorize these loops.
+ */
+static void
+select_range(unsigned char *ok, const int *col, int n, int min, int max) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		ok[i] &= (col[i] >= min) & (col[i] <= max);
+}
+
+/* handicap as in sgfdb_setgame(): abct, unless there are white stones */
+static void
+select_handicap(unsigned char *ok, const int *ab, const int *aw, int n,
+		int min, int max) {
+	int i, h;
+
+	for (i = 0; i < n; i++) {
+		h = ab[i] & -(aw[i] == 0);
+		ok[i] &= (h >= min) & (h <= max);
+	}
+}
+
+/* the intervals given for val, with UNSET as no bound; 0 if none */
+static int
+get_range(int *val, int *min, int *max) {
+	if (!getinterval(val, min, max))
+		return 0;
+	if (*min == UNSET)
+		*min = INT_MIN;
+	if (*max == UNSET)
+		*max = INT_MAX;
+	return 1;
+}
+
+/*
+ * Games that may satisfy the interval selections, judging from
+ * the columns only; NULL if all games must be looked at.
+ */
+static unsigned char *
+preselect(struct sgfdbmap *dm) {
+	static const struct { int *val; int col; } sels[] = {
+		{ &size, COL_SIZE },
+		{ &movect, COL_MOVECT },	/* not with -trunc */
+		{ &bcaptct, COL_BCAPT },
+		{ &wcaptct, COL_WCAPT },
+	};
+	unsigned char *ok;
+	int i, n, min, max, any, cols;
+
+	n = sgfdb_ngames(dm);
+	cols = (sgfdb_column(dm, COL_SIZE) != NULL);
+	ok = xmalloc(n+1);
+	memset(ok, 1, n+1);
+	any = 0;
+
+	for (i = 0; cols && i < sizeof(sels)/sizeof(sels[0]); i++) {
+		if (sels[i].val == &movect && opttrunc)
+			continue;
+		if (!get_range(sels[i].val, &min, &max))
+			continue;
+		select_range(ok, sgfdb_column(dm, sels[i].col), n, min, max);
+		any = 1;
+	}
+	if (cols && get_range(&handct, &min, &max)) {
+		select_handicap(ok, sgfdb_column(dm, COL_ABCT),
+				sgfdb_column(dm, COL_AWCT), n, min, max);
+		any = 1;
+	}
+	if (preselect_games(dm, ok, n))
+		any = 1;
+
+	if (!any) {
+		free(ok);
+		return NULL;
+	}
+	return ok;
+}
+
+struct dbrange {
+	struct sgfdbmap *dm;
+	unsigned char *ok;
+	const char *fn;
+	int n, njobs;
+};
+
+static void
+do_games(struct dbrange *r, int lo, int hi) {
+	struct bingame3 *bg;
+	int i;
+
+	for (i = lo; i < hi; i++) {
+		if (r->ok && !r->ok[i])
+			continue;
+		bg = sgfdb_game(r->dm, i);
+		if (bg == NULL)
+			sgfdb_bad_database(r->dm, r->fn);
+		sgfdb_setgame(r->dm, bg);
+		report_on_single_game();
+	}
+}
+
+/* with -j, in a child process; returns # games found */
+static long
+games_job(int job, void *arg) {
+	struct dbrange *r = arg;
+	int n = okgames;
+
+	do_games(r, (long) job * r->n / r->njobs,
+		 (long) (job+1) * r->n / r->njobs);
+	return okgames - n;
+}
+
+#define JOBS_PER_PROC	8
+
+static void
+do_dbin3(const char *fn) {
+	struct dbrange r;
+
+	r.fn = fn;
+	r.dm = sgfdb_find_preload(fn);
+	if (r.dm == NULL)
+		r.dm = sgfdb_open(fn);
+	r.n = sgfdb_ngames(r.dm);
+	r.ok = preselect(r.dm);
+	/* -dup without stored hashes needs all games in one process */
+	if (nprocs > 1 && !(optdup && !sgfdb_hashes(r.dm))) {
+		r.njobs = nprocs * JOBS_PER_PROC;
+		if (r.njobs > r.n)
+			r.njobs = r.n;
+		okgames += forkq_run(r.njobs, nprocs, games_job, &r);
+	} else
+		do_games(&r, 0, r.n);
+	free(r.ok);
+	infilename = "";
+	sgfdb_close(r.dm);
+}
+
 void
 do_dbin(const char *fn) {
 	int infd;
 	size_t sz;
 	struct stat s;
 	void *mm;
-	char *mmbegin, *mmend, *db, *bg;
+	struct sgfdb *dba;
 
 	if (fn == NULL)
 		fn = "out.sgfdb";
+	dupselected = sameselected = 0;	/* until preselect_games() */
+	if (sgfdb_find_preload(fn)) {
+		do_dbin3(fn);
+		return;
+	}
 
 	infd = open(fn, O_RDONLY);
 	if (infd < 0)
@@ -86,43 +299,38 @@ do_dbin(const char *fn) {
 		errexit("cannot mmap %s", fn);
 	close(infd);
 
-	db = mmbegin = mm;
-	mmend = mmbegin + sz;
-
 	/* check database magic and version */
-	{
-		struct sgfdb *dba;
-
-		dba = (struct sgfdb *) db;
-
-		if (dba->magic != DB_MAGIC)
-			errexit("%s: bad magic", fn);
-		if (dba->version != DB_VERSION)
-			errexit("%s is an sgfdb version %d, "
-				"we only support version %d",
-				dba->version, DB_VERSION);
-		if (dba->headerlen != sizeof(*dba))
-			errexit("%s: bad header", fn);
+	dba = (struct sgfdb *) mm;
+	if (sz < sizeof(*dba) || dba->magic != DB_MAGIC) {
+		munmap(mm, sz);
+		errexit("%s: bad magic", fn);
+	}
+	if (dba->version == DB_VERSION) {
+		munmap(mm, sz);
+		do_dbin3(fn);
+		return;
+	}
+	if (dba->version != DB_VERSION2) {
+		int v = dba->version;
+		munmap(mm, sz);
+		errexit("%s is an sgfdb version %d, "
+			"we only support versions %d and %d",
+			fn, v, DB_VERSION2, DB_VERSION);
+	}
+	if (optwho || optdate) {
+		munmap(mm, sz);
+		errexit("%s: -who and -date need a version %d data base",
+			fn, DB_VERSION);
+	}
+	if (dba->headerlen != sizeof(*dba)) {
+		munmap(mm, sz);
+		errexit("%s: bad header", fn);
 	}
 
-	bg = db + sizeof(struct sgfdb);
-
-	while (bg < mmend) {
-		struct bingame *bga;
-
-		bga = (struct bingame *) bg;
-
-		/* check that entry looks ok - avoid segfaults */
-		if (bga->sz < 0 || bg + bga->sz > mmend ||
-		    bga->mvct < 0 || bga->filenamelen < 0 ||
-		    sizeof(*bga) + 2*bga->mvct + bga->filenamelen > bga->sz) {
-			infilename = "";	/* no longer mapped */
-			munmap(mm, sz);
-			errexit("%s: bad database", fn);
-		}
-
-		do_bgin(bga);
-		bg += bga->sz;
+	if (do_dbin2(mm, (char *) mm + sz) < 0) {
+		infilename = "";	/* no longer mapped */
+		munmap(mm, sz);
+		errexit("%s: bad database", fn);
 	}
 	munmap(mm, sz);
 }
@@ -1 +1,13 @@
 extern void do_dbin(const char *fn);
+
+/* set the globals for report_on_single_game() from a record */
+struct sgfdbmap;
+struct bingame3;
+extern void sgfdb_setgame(struct sgfdbmap *dm, struct bingame3 *bg);
+
+/* sgfdbinfo -serve (sgfdbserve.c) */
+extern int sgfdb_serve(const char *path, int ndbs, char **dbs,
+		       int (*query)(int argc, char **argv));
+
+/* provided by the caller: narrow down ok[] using the indexes */
+extern int preselect_games(struct sgfdbmap *dm, unsigned char *ok, int n);
@@ -0,0 +1,469 @@
+/*
+ * sgfdbread.c - random access to a version 3 data base (see sgfdb.h)
+ *
+ * sgfdb_open(fn), sgfdb_ngames(dm), sgfdb_game(dm, i) (NULL for a
+ * damaged record), sgfdb_filename(dm, bg), sgfdb_moves(bg, moves),
+ * sgfdb_close(dm),
+ * sgfdb_column(dm, COL_xx) (NULL for a data base without columns),
+ * sgfdb_postings(dm, key, min, max, mask) (-1 without a move index),
+ * sgfdb_positions(dm, hash, mask) (-1 without a position index),
+ * sgfdb_hashes(dm) (the can64 of each game, or NULL),
+ * sgfdb_byhash(dm, hash, mask), sgfdb_byplayer(dm, name, mask),
+ * sgfdb_bydate(dm, from, to, mask) (-1 without that index),
+ * sgfdb_bad_database(dm, fn) (close it, and give up).
+ *
+ * sgfdb_preload(fn) opens and checks a data base for good, and
+ * sgfdb_find_preload(fn) finds it again (for sgfdbinfo -serve).
+ *
+ * Nothing here depends on sgfinfo, so that other tools can use it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "errexit.h"
+#include "xmalloc.h"
+#include "sgfdb.h"
+#include "playgogame.h"
+#include "sgfdbread.h"
+
+#define MAXSZ	31
+
+struct sgfdbmap {
+	void *mm;
+	size_t sz;
+	struct sgfdb3 *db;
+	char *games, *gamesend;
+	long long *index;
+	char *names;
+	int nameslen;
+	int *columns;		/* NULL if absent */
+	long long *moveoffs;	/* SECT_MOVES, or NULL */
+	unsigned char *moves;
+	struct sgfdb_position *positions;	/* SECT_POSITIONS, or NULL */
+	long npositions;
+	unsigned long long *hashes;	/* SECT_HASHES, or NULL */
+	int *byhash;			/* SECT_BYHASH, or NULL */
+	struct sgfdb_nameref *byplayer, *bydate;	/* or NULL */
+	long nbyplayer, nbydate;
+	int preloaded;		/* by sgfdb_preload(): never closed, and
+				   all records already checked */
+};
+
+static struct sgfdb_section *
+find_section(struct sgfdb3 *db, int type) {
+	int i;
+
+	for (i = 0; i < DB_MAXSECT; i++)
+		if (db->sect[i].type == type)
+			return &db->sect[i];
+	return NULL;
+}
+
+void
+sgfdb_bad_database(struct sgfdbmap *dm, const char *fn) {
+	infilename = "";	/* no longer mapped */
+	sgfdb_close(dm);
+	errexit("%s: bad database", fn);
+}
+
+/*
+ * Map a version 3 data base and check its sections.
+ * The records themselves are checked by sgfdb_game().
+ */
+struct sgfdbmap *
+sgfdb_open(const char *fn) {
+	struct sgfdbmap *dm;
+	struct sgfdb3 *db;
+	struct sgfdb_section *sg, *si, *sn, *sc, *sm, *sz, *sh, *sp, *sb;
+	struct stat s;
+	int fd, i;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0)
+		errexit("cannot open %s", fn);
+	if (fstat(fd, &s) < 0)
+		errexit("cannot stat %s", fn);
+	dm = xmalloc(sizeof(*dm));
+	dm->sz = s.st_size;
+	dm->mm = mmap(NULL, dm->sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (dm->mm == MAP_FAILED)
+		errexit("cannot mmap %s", fn);
+	close(fd);
+	dm->preloaded = 0;
+
+	db = dm->db = dm->mm;
+	if (dm->sz < sizeof(*db) || db->magic != DB_MAGIC)
+		sgfdb_bad_database(dm, fn);
+	if (db->version != DB_VERSION)
+		errexit("%s is an sgfdb version %d, expected version %d",
+			fn, db->version, DB_VERSION);
+	if (db->headerlen != sizeof(*db) || db->nsections != DB_MAXSECT ||
+	    db->ngames < 0)
+		sgfdb_bad_database(dm, fn);
+
+	sg = find_section(db, SECT_GAMES);
+	si = find_section(db, SECT_INDEX);
+	sn = find_section(db, SECT_NAMES);
+	if (!sg || !si || !sn)
+		sgfdb_bad_database(dm, fn);
+	for (i = 0; i < DB_MAXSECT; i++) {
+		sp = &db->sect[i];
+		if (sp->type && (sp->offset < 0 || sp->len < 0 ||
+				 (sp->offset & 7) ||
+				 sp->offset + sp->len > dm->sz))
+			sgfdb_bad_database(dm, fn);
+	}
+	if (si->len != db->ngames * sizeof(long long) ||
+	    (sn->len && ((char *) dm->mm)[sn->offset + sn->len - 1] != 0))
+		sgfdb_bad_database(dm, fn);
+
+	dm->games = (char *) dm->mm + sg->offset;
+	dm->gamesend = dm->games + sg->len;
+	dm->index = (long long *)((char *) dm->mm + si->offset);
+	dm->names = (char *) dm->mm + sn->offset;
+	dm->nameslen = sn->len;
+
+	/* optional */
+	sc = find_section(db, SECT_COLUMNS);
+	dm->columns = NULL;
+	if (sc) {
+		if (sc->len != (long long) DB_NCOLS * db->ngames * sizeof(int))
+			sgfdb_bad_database(dm, fn);
+		dm->columns = (int *)((char *) dm->mm + sc->offset);
+	}
+	sm = find_section(db, SECT_MOVES);
+	dm->moveoffs = NULL;
+	if (sm) {
+		long long *offs;
+
+		if (sm->len < (DB_NKEYS+1) * sizeof(long long))
+			sgfdb_bad_database(dm, fn);
+		dm->moves = (unsigned char *) dm->mm + sm->offset;
+		offs = (long long *) dm->moves;
+		for (i = 0; i < DB_NKEYS; i++)
+			if (offs[i] < (DB_NKEYS+1) * sizeof(long long) ||
+			    offs[i] > offs[i+1])
+				sgfdb_bad_database(dm, fn);
+		if (offs[DB_NKEYS] != sm->len)
+			sgfdb_bad_database(dm, fn);
+		dm->moveoffs = offs;
+	}
+	sz = find_section(db, SECT_POSITIONS);
+	dm->positions = NULL;
+	if (sz) {
+		if (sz->len % sizeof(struct sgfdb_position))
+			sgfdb_bad_database(dm, fn);
+		dm->positions = (struct sgfdb_position *)
+			((char *) dm->mm + sz->offset);
+		dm->npositions = sz->len / sizeof(struct sgfdb_position);
+	}
+	sh = find_section(db, SECT_HASHES);
+	dm->hashes = NULL;
+	if (sh) {
+		if (sh->len != db->ngames * sizeof(unsigned long long))
+			sgfdb_bad_database(dm, fn);
+		dm->hashes = (unsigned long long *)
+			((char *) dm->mm + sh->offset);
+	}
+	sb = find_section(db, SECT_BYHASH);
+	dm->byhash = NULL;
+	if (sb && dm->hashes) {
+		if (sb->len != db->ngames * sizeof(int))
+			sgfdb_bad_database(dm, fn);
+		dm->byhash = (int *)((char *) dm->mm + sb->offset);
+		for (i = 0; i < db->ngames; i++)
+			if (dm->byhash[i] < 0 || dm->byhash[i] >= db->ngames)
+				sgfdb_bad_database(dm, fn);
+	}
+	sb = find_section(db, SECT_BYPLAYER);
+	dm->byplayer = NULL;
+	if (sb) {
+		if (sb->len % sizeof(struct sgfdb_nameref))
+			sgfdb_bad_database(dm, fn);
+		dm->byplayer = (struct sgfdb_nameref *)
+			((char *) dm->mm + sb->offset);
+		dm->nbyplayer = sb->len / sizeof(struct sgfdb_nameref);
+	}
+	sb = find_section(db, SECT_BYDATE);
+	dm->bydate = NULL;
+	if (sb) {
+		if (sb->len % sizeof(struct sgfdb_nameref))
+			sgfdb_bad_database(dm, fn);
+		dm->bydate = (struct sgfdb_nameref *)
+			((char *) dm->mm + sb->offset);
+		dm->nbydate = sb->len / sizeof(struct sgfdb_nameref);
+	}
+	return dm;
+}
+
+void
+sgfdb_close(struct sgfdbmap *dm) {
+	if (dm->preloaded)
+		return;
+	munmap(dm->mm, dm->sz);
+	free(dm);
+}
+
+/*
+ * For a server: open and check fn once, with all its records, and
+ * let later do_dbin(fn) calls (in this process or in children forked
+ * from it) use the mapping that is already there.
+ */
+static struct preload {
+	char *fn;
+	struct sgfdbmap *dm;
+	struct preload *next;
+} *preloads;
+
+void
+sgfdb_preload(const char *fn) {
+	struct sgfdbmap *dm;
+	struct preload *pl;
+	int i;
+
+	dm = sgfdb_open(fn);
+	for (i = 0; i < dm->db->ngames; i++)
+		if (sgfdb_game(dm, i) == NULL)
+			sgfdb_bad_database(dm, fn);
+	madvise(dm->mm, dm->sz, MADV_WILLNEED);
+	dm->preloaded = 1;
+
+	pl = xmalloc(sizeof(*pl));
+	pl->fn = xstrdup((char *) fn);
+	pl->dm = dm;
+	pl->next = preloads;
+	preloads = pl;
+}
+
+struct sgfdbmap *
+sgfdb_find_preload(const char *fn) {
+	struct preload *pl;
+
+	for (pl = preloads; pl; pl = pl->next)
+		if (!strcmp(pl->fn, fn))
+			return pl->dm;
+	return NULL;
+}
+
+int
+sgfdb_ngames(struct sgfdbmap *dm) {
+	return dm->db->ngames;
+}
+
+/* game i (from 0), or NULL if the record is damaged */
+struct bingame3 *
+sgfdb_game(struct sgfdbmap *dm, int i) {
+	struct bingame3 *bg;
+	char *p;
+
+	if (i < 0 || i >= dm->db->ngames)
+		return NULL;
+	p = (char *) dm->mm + dm->index[i];
+	if (dm->preloaded)
+		return (struct bingame3 *) p;
+	if (p < dm->games || p + sizeof(*bg) > dm->gamesend ||
+	    ((p - dm->games) & 7))
+		return NULL;
+	bg = (struct bingame3 *) p;
+	if (bg->sz < sizeof(*bg) || p + bg->sz > dm->gamesend ||
+	    bg->mvct < 0 || sizeof(*bg) + 2L*bg->mvct > bg->sz ||
+	    bg->fnoff < 0 || bg->fnoff >= dm->nameslen)
+		return NULL;
+	return bg;
+}
+
+/* the values of column col for all games, or NULL */
+const int *
+sgfdb_column(struct sgfdbmap *dm, int col) {
+	if (dm->columns == NULL || col < 0 || col >= DB_NCOLS)
+		return NULL;
+	return dm->columns + (long) col * dm->db->ngames;
+}
+
+const unsigned long long *
+sgfdb_hashes(struct sgfdbmap *dm) {
+	return dm->hashes;
+}
+
+/*
+ * Set mask[g] for the games g where a stone with the given key
+ * (color << 10 | point, as in mv[]) was placed at a move number
+ * in [min,max]. Returns -1 if there is no move index.
+ */
+int
+sgfdb_postings(struct sgfdbmap *dm, int key, int min, int max,
+	       unsigned char *mask) {
+	const unsigned char *p, *end;
+	unsigned int v[2];
+	int g, j, sh;
+
+	if (dm->moveoffs == NULL)
+		return -1;
+	if (key < 0 || key >= DB_NKEYS)
+		return 0;
+	p = dm->moves + dm->moveoffs[key];
+	end = dm->moves + dm->moveoffs[key+1];
+	g = 0;
+	while (p < end) {
+		for (j = 0; j < 2; j++) {
+			v[j] = sh = 0;
+			do {
+				if (p == end || sh > 28)
+					errexit("bad move index");
+				v[j] |= (*p & 0x7f) << sh;
+				sh += 7;
+			} while (*p++ & 0x80);
+		}
+		g += v[0];
+		if (g < 0 || g >= dm->db->ngames)
+			errexit("bad move index");
+		if ((int) v[1] >= min && (int) v[1] <= max)
+			mask[g] = 1;
+	}
+	return 0;
+}
+
+/*
+ * Set mask[g] for the games g that reach the position with the given
+ * hash. Returns -1 if there is no position index.
+ */
+int
+sgfdb_positions(struct sgfdbmap *dm, unsigned long long hash,
+		unsigned char *mask) {
+	struct sgfdb_position *sp = dm->positions;
+	long lo, hi, mid;
+
+	if (sp == NULL)
+		return -1;
+	lo = 0;
+	hi = dm->npositions;
+	while (lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if (sp[mid].hash < hash)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	for ( ; lo < dm->npositions && sp[lo].hash == hash; lo++) {
+		if (sp[lo].game < 0 || sp[lo].game >= dm->db->ngames)
+			errexit("bad position index");
+		mask[sp[lo].game] = 1;
+	}
+	return 0;
+}
+
+/* mark the games with can64 hash; returns -1 without SECT_BYHASH */
+int
+sgfdb_byhash(struct sgfdbmap *dm, unsigned long long hash,
+	     unsigned char *mask) {
+	int *bh = dm->byhash;	/* entries checked by sgfdb_open() */
+	int lo, hi, mid;
+
+	if (bh == NULL)
+		return -1;
+	lo = 0;
+	hi = dm->db->ngames;
+	while (lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if (dm->hashes[bh[mid]] < hash)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	for ( ; lo < dm->db->ngames && dm->hashes[bh[lo]] == hash; lo++)
+		mask[bh[lo]] = 1;
+	return 0;
+}
+
+static const char *
+nameref_string(struct sgfdbmap *dm, struct sgfdb_nameref *r) {
+	if (r->name < 0 || r->name >= dm->nameslen ||
+	    r->game < 0 || r->game >= dm->db->ngames)
+		errexit("bad name index");
+	return dm->names + r->name;
+}
+
+/* the first entry of rp[0..n-1] with string not less than s */
+static long
+nameref_lower(struct sgfdbmap *dm, struct sgfdb_nameref *rp, long n,
+	      const char *s) {
+	long lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if (strcmp(nameref_string(dm, &rp[mid]), s) < 0)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* mark the games with PB or PW equal to name */
+int
+sgfdb_byplayer(struct sgfdbmap *dm, const char *name, unsigned char *mask) {
+	struct sgfdb_nameref *rp = dm->byplayer;
+	long i;
+
+	if (rp == NULL)
+		return -1;
+	i = nameref_lower(dm, rp, dm->nbyplayer, name);
+	for ( ; i < dm->nbyplayer &&
+		      !strcmp(nameref_string(dm, &rp[i]), name); i++)
+		mask[rp[i].game] = 1;
+	return 0;
+}
+
+/* mark the games with from <= DT < to (as strings; to NULL: no bound) */
+int
+sgfdb_bydate(struct sgfdbmap *dm, const char *from, const char *to,
+	     unsigned char *mask) {
+	struct sgfdb_nameref *rp = dm->bydate;
+	long i;
+
+	if (rp == NULL)
+		return -1;
+	i = nameref_lower(dm, rp, dm->nbydate, from);
+	for ( ; i < dm->nbydate && (to == NULL ||
+		     strcmp(nameref_string(dm, &rp[i]), to) < 0); i++)
+		mask[rp[i].game] = 1;
+	return 0;
+}
+
+const char *
+sgfdb_filename(struct sgfdbmap *dm, struct bingame3 *bg) {
+	return dm->names + bg->fnoff;
+}
+
+/*
+ * The moves of a record as in moves[] of sgfinfo: (color << 16) |
+ * (x << 8) | y with letters x, y ('tt' for a pass), setup stones first.
+ * moves[] needs room for bg->mvct entries; returns their number.
+ */
+int
+sgfdb_moves(struct bingame3 *bg, int *moves) {
+	int i, m, n, x, y;
+
+	n = 0;
+	for (i = 0; i < bg->mvct; i++) {
+		m = bg->mv[i];
+		if (m & PG_CAPTURE)
+			continue;
+		if (m & PG_PASS) {
+			x = y = 't';
+		} else {
+			x = (m & 0x3ff)/(MAXSZ+1) + 'a' - 1;
+			y = (m & 0x3ff)%(MAXSZ+1) + 'a' - 1;
+		}
+		moves[n++] = ((m & 0xc00) << 6) | (x << 8) | y;
+	}
+	return n;
+}
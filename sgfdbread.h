@@ -0,0 +1,27 @@
+/* random access to a version 3 data base */
+struct sgfdbmap;
+struct bingame3;
+extern struct sgfdbmap *sgfdb_open(const char *fn);
+extern void sgfdb_close(struct sgfdbmap *dm);
+extern void sgfdb_bad_database(struct sgfdbmap *dm, const char *fn)
+	__attribute__ ((noreturn));
+extern int sgfdb_ngames(struct sgfdbmap *dm);
+extern struct bingame3 *sgfdb_game(struct sgfdbmap *dm, int i);
+extern const char *sgfdb_filename(struct sgfdbmap *dm, struct bingame3 *bg);
+extern int sgfdb_moves(struct bingame3 *bg, int *moves);
+extern const int *sgfdb_column(struct sgfdbmap *dm, int col);
+extern const unsigned long long *sgfdb_hashes(struct sgfdbmap *dm);
+extern int sgfdb_postings(struct sgfdbmap *dm, int key, int min, int max,
+			  unsigned char *mask);
+extern int sgfdb_positions(struct sgfdbmap *dm, unsigned long long hash,
+			   unsigned char *mask);
+extern int sgfdb_byhash(struct sgfdbmap *dm, unsigned long long hash,
+			unsigned char *mask);
+extern int sgfdb_byplayer(struct sgfdbmap *dm, const char *name,
+			  unsigned char *mask);
+extern int sgfdb_bydate(struct sgfdbmap *dm, const char *from,
+			const char *to, unsigned char *mask);
+
+/* for sgfdbinfo -serve */
+extern void sgfdb_preload(const char *fn);
+extern struct sgfdbmap *sgfdb_find_preload(const char *fn);
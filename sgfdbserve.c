@@ -0,0 +1,220 @@
+/*
+ * sgfdbserve.c - sgfdbinfo -serve=SOCKET db ...: answer queries
+ *
+ * sgfdb_serve(path, ndbs, dbs, query): open, check and map the data
+ *  bases dbs[0..ndbs-1] once, and then listen on the local socket path.
+ *  Each connection carries one query: a single line with the options
+ *  of an sgfdbinfo call, separated by white space (no quoting), and
+ *  optionally "--" followed by data base names. Without "--" all the
+ *  data bases given to the server are searched. The output (and any
+ *  error messages) of query(argc, argv) is sent back, and then the
+ *  connection is closed.
+ *
+ * Queries may come from untrusted clients (a web front end), so only
+ *  the selection and report options in okopts[] are accepted, and only
+ *  data bases given to the server can be named. In particular -ref
+ *  (which runs a shell command), -serve=, -j, and -pos= and -pat=
+ *  (which would open files named by the client) are refused.
+ *
+ * Each query runs in a child forked from the server, so it starts with
+ * the option state of a fresh sgfdbinfo, and with the data bases already
+ * mapped and checked; an errexit() only ends that query.
+ *
+ * Example: sgfdbinfo -serve=/tmp/sgfdb.sock games.sgfdb &
+ *   echo "-m200- -p-cf,dd" | nc -U /tmp/sgfdb.sock
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "sgfdbread.h"
+#include "sgfdbinput.h"
+
+#define MAXQUERY	65536
+
+/* read the query line; returns its length, or -1 */
+static int
+read_query(int fd, char *buf, int sz) {
+	int n = 0;
+	ssize_t r;
+
+	while (n < sz-1) {
+		r = read(fd, buf+n, 1);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0 || buf[n] == '\n')
+			break;
+		n++;
+	}
+	if (n == sz-1)
+		return -1;
+	buf[n] = 0;
+	return n;
+}
+
+/* options a query may use, and what may be attached to them */
+#define NOARG	0
+#define ANYARG	1
+#define MOVEARG	2	/* a move list as for -p: no file names */
+
+static struct okopt {
+	char *name;
+	int arg;
+} okopts[] = {
+	{ "-alltra", NOARG }, { "-Bcapt", ANYARG }, { "-Bp", MOVEARG },
+	{ "-b", NOARG }, { "+b", NOARG }, { "-can", ANYARG },
+	{ "-capt", NOARG }, { "-Ds", ANYARG }, { "-Dn", ANYARG },
+	{ "-date=", ANYARG }, { "-dup", NOARG }, { "-E", ANYARG },
+	{ "-fn", ANYARG }, { "-hash64", ANYARG }, { "-h", ANYARG },
+	{ "-k", NOARG }, { "-i", NOARG }, { "-M", ANYARG }, { "-m", ANYARG },
+	{ "-P", ANYARG }, { "-p", MOVEARG }, { "-q", NOARG }, { "-r", NOARG },
+	{ "-rot", ANYARG }, { "-s", NOARG }, { "-same=", ANYARG },
+	{ "-swapcolors", NOARG }, { "-sz", ANYARG }, { "-t", NOARG },
+	{ "-tra", ANYARG }, { "-trunc", ANYARG }, { "-Wcapt", ANYARG },
+	{ "-Wp", MOVEARG }, { "-who=", ANYARG }, { "-x", ANYARG },
+};
+
+/* digits, letters, '-' and ',' only, so not -pos=FILE or -pat=FILE */
+static int
+movelist(const char *s) {
+	for ( ; *s; s++)
+		if (!isalnum((unsigned char) *s) && *s != '-' && *s != ',')
+			return 0;
+	return 1;
+}
+
+/* condensed single-letter options, as in sgfinfo.c */
+#define OKLETTERS	"bEikMqrstx"
+
+static int
+allowed_option(const char *s) {
+	const char *p;
+	int i, n;
+
+	for (i = 0; i < sizeof(okopts)/sizeof(okopts[0]); i++) {
+		n = strlen(okopts[i].name);
+		if (strncmp(s, okopts[i].name, n))
+			continue;
+		if (okopts[i].arg == ANYARG || s[n] == 0 ||
+		    (okopts[i].arg == MOVEARG && movelist(s+n)))
+			return 1;
+	}
+	if (s[0] != '-' || s[1] == 0)
+		return 0;
+	for (p = s+1; *p; p++)
+		if (!strchr(OKLETTERS, *p))
+			return 0;
+	return 1;
+}
+
+/* in the child: run one query with the connection as stdout, stderr */
+static void
+do_query(int fd, int ndbs, char **dbs, int (*query)(int, char **)) {
+	static char buf[MAXQUERY];
+	char **argv, *p;
+	int argc, i, names;
+
+	if (read_query(fd, buf, sizeof(buf)) < 0)
+		_exit(1);
+
+	if (dup2(fd, 1) < 0 || dup2(fd, 2) < 0)
+		_exit(1);
+	close(fd);
+
+	argv = xmalloc((sizeof(buf)/2 + ndbs + 3) * sizeof(char *));
+	argc = 0;
+	argv[argc++] = "sgfdbinfo";
+	names = 0;
+	for (p = strtok(buf, " \t\r"); p; p = strtok(NULL, " \t\r")) {
+		if (!names && !strcmp(p, "--"))
+			names = 1;
+		else if (!names && (p[0] == '-' || p[0] == '+')) {
+			if (!allowed_option(p))
+				errexit("option %s not allowed in a query", p);
+		} else {
+			/* sgfdbinfo takes everything from here on as names */
+			names = 1;
+			if (!sgfdb_find_preload(p))
+				errexit("%s is not served here", p);
+		}
+		argv[argc++] = p;
+	}
+	if (!names) {
+		argv[argc++] = "--";
+		for (i = 0; i < ndbs; i++)
+			argv[argc++] = dbs[i];
+	}
+	argv[argc] = NULL;
+
+	exit(query(argc, argv));
+}
+
+int
+sgfdb_serve(const char *path, int ndbs, char **dbs,
+	    int (*query)(int, char **)) {
+	static char *defaultdb[] = { "out.sgfdb" };
+	struct sockaddr_un sa;
+	struct stat st;
+	int lfd, fd, i;
+	pid_t pid;
+
+	if (ndbs == 0) {
+		dbs = defaultdb;
+		ndbs = 1;
+	}
+	for (i = 0; i < ndbs; i++) {
+		infilename = dbs[i];
+		sgfdb_preload(dbs[i]);
+	}
+	infilename = "";
+
+	if (strlen(path) >= sizeof(sa.sun_path))
+		errexit("socket name %s too long", path);
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		errexit("cannot create socket");
+	if (lstat(path, &st) == 0) {
+		/* left behind by an earlier server? */
+		if (!S_ISSOCK(st.st_mode))
+			errexit("%s exists and is not a socket", path);
+		unlink(path);
+	}
+	if (bind(lfd, (struct sockaddr *) &sa, sizeof(sa)) < 0)
+		errexit("cannot bind to %s", path);
+	if (listen(lfd, 16) < 0)
+		errexit("cannot listen on %s", path);
+
+	signal(SIGCHLD, SIG_IGN);	/* no zombies */
+	fflush(stdout);
+	fflush(stderr);
+
+	while (1) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			errexit("accept failed on %s", path);
+		}
+		pid = fork();
+		if (pid == 0) {
+			close(lfd);
+			signal(SIGCHLD, SIG_DFL);
+			do_query(fd, ndbs, dbs, query);
+		}
+		if (pid < 0)
+			fprintf(stderr, "%s: cannot fork\n", progname);
+		close(fd);
+	}
+}
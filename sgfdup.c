@@ -0,0 +1,487 @@
+/*
+ * sgfdup - find duplicate and nearly duplicate games in sgfdb data bases
+ *
+ * Call: sgfdup [-j N] [-x] [-L N] [-M MB] [-T dir] [-q] database(s)
+ *
+ * -j N: compute the signatures on N threads
+ * -x: exact duplicates only
+ * -L N: band length for near duplicates (default 40, see below)
+ * -M MB: keep at most about MB megabytes of signatures in memory
+ *     (default 256); the rest is sorted on disk
+ * -T dir: directory for the temporary files (default $TMPDIR or /tmp)
+ * -q: no summary on stderr
+ *
+ * Output: one block per cluster of related games
+ *
+ *   cluster 1: 3 games
+ *   	first	0	250	a.sgf
+ *   	exact	3	250	b.sgf  # 2
+ *   	prefix	0	120	c.sgf
+ *
+ * with per game (separated by tabs) its relation to the first game
+ * of the cluster, the transformation (as for sgfinfo -tra) that maps
+ * it onto that game, its number of moves, and the game.
+ * The relations are: exact (the same moves, after the transformation),
+ * prefix (one game is the other, truncated), onediff (the same length,
+ * and one move differs), and near (related only via other games of
+ * the cluster; the transformation is then meaningless).
+ *
+ * How: for each game there is the can64 of all its moves (stored by
+ * sgfdb, or else computed, see movehash.c), and the can64 of the bands
+ * of L moves 0..L-1, L..2L-1, ... (at most MAXBANDS). Games that are
+ * exact duplicates share the first, and a truncated game or a game
+ * with one different move shares some band with the other game.
+ * These (signature, game) pairs are sorted (extsort.c), and the games
+ * in a group with the same signature are compared move by move;
+ * related games are joined in a union-find forest. Games with fewer
+ * than L moves are only found as exact duplicates.
+ * Memory: the sort is bounded by -M; besides that 5 bytes per game.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "sgfdb.h"
+#include "sgfdbread.h"
+#include "movehash.h"
+#include "extsort.h"
+
+#define MAXBANDS	4
+#define MAXREPS		32	/* compare with at most this many per group */
+#define CHUNK		1024	/* games taken by a thread at a time */
+
+int nthreads = 1;
+int optx = 0;
+int bandlen = 40;
+long memlimit = 256;
+char *tmpdir = NULL;
+int quiet = 0;
+
+/* the games of all data bases are numbered together */
+static struct sgfdbmap **dms;
+static char **dbnames;
+static int *dbbase, ndbs;
+static int ngames;
+
+/* game gid, and in *dp (if not NULL) the index of its data base */
+static struct bingame3 *
+get_game(int gid, int *dp) {
+	struct bingame3 *bg;
+	int d;
+
+	for (d = ndbs-1; dbbase[d] > gid; d--)
+		;
+	bg = sgfdb_game(dms[d], gid - dbbase[d]);
+	if (bg == NULL)
+		sgfdb_bad_database(dms[d], dbnames[d]);
+	if (dp)
+		*dp = d;
+	return bg;
+}
+
+/* decode game gid into *mvp (of room *maxp); returns the number of moves */
+static int
+get_moves(int gid, int **mvp, int *maxp, int *size, int *dp) {
+	struct bingame3 *bg;
+
+	bg = get_game(gid, dp);
+	if (bg->mvct > *maxp) {
+		*maxp = 2*bg->mvct;
+		*mvp = xrealloc(*mvp, *maxp * sizeof(int));
+	}
+	*size = bg->size;
+	return sgfdb_moves(bg, *mvp);
+}
+
+/* a signature: kind 0 is the whole game, kind b+1 band b */
+struct dupkey {
+	unsigned long long key;
+	int gid;
+	int kind;
+};
+
+static int
+compar_keys(const void *aa, const void *bb) {
+	const struct dupkey *a = aa, *b = bb;
+
+	if (a->key != b->key)
+		return (a->key < b->key) ? -1 : 1;
+	if (a->kind != b->kind)
+		return a->kind - b->kind;
+	return a->gid - b->gid;
+}
+
+static struct extsort *keys;
+static pthread_mutex_t keylock = PTHREAD_MUTEX_INITIALIZER;
+static int nextgame;
+
+static void *
+key_thread(void *arg) {
+	struct dupkey *kb;
+	const unsigned long long *h;
+	int *mvs = NULL, maxmvs = 0;
+	int g, end, n, nk, b, size, d, i;
+
+	kb = xmalloc(CHUNK * (MAXBANDS+1) * sizeof(*kb));
+	while (1) {
+		pthread_mutex_lock(&keylock);
+		g = nextgame;
+		end = nextgame = (g + CHUNK < ngames ? g + CHUNK : ngames);
+		pthread_mutex_unlock(&keylock);
+		if (g == end)
+			break;
+
+		nk = 0;
+		for ( ; g < end; g++) {
+			n = get_moves(g, &mvs, &maxmvs, &size, &d);
+			h = sgfdb_hashes(dms[d]);
+			kb[nk].key = (h ? h[g - dbbase[d]] :
+				      can64_moves(mvs, n, size, NULL));
+			kb[nk].gid = g;
+			kb[nk++].kind = 0;
+			for (b = 0; !optx && b < MAXBANDS &&
+				     (b+1)*bandlen <= n; b++) {
+				kb[nk].key = can64_moves(mvs + b*bandlen,
+							 bandlen, size, NULL);
+				kb[nk].gid = g;
+				kb[nk++].kind = b+1;
+			}
+		}
+
+		pthread_mutex_lock(&keylock);
+		for (i = 0; i < nk; i++)
+			extsort_add(keys, &kb[i]);
+		pthread_mutex_unlock(&keylock);
+	}
+	free(kb);
+	free(mvs);
+	return NULL;
+}
+
+static void
+make_keys(void) {
+	pthread_t *tids;
+	int i;
+
+	keys = extsort_new(sizeof(struct dupkey), memlimit << 20,
+			   compar_keys, tmpdir);
+	nextgame = 0;
+	if (nthreads <= 1) {
+		key_thread(NULL);
+		return;
+	}
+	tids = xmalloc(nthreads * sizeof(pthread_t));
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&tids[i], NULL, key_thread, NULL))
+			fatalexit("cannot create thread");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+/* union-find, the root is the smallest game of its cluster */
+static int *parent;
+
+static int
+find(int g) {
+	while (parent[g] != g)
+		g = parent[g] = parent[parent[g]];
+	return g;
+}
+
+static void
+join(int a, int b) {
+	a = find(a);
+	b = find(b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+#define NONE	0
+#define ONEDIFF	1
+#define PREFIX	2
+#define EXACT	3
+static char *relnames[] = { "near", "onediff", "prefix", "exact" };
+
+/*
+ * How game b relates to game a: NONE, ONEDIFF, PREFIX or EXACT,
+ * with in *tra the transformation that maps b onto a.
+ */
+static int
+compare_games(int a, int b, int *tra) {
+	static int *ma, *mb, maxa, maxb;
+	const unsigned short *tab;
+	int na, nb, sza, szb, n, i, t, p, m, diffs, rel, best;
+
+	na = get_moves(a, &ma, &maxa, &sza, NULL);
+	nb = get_moves(b, &mb, &maxb, &szb, NULL);
+	if (sza != szb)
+		return NONE;
+	tab = movetra_table(sza);
+	n = (na < nb ? na : nb);
+
+	best = NONE;
+	*tra = 0;
+	for (t = 0; t < (tab ? 8 : 1); t++) {
+		diffs = 0;
+		for (i = 0; i < n && diffs <= 1; i++) {
+			m = mb[i];
+			if (tab && (p = movetra_point(szb, m)) >= 0)
+				m = (m & ~0xffff) | tab[TRAPT(t, p)];
+			if (m != ma[i])
+				diffs++;
+		}
+		if (diffs == 0)
+			rel = (na == nb) ? EXACT : PREFIX;
+		else if (diffs == 1 && na == nb)
+			rel = ONEDIFF;
+		else
+			rel = NONE;
+		if (rel > best) {
+			best = rel;
+			*tra = t;
+		}
+		if (best == EXACT)
+			break;
+	}
+	return best;
+}
+
+/* a group of games with the same signature */
+static int *group, ngroup, maxgroup;
+static long long ncompares;
+
+static void
+do_group(void) {
+	int reps[MAXREPS], nreps, i, j, g, tra;
+
+	nreps = 0;
+	for (i = 0; i < ngroup; i++) {
+		g = group[i];
+		for (j = 0; j < nreps; j++) {
+			if (find(reps[j]) == find(g))
+				break;
+			ncompares++;
+			if (compare_games(reps[j], g, &tra) != NONE) {
+				join(reps[j], g);
+				break;
+			}
+		}
+		if (j == nreps && nreps < MAXREPS)
+			reps[nreps++] = g;
+	}
+}
+
+static void
+find_clusters(void) {
+	const struct dupkey *k;
+	unsigned long long key = 0;
+	int kind = -1, g;
+
+	parent = xmalloc(ngames * sizeof(int));
+	for (g = 0; g < ngames; g++)
+		parent[g] = g;
+
+	extsort_sort(keys);
+	ngroup = 0;
+	while ((k = extsort_next(keys)) != NULL) {
+		if (k->key != key || k->kind != kind) {
+			if (ngroup > 1)
+				do_group();
+			ngroup = 0;
+			key = k->key;
+			kind = k->kind;
+		}
+		if (ngroup == maxgroup) {
+			maxgroup = (maxgroup ? 2*maxgroup : 64);
+			group = xrealloc(group, maxgroup * sizeof(int));
+		}
+		group[ngroup++] = k->gid;
+	}
+	if (ngroup > 1)
+		do_group();
+	extsort_free(keys);
+}
+
+static void
+print_game(const char *rel, int tra, int gid) {
+	struct bingame3 *bg;
+	int d;
+
+	bg = get_game(gid, &d);
+	printf("\t%s\t%d\t%d\t%s", rel, tra, bg->movect,
+	       sgfdb_filename(dms[d], bg));
+	if (bg->gamenr)
+		printf("  # %d", bg->gamenr);
+	printf("\n");
+}
+
+static int nclusters, nclustered;
+
+static void
+print_cluster(void) {
+	int i, rel, tra;
+
+	printf("cluster %d: %d games\n", ++nclusters, ngroup);
+	print_game("first", 0, group[0]);
+	for (i = 1; i < ngroup; i++) {
+		rel = compare_games(group[0], group[i], &tra);
+		print_game(relnames[rel], tra, group[i]);
+	}
+	nclustered += ngroup;
+}
+
+/* the games of each cluster together, in order of their first game */
+static void
+output_clusters(void) {
+	unsigned char *inclust;
+	struct dupkey *k, m;
+	struct extsort *es;
+	int g, r;
+
+	inclust = xmalloc(ngames+1);
+	memset(inclust, 0, ngames+1);
+	for (g = 0; g < ngames; g++)
+		if ((r = find(g)) != g)
+			inclust[r] = inclust[g] = 1;
+
+	es = extsort_new(sizeof(struct dupkey), memlimit << 20,
+			 compar_keys, tmpdir);
+	for (g = 0; g < ngames; g++) {
+		if (!inclust[g])
+			continue;
+		m.key = find(g);
+		m.gid = g;
+		m.kind = 0;
+		extsort_add(es, &m);
+	}
+	free(inclust);
+	free(parent);
+
+	extsort_sort(es);
+	ngroup = 0;
+	r = -1;
+	while ((k = (struct dupkey *) extsort_next(es)) != NULL) {
+		if ((int) k->key != r) {
+			if (ngroup)
+				print_cluster();
+			ngroup = 0;
+			r = k->key;
+		}
+		if (ngroup == maxgroup) {
+			maxgroup = (maxgroup ? 2*maxgroup : 64);
+			group = xrealloc(group, maxgroup * sizeof(int));
+		}
+		group[ngroup++] = k->gid;
+	}
+	if (ngroup)
+		print_cluster();
+	extsort_free(es);
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "Call: sgfdup [-j N] [-x] [-L N] [-M MB] [-T dir] "
+		"[-q] database(s)\n");
+	exit(1);
+}
+
+/* the numeric argument of option -X: -XN or -X N */
+static long
+numarg(int *argcp, char ***argvp) {
+	char **argv = *argvp;
+
+	if (argv[1][2])
+		return atol(argv[1]+2);
+	if (*argcp == 2)
+		errexit("%s needs following number", argv[1]);
+	(*argcp)--;
+	(*argvp)++;
+	return atol(argv[2]);
+}
+
+int
+main(int argc, char **argv) {
+	long long total;
+	int i;
+
+	progname = "sgfdup";
+	infilename = "(reading options)";
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "--")) {
+			argc--; argv++;
+			break;
+		}
+		if (!strncmp(argv[1], "-j", 2)) {
+			nthreads = numarg(&argc, &argv);
+			if (nthreads < 1)
+				errexit("-j needs a positive number");
+			goto next;
+		}
+		if (!strncmp(argv[1], "-L", 2)) {
+			bandlen = numarg(&argc, &argv);
+			if (bandlen < 1)
+				errexit("-L needs a positive number");
+			goto next;
+		}
+		if (!strncmp(argv[1], "-M", 2)) {
+			memlimit = numarg(&argc, &argv);
+			if (memlimit < 1)
+				errexit("-M needs a positive number");
+			goto next;
+		}
+		if (!strcmp(argv[1], "-T")) {
+			if (argc == 2)
+				errexit("-T needs following directory");
+			tmpdir = argv[2];
+			argc--; argv++;
+			goto next;
+		}
+		if (!strcmp(argv[1], "-q")) {
+			quiet = 1;
+			goto next;
+		}
+		if (!strcmp(argv[1], "-x")) {
+			optx = 1;
+			goto next;
+		}
+		usage();
+	next:
+		argc--; argv++;
+	}
+	if (argc == 1)
+		usage();
+
+	ndbs = argc-1;
+	dbnames = argv+1;
+	dms = xmalloc(ndbs * sizeof(*dms));
+	dbbase = xmalloc(ndbs * sizeof(int));
+	total = 0;
+	for (i = 0; i < ndbs; i++) {
+		infilename = dbnames[i];
+		dms[i] = sgfdb_open(dbnames[i]);
+		dbbase[i] = total;
+		total += sgfdb_ngames(dms[i]);
+		if (total > 0x7fffffff)
+			errexit("too many games");
+	}
+	infilename = "";
+	ngames = total;
+
+	make_keys();
+	total = extsort_count(keys);
+	find_clusters();
+	output_clusters();
+
+	if (!quiet)
+		fprintf(stderr, "%d game%s, %lld signatures, %lld comparisons, "
+			"%d cluster%s with %d games\n",
+			ngames, (ngames == 1) ? "" : "s", total, ncompares,
+			nclusters, (nclusters == 1) ? "" : "s", nclustered);
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include "errexit.h"
 #include "xmalloc.h"
 #include "readsgf.h"
+#include "sgfprop.h"
 #include "sgfinfo.h"
 #include "sgffileinput.h"
 #include "tests.h"
@@ -21,6 +22,7 @@ struct gametree *gametree;
 struct node *rootnode;
 static int gtlevel;		/* nesting depth of parens */
 static int skipping;		/* true if not the main game line */
+static struct sgf_parser *parser;
 
 static inline int
 is_upper_case(int c) {
@@ -220,6 +222,20 @@ get_multiprops(char *buf, int len) {
 	return (len == 0);
 }
 
+/* returns 1 on overflow */
+static int
+copy_value(char *buf, int len, struct propvalue *pv) {
+	char *s = sgf_value(parser, pv);
+
+	if (strlen(s) >= len)
+		return 1;
+	if (!replacenl)
+		strcpy(buf, s);
+	else
+		copy_without_nl(buf, s);
+	return 0;
+}
+
 /* get the value of the 1st occurrence of XY */
 static int
 get_propXY_n(char *XY, char *buf, int len, struct node *node) {
@@ -229,15 +245,9 @@ get_propXY_n(char *XY, char *buf, int len, struct node *node) {
 		p = node->p;
 		while (p) {
 			if (!strcmp(p->id, XY)) {
-				if (!p->val || !p->val->val)
+				if (!p->val)
 					continue;	/* impossible? */
-				if (strlen(p->val->val) >= len)
-					return 1;	/* overflow */
-				if (!replacenl)
-					strcpy(buf, p->val->val);
-				else
-					copy_without_nl(buf, p->val->val);
-				return 0;
+				return copy_value(buf, len, p->val);
 			}
 			p = p->next;
 		}
@@ -282,15 +292,9 @@ static int get_rpropXY(char *XY, char *buf, int len) {
 
 	while (p) {
 		if (!strcmp(p->id, XY)) {
-			if (!p->val || !p->val->val)
+			if (!p->val)
 				continue;	/* impossible? */
-			if (strlen(p->val->val) >= len)
-				return 1;	/* overflow */
-			if (!replacenl)
-				strcpy(buf, p->val->val);
-			else
-				copy_without_nl(buf, p->val->val);
-			return 0;
+			return copy_value(buf, len, p->val);
 		}
 		p = p->next;
 	}
@@ -324,7 +328,7 @@ get_mpropXY_n(char *XY, char *buf, int len, struct node *node) {
 				pv = p->val;
 				while (pv) {
 					ret = snprintf(buf, len, "[%s]",
-						       pv->val);
+						       sgf_value(parser, pv));
 					buf += ret;
 					len -= ret;
 					if (len <= 0)
@@ -464,10 +468,10 @@ setsize(struct node *node) {
 	struct property *p = node->p;
 
 	while (p) {
-		if (!strcmp(p->id, "SZ")) {
+		if (p->tag == PROP_SZ) {
 			if (!p->val || p->val->next)
 				errexit("strange SZ property");
-			size = atoi(p->val->val);
+			size = atoi(sgf_value(parser, p->val));
 			if (size < 0 || size > MAXSZ)
 				errexit("SZ[%d] out of bounds", size);
 			/* playgogame.c has a smaller limit */
@@ -477,33 +481,36 @@ setsize(struct node *node) {
 	}
 }
 
+static inline int
+is_space(int c) {
+	return (c == ' ' || c == '\n' || c == '\r');
+}
+
 static void
 put_move1(struct propvalue *pv, int mask) {
-	char *s, *t;
+	const char *s;
+	int n;
 
 	if (!pv)
 		errexit("missing move value");
-	s = pv->val;	/* something like "dp" or "bp:cp" */
-
-	/* strip leading whitespace */
-	while (*s && (*s == ' ' || *s == '\n' || *s == '\r'))
-		s++;
+	s = pv->raw;	/* something like "dp" or "bp:cp" */
+	n = pv->len;
 
-	/* strip trailing whitespace */
-	t = s;
-	while (*t) t++;
-	while (--t >= s && (*t == ' ' || *t == '\n' || *t == '\r'))
-		*t = 0;
+	/* strip leading and trailing whitespace */
+	while (n > 0 && is_space(*s))
+		s++, n--;
+	while (n > 0 && is_space(s[n-1]))
+		n--;
 
-	if (*s == 0) {
+	if (n == 0) {
 		if (mvct == MAXMOVES)
 			errexit("too many moves");
 		moves[mvct++] = (PASS | mask);
-	} else if (s[0] && s[1] && s[2] == 0) {
+	} else if (n == 2) {
 		if (mvct == MAXMOVES)
 			errexit("too many moves");
 		moves[mvct++] = ((s[0]<<8) | s[1] | mask);
-	} else if (s[0] && s[1] && s[2] == ':' && s[3] && s[4] && s[5] == 0) {
+	} else if (n == 5 && s[2] == ':') {
 		int r1,c1,r2,c2,i,j;
 
 		r1 = s[0];
@@ -511,28 +518,28 @@ put_move1(struct propvalue *pv, int mask) {
 		r2 = s[3];
 		c2 = s[4];
 		if (r1 > r2 || c1 > c2)
-			errexit("unexpected range _%s_", s);
+			errexit("unexpected range _%.*s_", n, s);
 		for (i=r1; i<=r2; i++) for (j=c1; j<=c2; j++) {
 			if (mvct == MAXMOVES)
 				errexit("too many moves");
 			moves[mvct++] = ((i<<8) | j | mask);
 		}
-	} else if (!strcmp(s, "pass")) {
+	} else if (n == 4 && !strncmp(s, "pass", 4)) {
 		/* not really legal.. */
 		if (mvct == MAXMOVES)
 			errexit("too many moves");
 		moves[mvct++] = (PASS | mask);
 	} else
-		errexit("unexpected move _%s_", s);
+		errexit("unexpected move _%.*s_", n, s);
 }
 
 static void
 put_move(struct property *p) {
 	int mask;
 
-	if (p->id[0] == 'B')
+	if (p->tag == PROP_B)
 		mask = BLACK_MASK;
-	else if (p->id[0] == 'W')
+	else if (p->tag == PROP_W)
 		mask = WHITE_MASK;
 	else
 		errexit("non B/W move");
@@ -552,14 +559,14 @@ get_setup_stones(struct node *node) {
 
 	p = node->p;
 	while (p) {
-		if (!strcmp(p->id, "AB")) {
+		if (p->tag == PROP_AB) {
 			pv = p->val;
 			while (pv) {
 				abct++;
 				put_move1(pv, BLACK_MASK);
 				pv = pv->next;
 			}
-		} else if (!strcmp(p->id, "AW")) {
+		} else if (p->tag == PROP_AW) {
 			pv = p->val;
 			while (pv) {
 				awct++;
@@ -617,7 +624,7 @@ init_single_game(struct gametree *g) {
 static int
 is_move(struct property *p) {
 	return (p && p->val->next == NULL &&
-		(!strcmp(p->id, "B") || !strcmp(p->id, "W")));
+		(p->tag == PROP_B || p->tag == PROP_W));
 }
 
 static void
@@ -660,21 +667,16 @@ put_gametree_sequence(struct gametree *g) {
 	}
 }
 
-static int
-get_number_of_games(struct gametree *g) {
-	int n = 0;
-
-	while (g) {
-		g = g->nextsibling;
-		n++;
-	}
-	return n;
-}
-
 static inline char *plur(int n) {
 	return (n == 1) ? "" : "s";
 }
 
+/*
+ * The games are read one at a time, and each is freed before the
+ * next is read. Only whether more games follow is known in advance,
+ * so number_of_games is the number seen so far, plus one if there
+ * are more.
+ */
 void
 do_stdin(const char *fn) {
 	struct gametree *g;
@@ -683,24 +685,31 @@ do_stdin(const char *fn) {
 		goto ret;
 	have_jmpbuf = 1;
 
-	readsgf(fn, &g);
-	number_of_games = get_number_of_games(g);
+	if (parser == NULL)
+		parser = sgf_parser_new(sgf_default_flags() | SGF_MMAP);
+	sgf_readsgf_stream(parser, fn);
 
 	if (optN) {
+		number_of_games = 0;
+		while (sgf_readgame(parser, &g))
+			number_of_games++;
 		if (argct <= 1)
 			printf("%d\n", number_of_games);
 		else
 			printf("%6d game%s in %s\n",
 			       number_of_games, plur(number_of_games),
 			       infilename);
-		return;
+		goto ret;
 	}
 
 	reportedfn = 0;
 	gamenr = gtlevel = skipping = 0;
 
-	put_gametree_sequence(g);
+	while (sgf_readgame(parser, &g)) {
+		number_of_games = gamenr + 1 + sgf_more_games(parser);
+		put_gametree_sequence(g);
+	}
 ret:
 	have_jmpbuf = 0;
-	yfree();
+	sgf_parser_clear(parser);
 }
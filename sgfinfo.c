@@ -7,6 +7,9 @@
  * -nf: suppress printing of the filename
  * -i: ignore errors (give message and continue with next file)
  * -t: trace: print input as it is being read
+ * -j N: use N processes (the output is the same as without)
+ * -serve=SOCKET (sgfdbinfo only, first option): load the data bases
+ *  once and answer queries on a local socket (see sgfdbserve.c)
  * --: end option list (needed if a file name starts with '-')
  *
  * Select in a list of input files
@@ -18,18 +21,33 @@
  * -p1-12cf,dd: positions cf,dd were played between moves 1 and 12
  * -p-cf,dd: positions cf,dd were played between begin and end
  * -Bp, -Wp idem, with back/white move
- * -pat=file.sgf read file with AE, AB, AW restrictions (this closes stdin)
+ * -Bcapt#, -Wcapt#: # black/white stones were captured (ranges as for moves)
+ * -pat=file.sgf read file with AE, AB, AW restrictions
+ * -pos=file.sgf: the game reaches the position with the AB, AW stones
+ *  of file.sgf (in some orientation, with -alltra)
  * -player: give player
  *
  * Game selection in an input file with multiple games:
  * -x, -x#: report, and if # given select, game number
  *
+ * Select duplicates:
+ * -dup: the game has the same -can64 as a game seen earlier
+ * -same=HASH: the game has this -can64 (16 hex digits)
+ *
+ * Select on the root properties (sgfdbinfo only, using the player
+ * and date indexes of the data base):
+ * -who=NAME: PB or PW is NAME
+ * -date=FROM,TO: FROM <= DT < TO (as strings; either may be empty
+ *  for no bound); -date=D: DT starts with D
+ *
  * Print info or signature:
  * -N: print number of games in a collection
  * -m: print number of moves
  * -k: print first time the given pattern occurs
  * -md5: print md5 signature of this long string
  * -can: print minimal md5 signature of 8 rotated and reflected versions
+ * -hash64, -can64: idem with a fast 64-bit hash instead of md5
+ *  (not affected by -tra; sgfdb stores the can64 of each game)
  * -Ds20,40,60: print Dave Dyer type signature (the numbers may vary)
  * -DsA: equivalent to -s20,40,60
  * -DsB: equivalent to -s31,51,71
@@ -44,7 +62,8 @@
  *
  * Print position:
  * -P#: output sgf file with the position after move #
- *  (default: after the final move)
+ *  (default: after the final move); -P#,#,...: one line for each
+ *  of these positions
  *
  * Operations (for -md5, -can, -M, -s*, -P):
  * -trunc#, -trunc-#: truncate to # moves, or delete the final # moves
@@ -76,6 +95,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <openssl/md5.h>
 #include "ftw.h"
 #include "errexit.h"
@@ -83,9 +103,13 @@
 #include "sgfinfo.h"
 #include "playgogame.h"
 #include "tests.h"
+#include "xmalloc.h"
+#include "forkq.h"
+#include "movehash.h"
 
 #ifdef READ_FROM_DB
 
+#include "sgfdbread.h"
 #include "sgfdbinput.h"
 #include "sgfdb.h"
 #define DB "db"
@@ -104,6 +128,7 @@ char *file_extension = ".sgf";
 #endif
 
 int recursive = 0;
+int nprocs = 0;		/* -j: number of processes */
 
 void report_on_single_game(void);
 int reportedfn = 0;
@@ -124,7 +149,9 @@ int optM = 0;		/* report moves and/or color */
 int opts = 0;		/* print the sequence of moves as a single string */
 
 int optP = 0;
-int optPmvct;
+#define MAXPOSREQ	100
+int optPmvct[MAXPOSREQ], optPct;	/* -1: after the final move */
+#define SNAPEVERY	16		/* moves between board checkpoints */
 
 /* transformations */
 int opttra = 0;		/* specify transformation */
@@ -141,7 +168,8 @@ int size, moves[MAXMOVES], mvct, initct, movect, handct;
 int bcaptct, wcaptct;
 
 /* defined when didplay = 1 */
-int extmoves[MAXMOVES], extmvct;	/* all including captures */
+short int extmoves[MAXMOVES];	/* all including captures, as in mv[] */
+int extmvct;
 
 /* selection criteria */
 #define BLACK_MASK	0x10000
@@ -155,10 +183,23 @@ int movesplayedct;
 #define SZ 19
 int pattern[MAXPLAYS], patternct, patternbwct, patternsize, patindex;
 int patternboard[16*SZ*SZ];
+unsigned short patmask[3][SZ*SZ];	/* see findpattern() */
 int printpatternindex = 0;
 int swapcolors = 0;
 int alltra = 0;
 
+int optdup = 0;		/* -dup */
+int dupselected;	/* -dup done already by preselect_games() */
+int optsame = 0;	/* -same=HASH */
+int sameselected;	/* -same done already by preselect_games() */
+unsigned long long samehash;
+char *optwho = NULL;	/* -who=NAME */
+char *optdate = NULL;	/* -date=FROM,TO or -date=D */
+
+int optpos = 0;		/* -pos=file.sgf */
+int posstones[MAXPLAYS], posct, possize = SZ;
+unsigned long long poshash;
+
 int gamenr;		/* serial number (from 1) of current game */
 
 /* fill extmoves[] array, given the moves[] array */
@@ -167,19 +208,13 @@ static void do_play() {
 	errexit("do_play called unnecessarily");
 #else
 	struct played_game game;
-	short int mv[MAXMOVES], *mvp;
-	int i;
 
-	game.mv = mv;
+	game.mv = extmoves;
 	game.mvlen = MAXMOVES;
 	playgogame(size, moves, mvct, initct, &game);
 	bcaptct = game.counts[1];
 	wcaptct = game.counts[2];
 	extmvct = game.mvct;
-
-	mvp = mv;
-	for (i=0; i<extmvct; i++)
-		extmoves[i] = mvp[i];
 #endif
 }
 
@@ -360,12 +395,100 @@ static int move_to_index(int mv) {
 
 #define FAILURE (-1)
 
-static int findpattern0(int a) {
-	int n, i, pos, ipos, m, need, mc;
-	int *pb;
+/*
+ * With -dup: the can64 values of the games seen so far,
+ * in an open addressing hash table (0 is kept apart)
+ */
+static unsigned long long *seenhashes;
+static long nseen, seensz;
+static int seenzero;
+
+/* was h seen before? (and remember it) */
+static int seen_before(unsigned long long h) {
+	unsigned long long *old;
+	long i, j, oldsz;
+
+	if (h == 0) {
+		if (seenzero)
+			return 1;
+		seenzero = 1;
+		return 0;
+	}
+	if (2*(nseen+1) > seensz) {
+		old = seenhashes;
+		oldsz = seensz;
+		seensz = (seensz ? 2*seensz : 65536);
+		seenhashes = xmalloc(seensz * sizeof(*seenhashes));
+		memset(seenhashes, 0, seensz * sizeof(*seenhashes));
+		for (j=0; j<oldsz; j++) {
+			if (!old[j])
+				continue;
+			i = old[j] & (seensz-1);
+			while (seenhashes[i])
+				i = (i+1) & (seensz-1);
+			seenhashes[i] = old[j];
+		}
+		free(old);
+	}
+	i = h & (seensz-1);
+	while (seenhashes[i]) {
+		if (seenhashes[i] == h)
+			return 1;
+		i = (i+1) & (seensz-1);
+	}
+	seenhashes[i] = h;
+	nseen++;
+	return 0;
+}
+
+/*
+ * With -pos=file.sgf: the first move number after which the game
+ * has the position of file.sgf (in some orientation, with -alltra),
+ * or FAILURE
+ */
+static int findposition() {
+	static struct pg_engine *pe;
+	struct played_game game;
+	const unsigned long long *h;
+	short int *mv;
+	int c;
+
+	if (pe == NULL) {
+		pe = pg_new();
+		pg_set_canonical(pe, alltra);
+		pg_set_quiet(pe, 1);
+	}
+	mv = xmalloc(2*mvct * sizeof(short int) + 1);
+	game.mv = mv;
+	game.mvlen = 2*mvct;
+	playgogame_r(pe, size, moves, mvct, initct, &game);
+	free(mv);
+
+	h = (alltra ? pg_canonical_hashes(pe) : pg_hashes(pe));
+	for (c=initct; c<=mvct; c++)
+		if (h[c] == poshash)
+			return c-initct;
+	return FAILURE;
+}
+
+/*
+ * Look for the pattern in all 16 transformations in one pass over
+ * extmoves[] (only in transformation 0 without -alltra).
+ * patmask[c][p] has bit a set when transformation a of the pattern
+ * wants black (c=0), white (c=1) or empty (c=2) at point p, need[a]
+ * counts the pattern stones of transformation a that are not (yet)
+ * there, and live has the transformations that still can match:
+ * a PG_PERMANENT stone or capture in the wrong place removes one.
+ * Returns the first move number after which some transformation
+ * matches, or FAILURE.
+ */
+static int findpattern() {
+	int need[16], n, i, a, pos, ipos, c;
+	unsigned int live, want, other, empty, x;
 
-	pb = patternboard + a*SZ*SZ;
-	need = patternbwct;
+	live = (alltra ? 0xffff : 1);
+	for (a=0; a<16; a++)
+		need[a] = patternbwct;
 	n = 0;
 	for (i=0; i<extmvct; i++) {
 		pos = extmoves[i];
@@ -376,84 +499,196 @@ static int findpattern0(int a) {
 		ipos = move_to_index(pos & 0x3ff);
 		if (ipos < 0 || ipos >= SZ*SZ)
 			errexit("out-of-board move %d", i+1);
-		m = pb[ipos];
-		if (!m)
+		empty = patmask[2][ipos] & live;
+		c = (pos >> 10) & 3;		/* 1: black, 2: white */
+		want = (c == 1 || c == 2) ? patmask[c-1][ipos] & live : 0;
+		other = (patmask[0][ipos] | patmask[1][ipos]) & live & ~want;
+		if (!(empty | want | other))
 			continue;
-		if (m == EMPTY_MASK) {
-			if (pos & PG_CAPTURE) {
-				if (--need == 0)
-					return n;
-			} else {
-				if (pos & PG_PERMANENT)
-					return FAILURE;
-				need++;
-			}
-			continue;
-		}
-		/* pattern array has BLACK_MASK (bit 16)
-		   move array has color bit (bit 10) */
-		mc = (pos << 6) & 0x30000;	/* move color */
+
 		if (pos & PG_CAPTURE) {
+			for (x = empty; x; x &= x-1)
+				if (--need[__builtin_ctz(x)] == 0)
+					return n;
 			if (pos & PG_PERMANENT)
-				return FAILURE;
-			if (mc == m)
-				need++;
+				live &= ~(want | other);
+			else
+				for (x = want; x; x &= x-1)
+					need[__builtin_ctz(x)]++;
 		} else {
-			if (mc == m) {
-				if (--need == 0)
+			for (x = want; x; x &= x-1)
+				if (--need[__builtin_ctz(x)] == 0)
 					return n;
-			} else if (pos & PG_PERMANENT)
-				return FAILURE;
+			if (pos & PG_PERMANENT)
+				live &= ~(empty | other);
+			else
+				for (x = empty; x; x &= x-1)
+					need[__builtin_ctz(x)]++;
 		}
+		if (!live)
+			return FAILURE;
 	}
 	return FAILURE;
 }
 
-static int findpattern() {
-	int m, n, nmin;
-
-	if (!alltra)
-		return findpattern0(0);
-	nmin = -1;
-	for (m=0; m<16; m++) {
-		n = findpattern0(m);
-		if (n >= 0 && (nmin < 0 || n < nmin))
-			nmin = n;
-	}
-	return nmin;
+#ifdef READ_FROM_DB
+/* the key of a stone on x,y (from 0) in the move index, see sgfdb.h */
+static int dbkey(int x, int y, int mask) {
+	int color = ((mask == BLACK_MASK) ? 1 : 2);
+
+	return (color << 10) | ((x+1)*(MAXSZ+1) + (y+1));
 }
 
-static void transform0(int *xx, int *yy, int tra, int size) {
-	int x, y, xn, yn;
-	int sz = size-1;
+static void and_mask(unsigned char *a, unsigned char *b, int n) {
+	int i;
+
+	for (i=0; i<n; i++)
+		a[i] &= b[i];
+}
+
+/*
+ * Called by do_dbin() for a version 3 data base: clear ok[g] for the
+ * games g that cannot satisfy the -p and -pat restrictions because
+ * some required stone was never placed (when there is a move index),
+ * or that never reach the -pos position (when there is a position
+ * index). -same, -who and -date are looked up in the hash, player
+ * and date indexes. Returns 0 if nothing could be excluded in this way.
+ */
+int preselect_games(struct sgfdbmap *dm, unsigned char *ok, int n) {
+	unsigned char *t, *u, *cand;
+	struct mp *mp;
+	int i, a, x, y, min, max, *pb, res = 0;
 
-	x = *xx;
-	y = *yy;
-
-	switch (tra) {
-	case 0:
-		xn = x; yn = y; break;
-	case 1:
-		xn = x; yn = sz-y; break;
-	case 2:
-		xn = y; yn = sz-x; break;
-	case 3:
-		xn = y; yn = x; break;
-	case 4:
-		xn = sz-x; yn = sz-y; break;
-	case 5:
-		xn = sz-x; yn = y; break;
-	case 6:
-		xn = sz-y; yn = x; break;
-	case 7:
-		xn = sz-y; yn = sz-x; break;
-	default:
-		errexit("impossible tra arg in transform0()");
+	t = xmalloc(n+1);
+
+	/* with -dup and stored hashes, no need to look at the moves */
+	if (optdup) {
+		const unsigned long long *h = sgfdb_hashes(dm);
+
+		dupselected = (h != NULL);
+		if (h) {
+			for (i=0; i<n; i++)
+				if (!seen_before(h[i]))
+					ok[i] = 0;
+			res = 1;
+		}
+	}
+
+	/* with -same=, the games with that hash */
+	if (optsame) {
+		memset(t, 0, n);
+		sameselected = (sgfdb_byhash(dm, samehash, t) == 0);
+		if (sameselected) {
+			and_mask(ok, t, n);
+			res = 1;
+		}
 	}
 
-	*xx = xn;
-	*yy = yn;
+	/* -who= and -date= need the indexes, there are no columns for them
+	   in report_on_single_game() */
+	if (optwho) {
+		memset(t, 0, n);
+		if (sgfdb_byplayer(dm, optwho, t) < 0)
+			errexit("-who: data base without player index "
+				"(rebuild it with sgfdb)");
+		and_mask(ok, t, n);
+		res = 1;
+	}
+	if (optdate) {
+		char *from, *to, *comma;
+		int len;
+
+		from = xstrdup(optdate);
+		comma = strchr(from, ',');
+		if (comma) {
+			*comma = 0;
+			to = (comma[1] ? comma+1 : NULL);
+		} else {
+			/* a prefix D: from D up to D with its last byte
+			   incremented */
+			to = xstrdup(from);
+			len = strlen(to);
+			while (len > 0 && (unsigned char) to[len-1] == 0xff)
+				to[--len] = 0;
+			if (len > 0)
+				to[len-1]++;
+			else {
+				free(to);
+				to = NULL;
+			}
+		}
+		memset(t, 0, n);
+		if (sgfdb_bydate(dm, from, to, t) < 0)
+			errexit("-date: data base without date index "
+				"(rebuild it with sgfdb)");
+		and_mask(ok, t, n);
+		if (!comma)
+			free(to);
+		free(from);
+		res = 1;
+	}
+
+	/* with -pos=, without -alltra, the index has exact hashes */
+	if (optpos && !alltra) {
+		memset(t, 0, n);
+		if (sgfdb_positions(dm, poshash, t) == 0) {
+			and_mask(ok, t, n);
+			res = 1;
+		}
+	}
+
+	/* key -1: only ask whether there is a move index */
+	if (sgfdb_postings(dm, -1, 0, 0, NULL) < 0) {
+		free(t);
+		return res;
+	}
+
+	for (i=0; i<movesplayedct; i++) {
+		mp = &movesplayed[i];
+		x = (mp->pos >> 8) - 'a';
+		y = (mp->pos & 0xff) - 'a';
+		if (x < 0 || x >= SZ || y < 0 || y >= SZ)
+			continue;	/* pass */
+		min = (mp->nrmin == UNSET) ? 0 : mp->nrmin;
+		max = (mp->nrmax == UNSET) ? INT_MAX : mp->nrmax;
+		memset(t, 0, n);
+		if (mp->color != WHITE_MASK)
+			sgfdb_postings(dm, dbkey(x, y, BLACK_MASK), min, max, t);
+		if (mp->color != BLACK_MASK)
+			sgfdb_postings(dm, dbkey(x, y, WHITE_MASK), min, max, t);
+		and_mask(ok, t, n);
+		res = 1;
+	}
+
+	/* the stones of the pattern, in one of the transformations */
+	if (patternct && patternbwct) {
+		cand = xmalloc(n+1);
+		u = xmalloc(n+1);
+		memset(cand, 0, n);
+		for (a=0; a < (alltra ? 16 : 1); a++) {
+			pb = patternboard + a*SZ*SZ;
+			memset(u, 1, n);
+			for (i=0; i<SZ*SZ; i++) {
+				if (pb[i] != BLACK_MASK && pb[i] != WHITE_MASK)
+					continue;
+				memset(t, 0, n);
+				sgfdb_postings(dm, dbkey(i/SZ, i%SZ, pb[i]),
+					       0, INT_MAX, t);
+				and_mask(u, t, n);
+			}
+			for (i=0; i<n; i++)
+				cand[i] |= u[i];
+		}
+		and_mask(ok, cand, n);
+		free(cand);
+		free(u);
+		res = 1;
+	}
+
+	free(t);
+	return res;
 }
+#endif
 
 static void transform(int *xx, int *yy, int tra) {
 	int x = *xx, y = *yy;
@@ -479,10 +714,23 @@ static void transform(int *xx, int *yy, int tra) {
 	*yy = y + 'a';
 }
 
+/* the index in the movetra_table() of move m, or -1 (see movehash.c) */
+static int trapoint(int m) {
+	if (m < 0 || m >= mvct)
+		return -1;
+	return movetra_point(size, moves[m]);
+}
+
 /* needs room for 2 bytes */
 static void getmovetra(int m, char *buf, int tra) {
 	int n, x, y;
 
+	if ((n = trapoint(m)) >= 0) {
+		n = movetra_table(size)[TRAPT(tra, n)];
+		buf[0] = (n >> 8);
+		buf[1] = (n & 0xff);
+		return;
+	}
 	if (m < 0 || m >= mvct)
 		x = y = '?';
 	else {
@@ -495,6 +743,24 @@ static void getmovetra(int m, char *buf, int tra) {
 	buf[1] = y;
 }
 
+/* move m in all 8 transformations, at bufs[tra]+off */
+static void getmovealltra(int m, char **bufs, int off) {
+	const unsigned short *tab;
+	int p, n, tra;
+
+	if ((p = trapoint(m)) < 0) {
+		for (tra=0; tra<8; tra++)
+			getmovetra(m, bufs[tra]+off, tra);
+		return;
+	}
+	tab = movetra_table(size);
+	for (tra=0; tra<8; tra++) {
+		n = tab[TRAPT(tra, p)];
+		bufs[tra][off] = (n >> 8);
+		bufs[tra][off+1] = (n & 0xff);
+	}
+}
+
 /* needs room for 1 byte */
 static char getmovelet(int m) {
 	int n;
@@ -524,57 +790,31 @@ static void outmovex(int m) {
 }
 
 /* output position after move m, possibly after a transformation */
-static void outpos_at(int m) {
+static void outpos_at(struct pg_snapshots *ps, int m) {
 #define EMPTY	0
 #define BLACK	1
 #define	WHITE	2
-	int n, i, pos, ipos, ct, x, y;
-	int pb[SZ*SZ];
+	unsigned char pb[PG_BOARDSZ];
+	int color, ct, x, y, x1, y1;
 
-	for (i=0; i<SZ*SZ; i++)
-		pb[i] = EMPTY;
-	n = 0;
-	for (i=0; i<extmvct; i++) {
-		pos = extmoves[i];
-		if (i >= initct && !(pos & PG_CAPTURE)) {
-			n++;
-			if (n > m)
-				break;
-		}
-		if (pos & PG_PASS)
-			continue;
-		ipos = move_to_index(pos & 0x3ff);
-		if (ipos < 0 || ipos >= SZ*SZ)
-			errexit("out-of-board extmove[%d]", i);
-		if (pos & PG_CAPTURE)
-			pb[ipos] = EMPTY;
-		else
-			pb[ipos] = ((pos >> 10) & 3);
-	}
+	pg_position_at(ps, m, pb);
 
 	printf("(;");
 	if (size != 19)
 		printf("SZ[%d]", size);
-	ct = 0;
-	for (i=0; i<SZ*SZ; i++) {
-		if (pb[i] == BLACK) {
-			if (!ct++)
-				printf("AB");
-			x = (i/SZ);
-			y = (i%SZ);
-			transform0(&x, &y, opttra, size);
-			printf("[%c%c]", x+'a', y+'a');
-		}
-	}
-	ct = 0;
-	for (i=0; i<SZ*SZ; i++) {
-		if (pb[i] == WHITE) {
-			if (!ct++)
-				printf("AW");
-			x = (i/SZ);
-			y = (i%SZ);
-			transform0(&x, &y, opttra, size);
-			printf("[%c%c]", x+'a', y+'a');
+	for (color = BLACK; color <= WHITE; color++) {
+		ct = 0;
+		for (x=0; x<size; x++) {
+			for (y=0; y<size; y++) {
+				if (pb[(x+1)*(MAXSZ+1)+(y+1)] != color)
+					continue;
+				if (!ct++)
+					printf((color == BLACK) ? "AB" : "AW");
+				x1 = x;
+				y1 = y;
+				transform0(&x1, &y1, opttra, size);
+				printf("[%c%c]", x1+'a', y1+'a');
+			}
 		}
 	}
 	printf(")\n");
@@ -627,8 +867,8 @@ static int get_Dyer_sigC(char *buf, int len) {
 #define MAX_NDYER_LTH	(2*MAX_NSIG_LEN+1)
 static int get_nDyer_sign(char *choice, char *buf, int len) {
 	int choices[MAX_NSIG_LEN], choicect;
-	char ndyer[MAX_NDYER_LTH], ndyert[MAX_NDYER_LTH];
-	char *se, *buft;
+	char ndyert[8][MAX_NDYER_LTH], *bufs[8], *ndyer;
+	char *se;
 	int tra, i, n;
 
 	choicect = 0;
@@ -644,16 +884,15 @@ static int get_nDyer_sign(char *choice, char *buf, int len) {
 		choices[choicect++] = n;
 	}
 
+	for (tra = 0; tra < 8; tra++)
+		bufs[tra] = ndyert[tra];
+	for (i = 0; i < choicect; i++)
+		getmovealltra(choices[i]-1, bufs, 2*i);
+	ndyer = ndyert[0];
 	for (tra = 0; tra < 8; tra++) {
-		buft = ndyert;
-		for (i = 0; i < choicect; i++) {
-			n = choices[i];
-			getmovetra(n-1, buft, tra);
-			buft += 2;
-		}
-		*buft = 0;
-		if (tra == 0 || strcmp(ndyer, ndyert) > 0)
-			strcpy(ndyer, ndyert);
+		ndyert[tra][2*choicect] = 0;
+		if (strcmp(ndyer, ndyert[tra]) > 0)
+			ndyer = ndyert[tra];
 	}
 
 	if (2*choicect+1 > len)
@@ -819,6 +1058,24 @@ static void getmd5tra(unsigned char *md5, int tra) {
 	getmd5(md5, buf, bufct);
 }
 
+/* the md5 of the moves in each of the 8 transformations */
+static void getmd5alltra(unsigned char md5[8][MD5_DIGEST_LENGTH]) {
+	static char bufs[8][MAXBUF];
+	char *b[8];
+	int i, tra;
+
+	if (2*mvct > MAXBUF-1)
+		errexit("game too long");
+	for (tra=0; tra<8; tra++)
+		b[tra] = bufs[tra];
+	for (i=0; i<mvct; i++)
+		getmovealltra(i, b, 2*i);
+	for (tra=0; tra<8; tra++) {
+		bufs[tra][2*mvct] = '\n';
+		getmd5(md5[tra], bufs[tra], 2*mvct+1);
+	}
+}
+
 static int get_md5_string(char *buf, int len) {
 	unsigned char md5[MD5_DIGEST_LENGTH];
 	int i;
@@ -834,27 +1091,33 @@ static int get_md5_string(char *buf, int len) {
 	return 0;
 }
 
+static int get_hash64_string(char *buf, int len) {
+	if (len < 17)
+		return 1;	/* overflow */
+	sprintf(buf, "%016llx", hash64_moves(moves, mvct));
+	return 0;
+}
+
+static int get_can64_string(char *buf, int len) {
+	if (len < 17)
+		return 1;	/* overflow */
+	sprintf(buf, "%016llx", can64_moves(moves, mvct, size, NULL));
+	return 0;
+}
+
 static int get_canx_string(char *buf, int len) {
-	unsigned char md5[MD5_DIGEST_LENGTH];
-	unsigned char md5t[MD5_DIGEST_LENGTH];
+	unsigned char md5s[8][MD5_DIGEST_LENGTH], *md5;
 	int i, tra, mintra;
 
 	if (len < 2*MD5_DIGEST_LENGTH+3)
 		return 1;	/* overflow */
 
+	getmd5alltra(md5s);
 	mintra = 0;
-	getmd5tra(md5, 0);
-	for (tra=1; tra<8; tra++) {
-		getmd5tra(md5t, tra);
-		for(i = 0; i < MD5_DIGEST_LENGTH; i++)
-			if (md5t[i] != md5[i])
-				break;
-		if (md5t[i] < md5[i]) {
+	for (tra=1; tra<8; tra++)
+		if (memcmp(md5s[tra], md5s[mintra], MD5_DIGEST_LENGTH) < 0)
 			mintra = tra;
-			for(i = 0; i < MD5_DIGEST_LENGTH; i++)
-				md5[i] = md5t[i];
-		}
-	}
+	md5 = md5s[mintra];
 	for(i = 0; i < MD5_DIGEST_LENGTH; i++)
 		buf += sprintf(buf, "%02x", md5[i]);
 	/*
@@ -880,6 +1143,14 @@ void report_on_single_game() {
 	int i, bare;
 
 	/* check selection criteria */
+	if (optdup && !dupselected &&
+	    !seen_before(can64_moves(moves, mvct, size, NULL)))
+		return;
+
+	if (optsame && !sameselected &&
+	    can64_moves(moves, mvct, size, NULL) != samehash)
+		return;
+
 	if (optxx && gamenr != optxx)
 		return;
 
@@ -911,6 +1182,13 @@ void report_on_single_game() {
 		patindex = pi;
 	}
 
+	if (optpos) {
+		int pi = findposition();
+		if (pi < 0)
+			return;
+		patindex = pi;
+	}
+
 	/* yes, found a candidate - count it */
 	okgames++;
 
@@ -958,8 +1236,14 @@ void report_on_single_game() {
 	}
 
 	if (optP) {
-		/* output a single line */
-		outpos_at((optPmvct >= 0) ? optPmvct : movect);
+		/* output a single line for each position */
+		struct pg_snapshots *ps;
+
+		ps = pg_snapshots_new(size, extmoves, extmvct, initct,
+				      (optPct > 1) ? SNAPEVERY : extmvct+1);
+		for (i=0; i<optPct; i++)
+			outpos_at(ps, (optPmvct[i] >= 0) ? optPmvct[i] : movect);
+		pg_snapshots_free(ps);
 	}
 
 	bare_start(0);
@@ -1030,6 +1314,7 @@ static void init_pattern() {
 
 	for (i=0; i<16*SZ*SZ; i++)
 		patternboard[i] = 0;
+	memset(patmask, 0, sizeof(patmask));
 
 	/* init for all transformations and colors */
 	/* make sure that index 0 represents opttra, swapcolors */
@@ -1042,7 +1327,19 @@ static void init_pattern() {
 		initpb(pb, opttra ^ j, !swapcolors);
 	}
 
-	if (printpatternindex && !patternct)
+	for (j=0; j<16; j++) {
+		pb = &patternboard[j*SZ*SZ];
+		for (i=0; i<SZ*SZ; i++) {
+			if (pb[i] == BLACK_MASK)
+				patmask[0][i] |= (1 << j);
+			else if (pb[i] == WHITE_MASK)
+				patmask[1][i] |= (1 << j);
+			else if (pb[i] == EMPTY_MASK)
+				patmask[2][i] |= (1 << j);
+		}
+	}
+
+	if (printpatternindex && !patternct && !optpos)
 		errexit("pattern index requested, but no pattern?");
 }
 
@@ -1101,7 +1398,7 @@ static void readpatternfile(char *fn) {
 	struct node *node;
 	struct property *p;
 
-	readsgf(fn, &g);
+	sgf_readsgf(sgf_parser_new(sgf_default_flags()), fn, &g);
 	if (g->firstchild || g->nextsibling)
 		errexit("pattern file has variations");
 	node = g->nodesequence;
@@ -1131,26 +1428,89 @@ static void readpatternfile(char *fn) {
 	}
 }
 
+/*
+ * A position file is like a pattern file, but gives the complete
+ * position: SZ (default 19) and all stones, with AB/AW or B/W.
+ */
+static void readposfile(char *fn) {
+	struct gametree *g;
+	struct node *node;
+	struct property *p;
+	struct propvalue *pv;
+	int mask, mv;
+
+	sgf_readsgf(sgf_parser_new(sgf_default_flags()), fn, &g);
+	if (g->firstchild || g->nextsibling)
+		errexit("position file has variations");
+
+	for (node = g->nodesequence; node; node = node->next) {
+		for (p = node->p; p; p = p->next) {
+			if (!strcmp(p->id, "GM") || !strcmp(p->id, "FF"))
+				continue;
+			if (!strcmp(p->id, "SZ")) {
+				possize = atoi(p->val->val);
+				continue;
+			}
+			if (!strcmp(p->id, "AB") || !strcmp(p->id, "B"))
+				mask = BLACK_MASK;
+			else if (!strcmp(p->id, "AW") || !strcmp(p->id, "W"))
+				mask = WHITE_MASK;
+			else
+				errexit("unrecognized property %s "
+					"in position file", p->id);
+			for (pv = p->val; pv; pv = pv->next) {
+				if (!(strlen(pv->val) == 2 &&
+				      lowercasemove(pv->val, &mv)) &&
+				    !letdigsmove(pv->val, &mv))
+					errexit("unrecognized position move %s",
+						pv->val);
+				if (posct == MAXPLAYS)
+					errexit("MAXPLAYS overflow");
+				posstones[posct++] = (mv | mask);
+			}
+		}
+	}
+}
+
+/* after all options, since -alltra asks for the canonical hash */
+static void init_position() {
+	if (optpos)
+		poshash = pg_position_hash(possize, posstones, posct, alltra);
+}
+
 static void usage() {
 	printf("Call: %s [options] [--] [%sfile(s)]\n"
 	       " -nf: no filename\n"
 	       " -i: ignore errors\n"
 	       " -t: trace input\n"
+	       " -j N: use N processes\n"
+#ifdef READ_FROM_DB
+	       " -serve=SOCKET db(s): answer queries on SOCKET\n"
+#endif
 	       "\nSelect input file:\n"
 	       " -m#: game has # moves (-#, #-, #-#: at most, at least, ...)\n"
 	       " -p#X,Y,... : moves X, Y, ... were played at moves #\n"
 	       " -Bp#X, -Wp#X: idem for black/white moves\n"
 	       " -pat=file.sgf: find pattern\n"
+	       " -pos=file.sgf: find games that reach this position\n"
 	       " -h#: game has handicap # (-#, #-, #-#)\n"
+	       " -Bcapt#, -Wcapt#: # B, W stones captured (-#, #-, #-#)\n"
 	       "\nSelect game in a multi-game file:\n"
 	       " -x#: requested game number\n"
+	       " -dup: same game (up to symmetry) as an earlier one\n"
+	       " -same=HASH: game with this -can64\n"
+#ifdef READ_FROM_DB
+	       "\nSelect on root properties:\n"
+	       " -who=NAME: PB or PW is NAME\n"
+	       " -date=FROM,TO: FROM <= DT < TO; -date=D: DT starts with D\n"
+#endif
 	       "\nDefine and use reference file:\n"
 	       " -ref=FILE -propDT=@ (@: same as in FILE)\n"
 	       "\nTransform game:\n"
 	       " -trunc#: truncate to # moves\n"
 	       " -tra#: apply rotation or reflection (#=0,...,7)\n"
 	       " -swapcolors (together with -pat): swap colors\n"
-	       " -alltra (together with -pat): try all 16 transformations\n"
+	       " -alltra (with -pat, -pos): try all transformations\n"
 	       "\nPrint info:\n"
 	       " -N: print nr of games\n"
 	       " -m: print nr of moves\n"
@@ -1160,6 +1520,7 @@ static void usage() {
 	       " -k: print move number where pattern (first) found\n"
 	       " -h: print handicap\n"
 	       " -md5: print md5 signature of moves (only)\n"
+	       " -hash64, -can64: fast 64-bit versions of -md5, -can\n"
 	       " -can: print canonical signature of moves (only)\n"
 	       " -DsA (= -Ds20,40,60), -DsB (= -Ds31,51,71) Dyer signature\n"
 	       " -DnC (= -Dn20,40,60,31,51,71) normalized Dyer signature\n"
@@ -1170,8 +1531,21 @@ static void usage() {
 	       , progname, DB);
 }
 
+/* with -j, the input files are first collected */
+static char **infiles;
+static int ninfiles, maxinfiles, collecting;
+
 void
 do_input(const char *s) {
+	if (collecting) {
+		if (ninfiles == maxinfiles) {
+			maxinfiles = (maxinfiles ? 2*maxinfiles : 1024);
+			infiles = xrealloc(infiles,
+					   maxinfiles * sizeof(char *));
+		}
+		infiles[ninfiles++] = xstrdup((char *) s);
+		return;
+	}
 #ifdef READ_FROM_DB
 	do_dbin(s);
 #else
@@ -1179,6 +1553,55 @@ do_input(const char *s) {
 #endif
 }
 
+#define JOBS_PER_PROC	8	/* so that a slow job does not hold up all */
+
+/* the files of one job, in a child process; returns # games found */
+static long
+files_job(int job, void *arg) {
+	int njobs = *(int *) arg;
+	int i, n = okgames;
+
+	for (i = (long) job * ninfiles / njobs;
+	     i < (long) (job+1) * ninfiles / njobs; i++) {
+		infilename = infiles[i];
+		do_input(infiles[i]);
+	}
+	return okgames - n;
+}
+
+/*
+ * -j for sgfinfo: collect the input files, and give them out in
+ * nprocs child processes; the output is copied back in file order.
+ * (sgfdbinfo instead splits the games of a data base, see do_dbin3().)
+ * An error in do_infile() (say, a file that does not exist) ends the
+ * list; as in a serial run the files before it are still done.
+ */
+static void
+do_infiles_parallel(int argc, char **argv) {
+	int njobs, failed = 0;
+
+	collecting = 1;
+	catch_errors = 1;
+	if (setjmp(jmpbuf))
+		failed = 1;
+	else {
+		have_jmpbuf = 1;
+		while (argc > 1) {
+			infilename = argv[1];
+			do_infile(argv[1]);
+			argc--; argv++;
+		}
+	}
+	have_jmpbuf = catch_errors = collecting = 0;
+
+	njobs = nprocs * JOBS_PER_PROC;
+	if (njobs > ninfiles)
+		njobs = ninfiles;
+	okgames += forkq_run(njobs, nprocs, files_job, &njobs);
+	if (failed)
+		exit(1);
+}
+
 static void report_bcapt() {
 	set_int_to_report("%d black stone%s captured\n", &bcaptct);
 	infooptct++;
@@ -1195,6 +1618,13 @@ static int optional_num(char *s) {
 	return (*s == 0);
 }
 
+/* a comma-separated list of optional_num */
+static int optional_numlist(char *s) {
+	while ((*s >= '0' && *s <= '9') || *s == ',')
+		s++;
+	return (*s == 0);
+}
+
 /* for sh we have to escape ; & $ ( ) \ ' " ... */
 static int is_innocent(int c) {
 	return (c >= 'a' && c <= 'z') ||
@@ -1219,7 +1649,6 @@ static void esccopy(char *p, char *s) {
  * One of the problems is that parsing the "  " is not robust
  * The output of sgfinfo was not designed to be automatically parsed
  */
-#include "xmalloc.h"
 static void do_reference(char *ref_file, int argc, char **argv) {
 	char cmd[1000], *p, *a, *q, *r, *s, *t;
 	char buf[10000];
@@ -1332,6 +1761,11 @@ main(int argc, char **argv) {
 	infilename = "(reading options)";
 	seloptct = infooptct = 0;
 
+#ifdef READ_FROM_DB
+	if (argc > 1 && !strncmp(argv[1], "-serve=", 7))
+		return sgfdb_serve(argv[1]+7, argc-2, argv+2, main);
+#endif
+
 	/* Is there a reference file? Then we must not look yet at
 	   the other options, since they will be modified. */
 	for (i = 1; i < argc; i++) {
@@ -1378,6 +1812,12 @@ main(int argc, char **argv) {
 			report_bcapt();
 			goto next;
 		}
+		if (!strncmp(argv[1], "-Bcapt", 6)) {
+			needplay = 1;
+			setminmax(argv[1]+6, &bcaptct, "captures");
+			seloptct++;
+			goto next;
+		}
 		if (!strncmp(argv[1], "-Bp", 3)) {
 			setplayrestrictions(argv[1]+3, BLACK_MASK);
 			seloptct++;
@@ -1391,6 +1831,10 @@ main(int argc, char **argv) {
 			optb = 0;
 			goto next;
 		}
+		if (!strncmp(argv[1], "-can64", 6)) {
+			set_string("can64: %s\n", argv[1]+6, get_can64_string);
+			goto next;
+		}
 		if (!strncmp(argv[1], "-canx", 5)) {
 			set_string("canx: %s\n", argv[1]+5, get_canx_string);
 			goto next;
@@ -1445,6 +1889,18 @@ main(int argc, char **argv) {
 			set_stringfn("%s:  %s\n", argv[1]+3, get_nDyer_sign);
 			goto next;
 		}
+		if (!strcmp(argv[1], "-dup")) {
+			optdup = 1;
+			seloptct++;
+			goto next;
+		}
+#ifdef READ_FROM_DB
+		if (!strncmp(argv[1], "-date=", 6)) {
+			optdate = argv[1]+6;
+			seloptct++;
+			goto next;
+		}
+#endif
 		if (!strncmp(argv[1], "-e", 2)) {
 			file_extension = argv[1]+2;
 			goto next;
@@ -1469,6 +1925,11 @@ main(int argc, char **argv) {
 			goto next;
 		}
 #endif
+		if (!strncmp(argv[1], "-hash64", 7)) {
+			set_string("hash64: %s\n", argv[1]+7,
+				   get_hash64_string);
+			goto next;
+		}
 		if (!strcmp(argv[1], "-help") || !strcmp(argv[1], "--help") ||
 			!strcmp(argv[1], "-?")) {
 			usage();
@@ -1500,6 +1961,20 @@ main(int argc, char **argv) {
 			ignore_errors = 1;
 			goto next;
 		}
+		if (!strncmp(argv[1], "-j", 2) &&
+		    optional_num(argv[1]+2)) {
+			if (argv[1][2])
+				nprocs = atoi(argv[1]+2);
+			else {
+				if (argc == 2)
+					errexit("-j needs following number");
+				nprocs = atoi(argv[2]);
+				argc--; argv++;
+			}
+			if (nprocs < 1)
+				errexit("-j needs a positive number");
+			goto next;
+		}
 		if (!strncmp(argv[1], "-M", 2)) {
 			handle_M_option(argv[1]+2);
 			goto next;
@@ -1541,14 +2016,28 @@ main(int argc, char **argv) {
 			goto next;
 		}
 #endif
-		if (!strncmp(argv[1], "-P", 2) && optional_num(argv[1]+2)) {
+		if (!strncmp(argv[1], "-P", 2) && optional_numlist(argv[1]+2)) {
 			/* output the position at the end or after m moves */
+			char *s = argv[1]+2;
+
 			needplay = 1;
 			optP = 1;
-			optPmvct = (argv[1][2] ? atoi(argv[1]+2) : -1);
+			optPct = 0;
+			do {
+				if (optPct == MAXPOSREQ)
+					errexit("too many positions for -P");
+				optPmvct[optPct++] = (*s ? atoi(s) : -1);
+				s = strchr(s, ',');
+			} while (s++);
 			infooptct++;
 			goto next;
 		}
+		if (!strncmp(argv[1], "-pos=", 5)) {
+			readposfile(argv[1]+5);
+			optpos = 1;
+			seloptct++;
+			goto next;
+		}
 		if (!strncmp(argv[1], "-pat=", 5)) {
 			needplay = 1;
 			readpatternfile(argv[1]+5);
@@ -1597,6 +2086,16 @@ main(int argc, char **argv) {
 			goto next;
 		}
 #endif
+		if (!strncmp(argv[1], "-same=", 6)) {
+			char *e;
+
+			samehash = strtoull(argv[1]+6, &e, 16);
+			if (e == argv[1]+6 || *e)
+				errexit("-same= needs a hexadecimal hash");
+			optsame = 1;
+			seloptct++;
+			goto next;
+		}
 		if (!strcmp(argv[1], "-s")) {
 			opts = 1;
 			infooptct++;
@@ -1639,6 +2138,12 @@ main(int argc, char **argv) {
 			report_wcapt();
 			goto next;
 		}
+		if (!strncmp(argv[1], "-Wcapt", 6)) {
+			needplay = 1;
+			setminmax(argv[1]+6, &wcaptct, "captures");
+			seloptct++;
+			goto next;
+		}
 		if (!strncmp(argv[1], "-Wp", 3)) {
 			setplayrestrictions(argv[1]+3, WHITE_MASK);
 			seloptct++;
@@ -1649,6 +2154,13 @@ main(int argc, char **argv) {
 			set_string("winner: %s\n", argv[1]+7, get_winner);
 			goto next;
 		}
+#endif
+#ifdef READ_FROM_DB
+		if (!strncmp(argv[1], "-who=", 5)) {
+			optwho = argv[1]+5;
+			seloptct++;
+			goto next;
+		}
 #endif
 		if (!strcmp(argv[1], "-x")) {
 			optx = 1;
@@ -1718,6 +2230,7 @@ main(int argc, char **argv) {
 	}
 
 	init_pattern();
+	init_position();
 
 	argct = argc-1;
 
@@ -1728,6 +2241,11 @@ main(int argc, char **argv) {
 		goto done;
 	}
 
+	if (nprocs > 1 && !db && !optdup) {
+		do_infiles_parallel(argc, argv);
+		goto done;
+	}
+
 	while (argc > 1) {
 		infilename = argv[1];
 		do_infile(argv[1]);
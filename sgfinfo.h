@@ -1,6 +1,10 @@
 extern int size, gamenr, movect, initct, handct, argct, number_of_games;
-extern int moves[], extmoves[], mvct, extmvct;
+extern int moves[], mvct, extmvct;
+extern short int extmoves[];
 extern int reportedfn, bcaptct, wcaptct;
+extern int opttrunc;
+extern int nprocs, okgames, optdup, dupselected, sameselected;
+extern char *optwho, *optdate;
 
 extern void report_on_single_game();
 
@@ -15,6 +15,7 @@
 #include "errexit.h"
 #include "xmalloc.h"
 #include "readsgf.h"
+#include "sgfprop.h"
 
 FILE *outf;
 
@@ -338,11 +339,15 @@ remove_comments(char *fn, struct gametree *g) {
 	}
 }
 
+static struct sgf_parser *parser;
+
 static void
 prepare_merge(char *fn, struct gametree **g) {
 	int n;
 
-	readsgf(fn, g);
+	if (parser == NULL)
+		parser = sgf_parser_new(sgf_default_flags());
+	sgf_readsgf(parser, fn, g);
 
 	n = number_of_games(*g);
 	if (n != 1)
@@ -411,6 +416,7 @@ append_gamecomments(struct gametree *g) {
 	pv->next = NULL;
 	gc = xmalloc(sizeof(struct property));
 	gc->id = strdup("GC");
+	gc->tag = PROP_GC;
 	gc->val = pv;
 	gc->next = NULL;
 	node = g->nodesequence;
@@ -0,0 +1,26 @@
+/*
+ * sgfprop.c - map property ids to tags and back
+ */
+#include "sgfprop.h"
+
+char *sgfprop_name[PROP_COUNT] = {
+	"",
+#define P(id,a,b)	#id,
+	SGF_PROPERTIES
+#undef P
+};
+
+#define ID(a,b)	(((a) << 8) | (b))
+
+int
+sgfprop_tag(const char *id) {
+	if (id[0] == 0 || (id[1] && id[2]))
+		return PROP_UNKNOWN;
+
+	switch (ID(id[0], id[1])) {
+#define P(id,a,b)	case ID(a,b): return PROP_##id;
+	SGF_PROPERTIES
+#undef P
+	}
+	return PROP_UNKNOWN;
+}
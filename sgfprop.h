@@ -0,0 +1,46 @@
+/*
+ * The FF[4] properties, as small integers.
+ * The parser puts one of these in the tag field of struct property;
+ * ids not in this list get PROP_UNKNOWN.
+ */
+#define SGF_PROPERTIES \
+	/* move */ \
+	P(B,'B',0) P(KO,'K','O') P(MN,'M','N') P(W,'W',0) \
+	/* setup */ \
+	P(AB,'A','B') P(AE,'A','E') P(AW,'A','W') P(PL,'P','L') \
+	/* node annotation */ \
+	P(C,'C',0) P(DM,'D','M') P(GB,'G','B') P(GW,'G','W') \
+	P(HO,'H','O') P(N,'N',0) P(UC,'U','C') P(V,'V',0) \
+	/* move annotation */ \
+	P(BM,'B','M') P(DO,'D','O') P(IT,'I','T') P(TE,'T','E') \
+	/* markup */ \
+	P(AR,'A','R') P(CR,'C','R') P(DD,'D','D') P(LB,'L','B') \
+	P(LN,'L','N') P(MA,'M','A') P(SL,'S','L') P(SQ,'S','Q') \
+	P(TR,'T','R') \
+	/* root */ \
+	P(AP,'A','P') P(CA,'C','A') P(FF,'F','F') P(GM,'G','M') \
+	P(ST,'S','T') P(SZ,'S','Z') \
+	/* game info */ \
+	P(AN,'A','N') P(BR,'B','R') P(BT,'B','T') P(CP,'C','P') \
+	P(DT,'D','T') P(EV,'E','V') P(GN,'G','N') P(GC,'G','C') \
+	P(ON,'O','N') P(OT,'O','T') P(PB,'P','B') P(PC,'P','C') \
+	P(PW,'P','W') P(RE,'R','E') P(RO,'R','O') P(RU,'R','U') \
+	P(SO,'S','O') P(TM,'T','M') P(US,'U','S') P(WR,'W','R') \
+	P(WT,'W','T') \
+	/* timing */ \
+	P(BL,'B','L') P(OB,'O','B') P(OW,'O','W') P(WL,'W','L') \
+	/* miscellaneous */ \
+	P(FG,'F','G') P(PM,'P','M') P(VW,'V','W') \
+	/* go */ \
+	P(HA,'H','A') P(KM,'K','M') P(TB,'T','B') P(TW,'T','W')
+
+enum sgfprop {
+	PROP_UNKNOWN = 0,
+#define P(id,a,b)	PROP_##id,
+	SGF_PROPERTIES
+#undef P
+	PROP_COUNT
+};
+
+extern char *sgfprop_name[PROP_COUNT];
+extern int sgfprop_tag(const char *id);
@@ -0,0 +1,170 @@
+/*
+ * sgfscan.c - fast scanning of property values for readsgf.c
+ *
+ * sgf_scan_value(p, end): first ']' or '\\' in [p,end), or end
+ * sgf_count_nl(p, end): number of '\n' in [p,end)
+ *
+ * Both are picked at startup: AVX2 or SSE2 when the CPU has them,
+ * otherwise a portable version that looks at 8 bytes at a time.
+ * The environment variable SGFSCAN=avx2, sse2 or word forces a choice.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sgfscan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_X86
+#include <immintrin.h>
+#endif
+
+/* portable: eight bytes at a time */
+
+#define ONES	0x0101010101010101ULL
+#define HIGHS	0x8080808080808080ULL
+
+/* high bit set in each byte of v that is zero (exact, no false hits) */
+static inline uint64_t
+zerobytes(uint64_t v) {
+	return ~(((v & ~HIGHS) + ~HIGHS) | v | ~HIGHS);
+}
+
+static inline uint64_t
+load64(const unsigned char *p) {
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static const unsigned char *
+scan_value_word(const unsigned char *p, const unsigned char *end) {
+	uint64_t v, m;
+
+	while (end - p >= 8) {
+		v = load64(p);
+		m = zerobytes(v ^ (ONES * ']')) | zerobytes(v ^ (ONES * '\\'));
+		if (m) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return p + __builtin_ctzll(m) / 8;
+#else
+			return p + __builtin_clzll(m) / 8;
+#endif
+		}
+		p += 8;
+	}
+	while (p < end && *p != ']' && *p != '\\')
+		p++;
+	return p;
+}
+
+static int
+count_nl_word(const unsigned char *p, const unsigned char *end) {
+	int n = 0;
+
+	while (end - p >= 8) {
+		n += __builtin_popcountll(zerobytes(load64(p) ^ (ONES * '\n')));
+		p += 8;
+	}
+	while (p < end)
+		n += (*p++ == '\n');
+	return n;
+}
+
+#ifdef HAVE_X86
+
+__attribute__ ((target("sse2")))
+static const unsigned char *
+scan_value_sse2(const unsigned char *p, const unsigned char *end) {
+	const __m128i sq = _mm_set1_epi8(']'), bs = _mm_set1_epi8('\\');
+	__m128i v;
+	int m;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *) p);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, sq),
+						   _mm_cmpeq_epi8(v, bs)));
+		if (m)
+			return p + __builtin_ctz(m);
+		p += 16;
+	}
+	return scan_value_word(p, end);
+}
+
+__attribute__ ((target("sse2")))
+static int
+count_nl_sse2(const unsigned char *p, const unsigned char *end) {
+	const __m128i nl = _mm_set1_epi8('\n');
+	__m128i v;
+	int n = 0;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *) p);
+		n += __builtin_popcount(_mm_movemask_epi8(
+						_mm_cmpeq_epi8(v, nl)));
+		p += 16;
+	}
+	return n + count_nl_word(p, end);
+}
+
+__attribute__ ((target("avx2")))
+static const unsigned char *
+scan_value_avx2(const unsigned char *p, const unsigned char *end) {
+	const __m256i sq = _mm256_set1_epi8(']'), bs = _mm256_set1_epi8('\\');
+	__m256i v;
+	unsigned int m;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *) p);
+		m = _mm256_movemask_epi8(_mm256_or_si256(
+					_mm256_cmpeq_epi8(v, sq),
+					_mm256_cmpeq_epi8(v, bs)));
+		if (m)
+			return p + __builtin_ctz(m);
+		p += 32;
+	}
+	return scan_value_sse2(p, end);
+}
+
+__attribute__ ((target("avx2")))
+static int
+count_nl_avx2(const unsigned char *p, const unsigned char *end) {
+	const __m256i nl = _mm256_set1_epi8('\n');
+	__m256i v;
+	int n = 0;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *) p);
+		n += __builtin_popcount(_mm256_movemask_epi8(
+						_mm256_cmpeq_epi8(v, nl)));
+		p += 32;
+	}
+	return n + count_nl_sse2(p, end);
+}
+
+#endif
+
+const unsigned char *(*sgf_scan_value)(const unsigned char *p,
+				       const unsigned char *end) =
+	scan_value_word;
+int (*sgf_count_nl)(const unsigned char *p, const unsigned char *end) =
+	count_nl_word;
+
+__attribute__ ((constructor))
+static void
+sgfscan_init(void) {
+	const char *s = getenv("SGFSCAN");
+
+	if (s && !strcmp(s, "word"))
+		return;
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && !(s && !strcmp(s, "sse2"))) {
+		sgf_scan_value = scan_value_avx2;
+		sgf_count_nl = count_nl_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		sgf_scan_value = scan_value_sse2;
+		sgf_count_nl = count_nl_sse2;
+	}
+#endif
+}
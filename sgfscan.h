@@ -0,0 +1,4 @@
+/* vectorized scanning of property values, chosen at startup */
+extern const unsigned char *(*sgf_scan_value)(const unsigned char *p,
+					      const unsigned char *end);
+extern int (*sgf_count_nl)(const unsigned char *p, const unsigned char *end);
@@ -299,14 +299,8 @@ main(int argc, char **argv){
 
 	outf = stdout;
 
-	if (infile) {
-		FILE *f = freopen(infile, "r", stdin);
-		if (!f)
-			errexit("cannot open %s", infile);
-	}
-
 	eof = 0;
-	readsgf(NULL, &g);
+	sgf_readsgf(sgf_parser_new(sgf_default_flags()), infile, &g);
 	gtlevel = 0;
 	strip_gametree_sequence(g);
 	writesgf(g,stdout);
@@ -25,6 +25,7 @@
 #include <string.h>
 #include "errexit.h"
 #include "readsgf.h"
+#include "sgfprop.h"
 #include "ftw.h"
 
 FILE *outf;
@@ -135,6 +136,7 @@ color_transform(struct property *p) {
 	for (i=0; i<SIZE(coltf); i++) {
 		if (!strcmp(p->id, coltf[i])) {
 			p->id = coltf[i^1];
+			p->tag = sgfprop_tag(p->id);
 			break;
 		}
 	}
@@ -337,6 +339,8 @@ put_gametree_sequence(struct gametree *g) {
 	}
 }
 
+static struct sgf_parser *parser;
+
 static void
 do_stdin(const char *fn) {
 	struct gametree *g;
@@ -345,7 +349,9 @@ do_stdin(const char *fn) {
 		goto ret;
 	have_jmpbuf = 1;
 
-	readsgf(fn, &g);
+	if (parser == NULL)
+		parser = sgf_parser_new(sgf_default_flags());
+	sgf_readsgf(parser, fn, &g);
 
 	gtlevel = 0;
 	put_gametree_sequence(g);
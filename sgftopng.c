@@ -6,6 +6,8 @@
  *
  * OUTFILE must be something with an extension that convert can handle,
  * such as .png, .jpg, .gif. The default is "out.png".
+ * A .png is drawn in memory and written directly (see raster.c);
+ * other formats, or -convert, use convert from ImageMagick.
  *
  * A [FROM]-[TO] range will create unnumbered stones for the stones
  * that were still alive when move number FROM was done, and numbered
@@ -17,11 +19,25 @@
  *
  * Options:
  *  -info : list variants occurring in input file, do not create a diagram
- *  -var 3 : create a diagram of variant 3
+ *  -var 3 : create a diagram of variant 3 (numbered as by sgfx -v)
  *  -game 2 : create a diagram of the 2nd game in the sgf file
  *  -from 1 : number the numbered stones from 1
  *  -o outfile : alternative way to specify OUTFILE
+ *  -convert : use convert also for .png
+ *  -batch SRCDIR DSTDIR : for each SRCDIR/name.sgf make DSTDIR/name.png
+ *     (as sgfutils.sh does for one file); SRCDIR - reads the names
+ *     of the input files from stdin
+ *  -j N : with -batch, make the diagrams on N threads
+ *  -sequence : one diagram per move, OUTFILE-NNN.png for move NNN
+ *     (only moves FROM-TO, if given)
+ *  -animate : one animated PNG with a frame per move
+ *  -delay N : with -animate, N/100 seconds per frame (default 50)
  * See also usage().
+ *
+ * The input is read by the parser in readsgf.c, and the captures
+ * are found by playgogame(). Rectangular boards, and games with an
+ * illegal move, are put on the board as they come, removing groups
+ * without liberties.
  */
 
 /*
@@ -37,20 +53,16 @@
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>	/* for unlink */
-
-extern void errexit(const char *s, ...) __attribute__ ((noreturn));
-
-/* fatal error */
-void errexit(const char *s, ...) {
-	va_list p;
-
-	va_start(p, s);
-	vfprintf(stderr, s, p);
-	va_end(p);
-
-	fprintf(stderr, "\n");
-	exit(-1);
-}
+#include <sys/stat.h>
+#include <pthread.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "ftw.h"
+#include "workq.h"
+#include "raster.h"
+#include "readsgf.h"
+#include "sgfprop.h"
+#include "playgogame.h"
 
 static void outwarn(const char *s, ...) {
 	va_list p;
@@ -60,21 +72,6 @@ static void outwarn(const char *s, ...) {
 	va_end(p);
 }
 
-/* error-free malloc, realloc */
-static void *xmalloc(size_t sz) {
-	void *p = malloc(sz);
-	if (p == NULL)
-		errexit("out of memory");
-	return p;
-}
-
-static void *xrealloc(void *pp, size_t sz) {
-	void *p = realloc(pp, sz);
-	if (p == NULL)
-		errexit("out of memory");
-	return p;
-}
-
 /* quote a string before feeding it to sh */
 static char *quoted(char *s) {
 	int n = strlen(s);
@@ -95,60 +92,13 @@ static char *quoted(char *s) {
 	return r;
 }
 
-char *inbuf;
-int inbufsz;
-
-static void enlarge_inbuf() {
-	int sz = (inbufsz ? 4*inbufsz : 100000);
-
-	inbufsz = sz;
-	inbuf = xrealloc(inbuf, sz);
-}
-
-/* read entire input file into memory - might use mmap if not stdin */
-static void readinput() {
-	char *p;
-	int n;
-
-	enlarge_inbuf();
-	p = inbuf;
-	while (fgets(p, inbufsz - (p-inbuf), stdin)) {
-		n = strlen(p);
-		p += n;
-		if (inbufsz - (p-inbuf) < 100) {
-			enlarge_inbuf();
-			p = inbuf;
-			n = strlen(p);
-			p += n;
-		}
-	}
-}
-
-/* remove whitespace from input */
-static void remove_whitespace() {
-	char *p, *q;
-
-	p = q = inbuf;
-	while (*p) {
-		if (*p != ' ' && *p != '\r' && *p != '\n')
-			*q++ = *p;
-		p++;
-	}
-	*q = 0;
-}
-
-/* add closing parenthesis if needed and there is room */
-static char *add_paren() {
-	char *p;
-
-	p = inbuf;
-	while (*p++);
-	if (p - inbuf >= inbufsz)
-		errexit("no room to add a parenthesis");
-	*p = 0;
-	*--p = ')';
-	return p;
-}
+/*
+ * With -batch several diagrams are made at the same time, so the
+ * state of a diagram is per thread; the options are shared.
+ */
+__thread struct sgf_parser *parser;
+__thread struct pg_engine *engine;
+__thread int useengine;		/* else the board flood fill below */
 
 /*
  * Coordinates: the origin is the upper left hand corner.
@@ -165,23 +115,23 @@ static char *add_paren() {
 /* cannot be larger than the max length of a shell command */
 #define CBUFSZ 361000
 
-char command[CBUFSZ];
+__thread char command[CBUFSZ];
 
 /* max board size */
 #define SZ 19
 
-char board[SZ][SZ];
-int boardnumber[SZ][SZ];
-char *boardlabel[SZ][SZ];
+__thread char board[SZ][SZ];
+__thread int boardnumber[SZ][SZ];
+__thread char *boardlabel[SZ][SZ];
 
-/* max game length */
-#define MAXMOVES (2*SZ*SZ)
+/* moves and setup stones in the current variation, for playgogame() */
+__thread int *moves, mvct, mvmax;
+__thread int initct;		/* the number of setup stones before the moves */
+__thread struct played_game pg;
+__thread int mvi;		/* the next entry of pg.mv[] to put on the board */
 
-/* moves in current variation */
-int moves[MAXMOVES];
-
-/* current game, variation, move */
-int gamenr, varnr, movenr;
+/* the current move */
+__thread int movenr;
 
 /* idem to display */
 int displaygame, displayvar, displayfrom, displayto;
@@ -198,83 +148,37 @@ char *optcircle = 0;		/* later: circle these stones */
 #define COORDMARGIN	20
 #define MARGINSHIFT	5	/* additional space if coord, not edge */
 
-int bdheight;
-int bdwidth;
 int rowspacing = RSP;
 int colspacing = CSP;
-int leftmargin, rightmargin, topmargin, bottommargin;
-int leftcoordmargin, rightcoordmargin, topcoordmargin, bottomcoordmargin;
-int leftxcoordmargin, rightxcoordmargin, topxcoordmargin, bottomxcoordmargin;
-int coordleft, coordright, coordtop, coordbottom;
 char *bgcolor = BOARDCOLOR;
-int pointsize;
-int rows, cols;
-int topedge, botedge, leftedge, rightedge;
-int xmin, xmax, ymin, ymax;
-
-static int lookat(int x, int y, int c, int *groupctp, int *group, int *seen) {
-	int z;
-
-	if (x < 0 || y < 0 || x >= cols || y >= rows)
-		return 0;
-	if (board[x][y] == 0)
-		return 1;
-	if (board[x][y] == c) {
-		z = SZ*x+y;
-		if (!seen[z]) {
-			group[(*groupctp)++] = z;
-			seen[z] = 1;
-		}
-	}
-	return 0;
-}
-
-static void possibly_remove(int x, int y) {
-	int groupct, group[SZ*SZ], seen[SZ*SZ], done, h, i, j, k;
-	int c = board[x][y];
-
-	for (i=0; i<SZ*SZ; i++)
-		seen[i] = 0;
-	done = 0;
-	groupct = 1;
-	h = SZ*x+y;
-	group[0] = h;
-	seen[h] = 1;
-
-	while (done < groupct) {
-		h = group[done++];
-		i = h/SZ;
-		j = h%SZ;
-		if (lookat(i-1,j,c,&groupct,group,seen) ||
-		    lookat(i+1,j,c,&groupct,group,seen) ||
-		    lookat(i,j-1,c,&groupct,group,seen) ||
-		    lookat(i,j+1,c,&groupct,group,seen))
-			return;
-	}
-
-	for (k=0; k<groupct; k++) {
-		h = group[k];
-		i = h/SZ;
-		j = h%SZ;
-		board[i][j] = 0;
-		boardnumber[i][j] = 0;
-	}
-}
 
-/* remove what is killed by (x,y), then perhaps (x,y) itself */
-static void remove_dead_groups(int x, int y) {
-	int c = board[x][y];	/* our color */
-	int oc = ('X'+'O'-c);	/* the other color */
-	if (x > 0 && board[x-1][y] == oc)
-		possibly_remove(x-1,y);
-	if (x < cols-1 && board[x+1][y] == oc)
-		possibly_remove(x+1,y);
-	if (y > 0 && board[x][y-1] == oc)
-		possibly_remove(x,y-1);
-	if (y < rows-1 && board[x][y+1] == oc)
-		possibly_remove(x,y+1);
-	possibly_remove(x,y);
-}
+/* options, set by main() */
+char *optview, *optfont, *optcoord;
+int optdebug, optconvert, optinfo;
+int maxcommandlinelength;	/* use temporary files when limited */
+int optsequence;		/* SEQ_FILES or SEQ_ANIM */
+int seqfrom, seqto;		/* the FROM-TO range with -sequence */
+int optdelay = 50;
+
+#define SEQ_FILES	1
+#define SEQ_ANIM	2
+
+__thread int bdheight;
+__thread int bdwidth;
+__thread int leftmargin, rightmargin, topmargin, bottommargin;
+__thread int leftcoordmargin, rightcoordmargin, topcoordmargin,
+	bottomcoordmargin;
+__thread int leftxcoordmargin, rightxcoordmargin, topxcoordmargin,
+	bottomxcoordmargin;
+__thread int coordleft, coordright, coordtop, coordbottom;
+__thread int pointsize;
+__thread int rows, cols;
+__thread int topedge, botedge, leftedge, rightedge;
+__thread int xmin, xmax, ymin, ymax;
+
+/* the image when drawing in memory, NULL when building a command */
+__thread struct raster *rp;
+__thread int fillcolor, strokecolor;
 
 static inline int toint(char c) {
 	return c - 'a';
@@ -296,60 +200,23 @@ static int toy(char c) {
 	return n;
 }
 
-static int is_cap_letter(int c) {
-	return c >= 'A' && c <= 'Z';
-}
-
-static void skiparg(char **pp) {
-	char *p = *pp;
-
-	if (*p != '[')
-		errexit("program bug: arg does not start with [");
-	while (*p && *p != ']') {
-		if (*p == '\\' && *p)	/* what with \\[ ? */
-			p++;
-		p++;
-	}
-	if (*p == 0)
-		errexit("unterminated arg");
-	p++;
-	*pp = p;
-}
-
-static void skipargs(char **pp) {
-	while (**pp == '[')
-		skiparg(pp);
-}
-
-static void skipproperty(char **pp) {
-	if (!is_cap_letter(**pp))
-		errexit("unrecognized syntax %s", *pp);
-	while (is_cap_letter(**pp))
-		(*pp)++;
-	if (**pp != '[' && **pp != ';' && **pp != '(' && **pp != ')')
-		errexit("unrecognized syntax %s", *pp);
-	skipargs(pp);
-}
+#define BUFSZ 256
 
-/* called with *p pointing at ( */
-static char *matching_paren(char *p) {
-	int ct = 0;
+/* the value, without whitespace (that sgf allows almost anywhere) */
+static char *getval(struct propvalue *pv, char *buf) {
+	char *p, *q;
 
-	while (*p) {
-		if (*p == '[') {
-			skiparg(&p);
-			continue;
-		}
-		if (*p == '(')
-			ct++;
-		if (*p == ')')
-			ct--;
-		if (ct == 0)
-			return p;
+	if (pv == NULL)
+		errexit("missing property value");
+	p = pv->val;
+	q = buf;
+	while (*p && q < buf + BUFSZ - 1) {
+		if (*p != ' ' && *p != '\r' && *p != '\n')
+			*q++ = *p;
 		p++;
 	}
-	outwarn("no matching parenthesis - adding one at the end\n");
-	return add_paren();
+	*q = 0;
+	return buf;
 }
 
 static void setrows(int r) {
@@ -365,22 +232,20 @@ static void setcols(int c) {
 }
 
 /* SZ[size] or SZ[cols:rows] */
-static void setsize(char **pp) {
+static void setsize(struct property *p) {
+	char buf[BUFSZ], *end;
 	int r, c;
-	char *end;
 
-	c = strtoul(*pp + 1, &end, 10);
-	if (*end == ']')
-		r = c;
-	else if (*end == ':')
+	c = strtoul(getval(p->val, buf), &end, 10);
+	r = c;
+	if (*end == ':')
 		r = strtoul(end + 1, &end, 10);
-	if (*end != ']')
+	if (*end)
 		errexit("trailing junk in SZ property");
 	if (c < 1 || c > SZ || r < 1 || r > SZ)
-		errexit("bad size %d x %d", rows, cols);
+		errexit("bad size %d x %d", r, c);
 	setrows(r);
 	setcols(c);
-	skiparg(pp);
 }
 
 /* select view on board */
@@ -398,28 +263,26 @@ static void setxyminmax(int x1, int x2, int y1, int y2) {
 }
 
 /* VW[an:ms] - show bottom left 13x6 corner */
-static void setvisualpart(char **pp) {
+static void setvisualpart(struct property *p) {
+	char buf[BUFSZ], *v;
 	int x1,y1,x2,y2;
-	char *p = *pp;
 
 	/* the standard allows arbitrary shapes -
 	   we only do a single rectangle */
-	if (p[1] == ']') {
-		skipargs(pp);
+	v = getval(p->val, buf);
+	if (*v == 0) {
 		outwarn("empty VW node - ignored\n");
 		return;
 	}
-	if (p[3] != ':' || p[6] != ']') {
-		skipargs(pp);
+	if (strlen(v) != 5 || v[2] != ':' || p->val->next) {
 		outwarn("unsupported VW node - ignored\n");
 		return;
 	}
-	x1 = tox(p[1]);
-	y1 = toy(p[2]);
-	x2 = tox(p[4]);
-	y2 = toy(p[5]);
+	x1 = tox(v[0]);
+	y1 = toy(v[1]);
+	x2 = tox(v[3]);
+	y2 = toy(v[4]);
 	setxyminmax(x1, x2, y1, y2);
-	skiparg(pp);
 }
 
 static void
@@ -494,239 +357,350 @@ usage:
 	errexit("usage: sgftopng -view rowmin-rowmax,colmin-colmax ...");
 }
 
-#if 0
-static void add1stone(char **pp, char c) {
-	char *p = *pp;
+static void addlabels(struct property *p) {
+	struct propvalue *pv;
+	char *v;
 
-	if (p[3] != ']')
-		errexit("add1stone: no ]");
-	board[tox(p[1])][toy(p[2])] = c;
-	skiparg(pp);
+	for (pv = p->val; pv; pv = pv->next) {
+		v = pv->val;
+		if (strlen(v) < 4 || v[2] != ':')
+			errexit("LB: not xy:A");
+		free(boardlabel[tox(v[0])][toy(v[1])]);
+		boardlabel[tox(v[0])][toy(v[1])] = strdup(v+3);
+	}
 }
-#endif
 
-static void add1label(char **pp) {
-	char *p, *q;
+static int lookat(int x, int y, int c, int *groupctp, int *group, int *seen) {
+	int z;
 
-	q = p = *pp;
-	while (*q && *q != ']')
-		q++;		/* perhaps skiparg? */
-	if (q-p < 5 || p[3] != ':' || *q != ']')
-		errexit("add1label: not xy:A]");
-	boardlabel[tox(p[1])][toy(p[2])] = strndup(p+4, q-p-4);
-	skiparg(pp);
+	if (x < 0 || y < 0 || x >= cols || y >= rows)
+		return 0;
+	if (board[x][y] == 0)
+		return 1;
+	if (board[x][y] == c) {
+		z = SZ*x+y;
+		if (!seen[z]) {
+			group[(*groupctp)++] = z;
+			seen[z] = 1;
+		}
+	}
+	return 0;
 }
 
-static void addlabel(char **pp) {
-	while (**pp == '[')
-		add1label(pp);
-}
+static void possibly_remove(int x, int y) {
+	int groupct, group[SZ*SZ], seen[SZ*SZ], done, h, i, j, k;
+	int c = board[x][y];
 
-static void addrange(char **pp, char c) {
-	char *s, *t;
-	char x, y;
+	for (i=0; i<SZ*SZ; i++)
+		seen[i] = 0;
+	done = 0;
+	groupct = 1;
+	h = SZ*x+y;
+	group[0] = h;
+	seen[h] = 1;
 
-	s = *pp;
-	if (s[3] == ']')
-		t = s;
-	else if (s[3] == ':' && s[6] == ']')
-		t = s+3;
-	else
-		errexit("addrange: unrecognized range %s");
-	for (x=s[1]; x<=t[1]; x++)
-		for (y=s[2]; y<=t[2]; y++)
-			board[tox(x)][toy(y)] = c;
-	skiparg(pp);
-}
+	while (done < groupct) {
+		h = group[done++];
+		i = h/SZ;
+		j = h%SZ;
+		if (lookat(i-1,j,c,&groupct,group,seen) ||
+		    lookat(i+1,j,c,&groupct,group,seen) ||
+		    lookat(i,j-1,c,&groupct,group,seen) ||
+		    lookat(i,j+1,c,&groupct,group,seen))
+			return;
+	}
 
-/* e.g. AB[bp:cp][br][ch] */
-static void addstones(char **pp, char c) {
-	while (**pp == '[')
-		addrange(pp, c);
+	for (k=0; k<groupct; k++) {
+		h = group[k];
+		i = h/SZ;
+		j = h%SZ;
+		board[i][j] = 0;
+		boardnumber[i][j] = 0;
+	}
 }
 
-static void addbstones(char **pp) {
-	addstones(pp, 'X');
+/* remove what is killed by (x,y), then perhaps (x,y) itself */
+static void remove_dead_groups(int x, int y) {
+	int c = board[x][y];	/* our color */
+	int oc = ('X'+'O'-c);	/* the other color */
+	if (x > 0 && board[x-1][y] == oc)
+		possibly_remove(x-1,y);
+	if (x < cols-1 && board[x+1][y] == oc)
+		possibly_remove(x+1,y);
+	if (y > 0 && board[x][y-1] == oc)
+		possibly_remove(x,y-1);
+	if (y < rows-1 && board[x][y+1] == oc)
+		possibly_remove(x,y+1);
+	possibly_remove(x,y);
 }
 
-static void addwstones(char **pp) {
-	addstones(pp, 'O');
+/*
+ * The game is read with the shared parser, and replayed by playgogame(),
+ * that finds the captures. The selected variation is gone through twice:
+ * first to collect the moves and setup stones (addmove()), and then to
+ * put them on the board (putstone()), each followed by its captures
+ * in pg.mv[]. When playgogame() cannot be used (useengine == 0),
+ * putstone() finds the captures with remove_dead_groups().
+ */
+static void addmove(int color, int x, int y) {
+	if (mvct == mvmax) {
+		mvmax = (mvmax ? 2*mvmax : 1024);
+		moves = xrealloc(moves, mvmax * sizeof(int));
+	}
+	moves[mvct++] = (color << 16) | (x << 8) | y;
 }
 
-static void playstone(char **pp, char c) {
-	char *p;
-	int x,y;
+/* color is 1 for black and 2 for white, as in playgogame.c;
+   x < 0 for a pass */
+static void putstone(int color, int ismove, int x, int y) {
+	int m;
 
-	movenr++;
-	p = *pp;
-	if (p[1] == ']' || !strncmp(p+1, "tt]", 3)) {
-		/* pass */
-		skiparg(pp);
+	if (!useengine) {
+		if (x < 0)
+			return;
+		board[x][y] = (color == 1) ? 'X' : 'O';
+		if (ismove && !boardnumber[x][y])
+			boardnumber[x][y] = movenr;
+		if (ismove && displayfrom && movenr < displayfrom)
+			remove_dead_groups(x, y);
 		return;
 	}
 
-	if (p[3] != ']')
-		errexit("playstone: no ]");
-	x = tox(p[1]);
-	y = toy(p[2]);
-	board[x][y] = c;
+	if (mvi >= pg.mvct)
+		errexit("program bug: pg.mv[] too short");
+	m = pg.mv[mvi++];
+	if (!(m & PG_PASS)) {
+		x = ((m & 0x3ff) >> 5) - 1;
+		y = (m & 0x1f) - 1;
+		board[x][y] = (color == 1) ? 'X' : 'O';
+
+		/* the number is the number of the first stone played there */
+		if (ismove && !boardnumber[x][y])
+			boardnumber[x][y] = movenr;
+	}
 
-	/* the number is the number of the first stone played there */
-	if (!boardnumber[x][y])
-		boardnumber[x][y] = movenr;
-	else {
-// make some interface for outputting ko moves
-//		printf("%d:%d\n", movenr, boardnumber[x][y]);
+	while (mvi < pg.mvct && (pg.mv[mvi] & PG_CAPTURE)) {
+		m = pg.mv[mvi++];
+		if (displayfrom && movenr < displayfrom) {
+			x = ((m & 0x3ff) >> 5) - 1;
+			y = (m & 0x1f) - 1;
+			board[x][y] = 0;
+			boardnumber[x][y] = 0;
+		}
 	}
+}
 
-	skiparg(pp);
+/* e.g. AB[bp:cp][br][ch] */
+static void addstones(struct property *p, int color, int phase) {
+	struct propvalue *pv;
+	char buf[BUFSZ], *s, *t;
+	char x, y;
 
-	if (displayfrom && movenr < displayfrom)
-		remove_dead_groups(x,y);
+	for (pv = p->val; pv; pv = pv->next) {
+		s = getval(pv, buf);
+		if (strlen(s) == 2)
+			t = s;
+		else if (strlen(s) == 5 && s[2] == ':')
+			t = s+3;
+		else
+			errexit("addrange: unrecognized range %s", s);
+		for (x=s[0]; x<=t[0]; x++)
+			for (y=s[1]; y<=t[1]; y++) {
+				tox(x);
+				toy(y);
+				if (phase == 1)
+					addmove(color, x, y);
+				else
+					putstone(color, 0, tox(x), toy(y));
+			}
+	}
 }
 
-static void playbstone(char **pp) {
-        playstone(pp, 'X');
-}
+static void playstone(struct property *p, int color, int phase) {
+	char buf[BUFSZ], *v;
 
-static void playwstone(char **pp) {
-        playstone(pp, 'O');
+	movenr++;
+	v = getval(p->val, buf);
+	if (*v == 0 || !strcmp(v, "tt")) {
+		/* pass */
+		v = "tt";
+	} else if (strlen(v) != 2)
+		errexit("playstone: not xy");
+	else {
+		tox(v[0]);
+		toy(v[1]);
+	}
+	if (phase == 1) {
+		if (initct < 0)
+			initct = mvct;
+		addmove(color, v[0], v[1]);
+	} else if (v[0] == 't')
+		putstone(color, 1, -1, -1);
+	else
+		putstone(color, 1, tox(v[0]), toy(v[1]));
 }
 
-#define SIZE(x)	(sizeof(x)/sizeof((x)[0]))
+static void seqframe(int final);
 
-struct property {
-	char *name;
-	int ismove;
-	void (*fn)(char **);
-} props[] = {
-	{ "B", 1, playbstone },
-	{ "W", 1, playwstone },
-	{ "AB", 0, addbstones },
-	{ "AW", 0, addwstones },
-	{ "LB", 0, addlabel },
-	{ "SZ", 0, setsize },
-	{ "VW", 0, setvisualpart },
-};
+/* the nodes of the selected variation */
+__thread struct node **path;
+__thread int pathct, pathmax;
 
-static void scansgf(char *begin, char *end) {
-	struct property *pr;
-	char *p, *q;
-	int n;
+static void scangame(int phase) {
+	struct property *p;
+	int i;
 
-	p = begin+1;
-	while (p < end && *p != ')') {
-		if (*p == ' ') {
-			p++;
-			continue;
-		}
-		if (*p == ';') {
-			p++;
-			continue;
-		}
-		if (*p == '(') {
-			q = matching_paren(p);
-			if (q[1] == '(')
-				p = q;	/* last variant only */
-			p++;
-			continue;
-		}
-		for (pr = props; pr < props+SIZE(props); pr++) {
-			n = strlen(pr->name);
-			if (!strncmp(p, pr->name, n) && p[n] == '[') {
-				p += n;
-				pr->fn(&p);
-				goto prdone;
+	movenr = 0;
+	for (i = 0; i < pathct; i++) {
+		if (phase == 2 && optsequence)
+			seqframe(0);	/* the previous node is done */
+		for (p = path[i]->p; p; p = p->next) {
+			switch (p->tag) {
+			case PROP_B:
+				playstone(p, 1, phase);
+				break;
+			case PROP_W:
+				playstone(p, 2, phase);
+				break;
+			case PROP_AB:
+				addstones(p, 1, phase);
+				break;
+			case PROP_AW:
+				addstones(p, 2, phase);
+				break;
+			case PROP_SZ:
+				setsize(p);
+				break;
+			case PROP_LB:
+				if (phase == 2)
+					addlabels(p);
+				break;
+			case PROP_VW:
+				if (phase == 2)
+					setvisualpart(p);
+				break;
 			}
-		}
-		/* ignore unknown properties */
-		skipproperty(&p);
-	prdone:;
 /*
  * Do we want to see the nonmoves after the final move?
  * At the start, yes, otherwise perhaps no.
  * Or we must introduce some syntax and make this selectable.
  */
-		if (movenr && displayto && movenr >= displayto-1)
-			return;
+			if (movenr && displayto && movenr >= displayto-1)
+				return;
+		}
 	}
 }
 
-static void wipe(char *begin, char *end) {
-	while (begin <= end)
-		*begin++ = ' ';
+/* a node with a move (as the first property) */
+static int is_move(struct node *n) {
+	return (n->p && (n->p->tag == PROP_B || n->p->tag == PROP_W));
 }
 
-/* scan the game, and remove the parts in nonselected variations */
-static void readsgfvar(char *begin, char *end, int *depth, int *depth0, int islast) {
-	char *p, *q;
-	int last;
+static int get_number_of_variations(struct gametree *g) {
+	int nv = 0;
 
-	if (displayvar && varnr > displayvar) {
-		wipe(begin, end);
-		return;
+	g = g->firstchild;
+	if (!g)
+		nv++;
+	else while (g) {
+		nv += get_number_of_variations(g);
+		g = g->nextsibling;
 	}
+	return nv;
+}
 
-	(*depth)++;
-	p = begin+1;
-	while (p < end) {
-		if (*p == '[') {	
-			skiparg(&p);
-			continue;
-		}
-		if (*p == '(') {
-			q = matching_paren(p);
-			last = (q[1] != '(');
-			readsgfvar(p, q, depth, depth0, last);
-			p = q;
-			if (displayvar && varnr == displayvar) {
-				wipe(p+1,end-1);
-				return;
-			}
+static void addpath(struct gametree *g) {
+	struct node *n;
+
+	for (n = g->nodesequence; n; n = n->next) {
+		if (pathct == pathmax) {
+			pathmax = (pathmax ? 2*pathmax : 1024);
+			path = xrealloc(path, pathmax * sizeof(*path));
 		}
-		p++;
+		path[pathct++] = n;
 	}
-	if ((*depth0) < (*depth))
-		varnr++;
-	(*depth)--;
-	*depth0 = *depth;
-
-	if ((displayvar && varnr < displayvar) || (!displayvar && !islast))
-		wipe(begin, end);
 }
 
-static void readsgfgame(char *begin, char *end) {
-	int depth, depth0;
-
-	varnr = depth = depth0 = 0;
-	readsgfvar(begin, end, &depth, &depth0,1);
-	scansgf(begin,end);
+/*
+ * The nodes of variation wanted_varnr (counting the leaves of the
+ * tree from 1, as sgfx -v does), or of the final one when 0
+ */
+static void get_variation(struct gametree *g, int wanted_varnr) {
+	struct gametree *gg;
+	int nv;
+
+	pathct = 0;
+	if (wanted_varnr > get_number_of_variations(g))
+		errexit("game %d has no variation %d",
+			displaygame, wanted_varnr);
+	while (1) {
+		addpath(g);
+		gg = g->firstchild;
+		if (gg == NULL)
+			return;
+		if (wanted_varnr == 0) {
+			while (gg->nextsibling)
+				gg = gg->nextsibling;
+		} else while (1) {
+			nv = get_number_of_variations(gg);
+			if (nv >= wanted_varnr)
+				break;
+			wanted_varnr -= nv;
+			gg = gg->nextsibling;
+		}
+		g = gg;
+	}
 }
 
-/* sometimes a file starts with BOM = U+FEFF, i.e., ef bb bf */
-char BOM[3] = "\xef\xbb\xbf";
+static struct gametree *readgames(FILE *f) {
+	struct gametree *g;
 
-static void readsgf() {
-	char *p, *q;
+	if (parser == NULL)
+		parser = sgf_parser_new(SGF_MULTIIN | SGF_QUIET);
+	sgf_parser_clear(parser);
+	if (sgf_parse_file(parser, f, infilename, &g) < 0)
+		sgf_parser_errexit(parser);
+	linenr = 0;
+	return g;
+}
 
-	readinput();
-	remove_whitespace();
-	gamenr = 0;
+static void read_game(FILE *f) {
+	struct gametree *g;
+	int n;
 
-	p = inbuf;
-	if (!strncmp(p, BOM, 3))
-		p += 3;
-	if (*p != '(')
-		errexit("sgf does not start with (");
-	while (*p) {
-		if (*p == '(') {
-			q = matching_paren(p);
-			if (++gamenr == displaygame)
-				readsgfgame(p,q);
-			p = q;
-		}
-		p++;
+	g = readgames(f);
+	for (n = 1; n < displaygame && g; n++)
+		g = g->nextsibling;
+	if (g == NULL)
+		errexit("there is no game %d", displaygame);
+	get_variation(g, displayvar);
+
+	mvct = 0;
+	initct = -1;
+	scangame(1);
+	if (initct < 0)
+		initct = mvct;
+	if (engine == NULL) {
+		engine = pg_new();
+		pg_set_quiet(engine, 1);
+		pg_set_lenient(engine, 1);
+	}
+	if (pg.mvlen < 2*mvct + 1) {
+		pg.mvlen = 2*mvct + 1;
+		free(pg.mv);
+		pg.mv = xmalloc(pg.mvlen * sizeof(short int));
 	}
+	/* the engine has square boards only */
+	useengine = 0;
+	if (rows == cols) {
+		playgogame_r(engine, rows, moves, mvct, initct, &pg);
+		useengine = (pg_illegal_move(engine) < 0);
+	}
+
+	setrows(SZ);
+	setcols(SZ);
+	mvi = 0;
+	scangame(2);
 }
 
 static inline int horx(int i) {
@@ -780,76 +754,126 @@ static int voffset(int w) {
 	return 5-w;
 }
 
+/* -fill and -stroke, or the colors for drawing in memory */
+static void setcolors(char **pp, char *fill, char *stroke) {
+	if (rp) {
+		fillcolor = raster_color(fill);
+		strokecolor = raster_color(stroke);
+		return;
+	}
+	*pp += sprintf(*pp, " -fill %s -stroke %s", fill, stroke);
+}
+
+/*
+ * Text: for convert at x,y (the left end of the baseline, see hoffset
+ * and voffset above), in memory centered at cx,cy.
+ */
+static void drawtext(char **pp, int x, int y, int cx, int cy, char *fmt, ...) {
+	va_list ap;
+	char txt[100];
+
+	va_start(ap, fmt);
+	vsnprintf(txt, sizeof(txt), fmt, ap);
+	va_end(ap);
+	if (rp) {
+		raster_text(rp, cx, cy, txt, pointsize, fillcolor);
+		return;
+	}
+	*pp += sprintf(*pp, " -draw \"text %d,%d '%s'\"", x, y, txt);
+}
+
 static void drawgrid(char **pp) {
 	int i,j,begin,end;
 
 	for (i=0; i<=ymax-ymin; i++) {
 		begin = (leftedge ? leftmargin : leftcoordmargin);
 		end = bdwidth - 1 - (rightedge ? rightmargin : rightcoordmargin);
+		if (rp) {
+			raster_line(rp, begin, verty(i), end, verty(i), 0);
+			continue;
+		}
 		*pp += sprintf(*pp, " -draw \"line %d,%d %d,%d\"",
 			       begin, verty(i), end, verty(i));
 	}
 	for (j=0; j<=xmax-xmin; j++) {
 		begin = (topedge ? topmargin : topcoordmargin);
 		end = bdheight - 1 - (botedge ? bottommargin : bottomcoordmargin);
+		if (rp) {
+			raster_line(rp, horx(j), begin, horx(j), end, 0);
+			continue;
+		}
 		*pp += sprintf(*pp, " -draw \"line %d,%d %d,%d\"",
 			       horx(j), begin, horx(j), end);
 	}
 }
 
 static void drawcoords(char **pp) {
-	int x, y;
+	int x, y, cx;
 
-	*pp += sprintf(*pp, " -fill black -stroke none");
+	setcolors(pp, "black", "none");
 	for (y = ymin; y <= ymax; y++) {
 		int v = rows-y;
-		if (coordleft)
-		*pp += sprintf(*pp, " -draw \"text %d,%d '%d'\"",
-			       (leftcoordmargin-leftxcoordmargin)/2 + 1 - hoffsetnum(v),
-			       verty(y-ymin)+voffset(0), v);
-		if (coordright)
-		*pp += sprintf(*pp, " -draw \"text %d,%d '%d'\"",
-			       bdwidth-(rightcoordmargin-rightxcoordmargin)/2 - 1 - hoffsetnum(v),
-			       verty(y-ymin)+voffset(0), v);
+		if (coordleft) {
+			cx = (leftcoordmargin-leftxcoordmargin)/2 + 1;
+			drawtext(pp, cx - hoffsetnum(v), verty(y-ymin)+voffset(0),
+				 cx, verty(y-ymin), "%d", v);
+		}
+		if (coordright) {
+			cx = bdwidth-(rightcoordmargin-rightxcoordmargin)/2 - 1;
+			drawtext(pp, cx - hoffsetnum(v), verty(y-ymin)+voffset(0),
+				 cx, verty(y-ymin), "%d", v);
+		}
 	}
 
 	for (x = xmin; x <= xmax; x++) {
 		char let;
+		int y0;
 
 		let = 'A' + x;
 		if (let >= 'I')
 			let++;
 
-		if (coordtop)
-		*pp += sprintf(*pp, " -draw \"text %d,%d '%c'\"",
-			       horx(x-xmin)-hoffset("X"),
-			       (topcoordmargin-topxcoordmargin)/2 + 6, let);
-		if (coordbottom)
-		*pp += sprintf(*pp, " -draw \"text %d,%d '%c'\"",
-			       horx(x-xmin)-hoffset("X"),
-			       bdheight-(bottomcoordmargin-bottomxcoordmargin)/2 + 3, let);
+		if (coordtop) {
+			y0 = (topcoordmargin-topxcoordmargin)/2 + 6;
+			drawtext(pp, horx(x-xmin)-hoffset("X"), y0,
+				 horx(x-xmin), y0 - voffset(0), "%c", let);
+		}
+		if (coordbottom) {
+			y0 = bdheight-(bottomcoordmargin-bottomxcoordmargin)/2 + 3;
+			drawtext(pp, horx(x-xmin)-hoffset("X"), y0,
+				 horx(x-xmin), y0 - voffset(0), "%c", let);
+		}
 	}
 }
 
 /* small black circle, radius 1.5 */
 static void drawhoshi(char **pp, int x, int y) {
-	*pp += sprintf(*pp, " -fill black -stroke none");
+	setcolors(pp, "black", "none");
+	if (rp) {
+		raster_circle(rp, horx(x), verty(y), 1.5, fillcolor, NOCOLOR);
+		return;
+	}
 	*pp += sprintf(*pp, " -draw \"circle %d,%d %d,%d.5\"",
 		       horx(x), verty(y), horx(x)+1, verty(y));
 }
 
 static void drawstone(char **pp, int x, int y) {
+	if (rp) {
+		raster_circle(rp, horx(x), verty(y), rowspacing/2,
+			      fillcolor, strokecolor);
+		return;
+	}
 	*pp += sprintf(*pp, " -draw \"circle %d,%d %d,%d\"",
 		       horx(x), verty(y), horx(x)+rowspacing/2, verty(y));
 }
 
 static void drawbs(char **pp, int x, int y) {
-	*pp += sprintf(*pp, " -fill black -stroke black");
+	setcolors(pp, "black", "black");
 	drawstone(pp, x, y);
 }
 
 static void drawws(char **pp, int x, int y) {
-	*pp += sprintf(*pp, " -fill white -stroke black");
+	setcolors(pp, "white", "black");
 	drawstone(pp, x, y);
 }
 
@@ -857,42 +881,55 @@ static void drawcircle(char **pp, int x, int y) {
 //	*pp += sprintf(*pp, " -draw \"circle %d,%d %d,%d\"",
 //		       horx(x), verty(y), horx(x)+rowspacing/3, verty(y));
 
+	if (rp) {
+		raster_circle(rp, horx(x), verty(y), rowspacing/6,
+			      fillcolor, strokecolor);
+		return;
+	}
 	*pp += sprintf(*pp, " -draw \"circle %d,%d %d,%d\"",
 		       horx(x), verty(y), horx(x)+rowspacing/6, verty(y));
 }
 
 static void drawwc(char **pp, int x, int y) {
 //	*pp += sprintf(*pp, " -fill none -stroke white");
-	*pp += sprintf(*pp, " -fill red -stroke none");
+	setcolors(pp, "red", "none");
 	drawcircle(pp, x, y);
 }
 
 static void drawbc(char **pp, int x, int y) {
 //	*pp += sprintf(*pp, " -fill none -stroke black");
-	*pp += sprintf(*pp, " -fill red -stroke none");
+	setcolors(pp, "red", "none");
 	drawcircle(pp, x, y);
 }
 
 static void drawbtext(char **pp, int x, int y, char *s) {
-	*pp += sprintf(*pp, " -fill black -stroke none");
-	*pp += sprintf(*pp, " -draw \"text %d,%d '%s'\"",
-		       horx(x)-hoffset(s), verty(y)+voffset(0), s);
+	setcolors(pp, "black", "none");
+	drawtext(pp, horx(x)-hoffset(s), verty(y)+voffset(0),
+		 horx(x), verty(y), "%s", s);
 }
 
 static void drawwtext(char **pp, int x, int y, char *s) {
-	*pp += sprintf(*pp, " -fill white -stroke white");
-	*pp += sprintf(*pp, " -draw \"text %d,%d '%s'\"",
-		       horx(x)-hoffset(s), verty(y)+voffset(1), s);
+	setcolors(pp, "white", "white");
+	drawtext(pp, horx(x)-hoffset(s), verty(y)+voffset(1),
+		 horx(x), verty(y), "%s", s);
 }
 
 static void drawbbtext(char **pp, int x, int y, char *s) {
-	*pp += sprintf(*pp, " -fill '%s' -stroke none", bgcolor);
-	*pp += sprintf(*pp, " -draw \"rectangle %d,%d %d,%d\"",
-		       horx(x)-rowspacing/3, verty(y)-colspacing/3,
-		       horx(x)+rowspacing/3, verty(y)+colspacing/3);
-	*pp += sprintf(*pp, " -fill black -stroke none");
-	*pp += sprintf(*pp, " -draw \"text %d,%d '%s'\"",
-		       horx(x)-hoffset(s), verty(y)+voffset(0), s);
+	char bg[100];
+
+	snprintf(bg, sizeof(bg), "'%s'", bgcolor);
+	setcolors(pp, bg, "none");
+	if (rp)
+		raster_rect(rp, horx(x)-rowspacing/3, verty(y)-colspacing/3,
+			    horx(x)+rowspacing/3, verty(y)+colspacing/3,
+			    fillcolor);
+	else
+		*pp += sprintf(*pp, " -draw \"rectangle %d,%d %d,%d\"",
+			       horx(x)-rowspacing/3, verty(y)-colspacing/3,
+			       horx(x)+rowspacing/3, verty(y)+colspacing/3);
+	setcolors(pp, "black", "none");
+	drawtext(pp, horx(x)-hoffset(s), verty(y)+voffset(0),
+		 horx(x), verty(y), "%s", s);
 }
 
 /* a is a move number, probably in the range 1-361 */
@@ -902,29 +939,20 @@ static int intwidth(int a) {
 
 #define STACKSZ 1000
 
-static void outinfo1(char *begin, char *end, int *varnr, int *movenr, int *stack, int *stct, int *stct0) {
-	char *p, *q;
+static void outinfo1(struct gametree *g, int *varnr, int *movenr, int *stack, int *stct, int *stct0) {
+	struct gametree *gg;
+	struct node *n;
 	int h, i, ct;
 
 	if (*stct + 2 >= STACKSZ)
 		errexit("stack overflow");
 	stack[(*stct)++] = *movenr;	/* last move */
 
-	p = begin+1;
-	while (p < end) {
-		if (*p == '[') {	
-			skiparg(&p);
-			continue;
-		}
-		if (*p == '(') {
-			q = matching_paren(p);
-			outinfo1(p, q, varnr, movenr, stack, stct, stct0);
-			p = q;
-		}
-		if (!strncmp(p, ";B[", 3) || !strncmp(p, ";W[", 3))
+	for (n = g->nodesequence; n; n = n->next)
+		if (is_move(n))
 			(*movenr)++;
-		p++;
-	}
+	for (gg = g->firstchild; gg; gg = gg->nextsibling)
+		outinfo1(gg, varnr, movenr, stack, stct, stct0);
 
 	stack[(*stct)] = *movenr;	/* current move */
 
@@ -948,24 +976,15 @@ static void outinfo1(char *begin, char *end, int *varnr, int *movenr, int *stack
 /* print input skeleton */
 static void outinfo() {
 	int gamenr, varnr, movenr, stack[STACKSZ], stct, stct0;
-	char *p, *q;
+	struct gametree *g;
 
-	readinput();
-	remove_whitespace();
 	gamenr = 0;
 	stct = 0;
-
-	p = inbuf;
-	while (*p) {
-		if (*p == '(') {
-			printf("Game #%d", ++gamenr);
-			varnr = movenr = stct0 = 0;
-			q = matching_paren(p);
-			outinfo1(p,q,&varnr,&movenr,stack,&stct,&stct0);
-			printf("\n\n");
-			p = q;
-		}
-		p++;
+	for (g = readgames(stdin); g; g = g->nextsibling) {
+		printf("Game #%d", ++gamenr);
+		varnr = movenr = stct0 = 0;
+		outinfo1(g, &varnr, &movenr, stack, &stct, &stct0);
+		printf("\n\n");
 	}
 }
 
@@ -1023,6 +1042,509 @@ static void setfromto(char *s) {
 	displayto = to;
 }
 
+/*
+ * The board without stones, as a raster: grid, coordinates and hoshi.
+ * It depends only on the size and the part of the board shown
+ * (the other options are the same for all diagrams), so it is drawn
+ * once and shared by all diagrams (and threads) that need it.
+ */
+struct background {
+	int rows, cols, xmin, xmax, ymin, ymax;
+	struct raster *r;
+	struct background *next;
+};
+
+static struct background *backgrounds;
+static pthread_mutex_t bglock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct raster *new_board(struct raster **bgp) {
+	struct background *b, *nb;
+	struct raster *r;
+	char *p = command;
+	int i, j;
+
+	nb = xmalloc(sizeof(*nb));
+	pthread_mutex_lock(&bglock);
+	for (b = backgrounds; b; b = b->next)
+		if (b->rows == rows && b->cols == cols &&
+		    b->xmin == xmin && b->xmax == xmax &&
+		    b->ymin == ymin && b->ymax == ymax)
+			break;
+	if (b == NULL) {
+		rp = raster_new(bdwidth, bdheight, raster_color(bgcolor));
+		if (rp == NULL) {
+			pthread_mutex_unlock(&bglock);
+			errexit("out of memory");
+		}
+		drawgrid(&p);
+		if (optcoord)
+			drawcoords(&p);
+		if (rows == 19 && cols == 19)
+			for (i=xmin; i<=xmax; i++) for (j=ymin; j<=ymax; j++)
+				if ((i%6) == 3 && (j%6) == 3)
+					drawhoshi(&p, i-xmin, j-ymin);
+		b = nb;
+		nb = NULL;
+		b->rows = rows;
+		b->cols = cols;
+		b->xmin = xmin;
+		b->xmax = xmax;
+		b->ymin = ymin;
+		b->ymax = ymax;
+		b->r = rp;
+		b->next = backgrounds;
+		backgrounds = b;
+	}
+	r = raster_dup(b->r);
+	if (bgp)
+		*bgp = b->r;	/* not changed after this */
+	pthread_mutex_unlock(&bglock);
+	free(nb);
+	if (r == NULL)
+		errexit("out of memory");
+	return r;
+}
+
+/* forget the previous diagram of this thread */
+static void reset_diagram() {
+	int i, j;
+
+	for (i=0; i<SZ; i++) for (j=0; j<SZ; j++) {
+		board[i][j] = 0;
+		boardnumber[i][j] = 0;
+		free(boardlabel[i][j]);
+		boardlabel[i][j] = NULL;
+	}
+	movenr = mvct = 0;
+	coordleft = coordright = coordtop = coordbottom = 0;
+	setrows(SZ);
+	setcols(SZ);
+	topedge = botedge = leftedge = rightedge = 1;
+	if (rp) {
+		raster_free(rp);
+		rp = NULL;
+	}
+}
+
+/* draw point i,j of the board (x,y in the diagram) */
+static void drawpoint(char **pp, int i, int j) {
+	int x,y,c,nr;
+	char *lb;
+	char txt[10];
+
+	x = i-xmin;
+	y = j-ymin;
+
+	c = board[i][j];
+	nr = boardnumber[i][j];
+	lb = boardlabel[i][j];
+
+	if (nr && nr == movenr && optcircle) {
+		if (c == 'O') {
+			drawws(pp,x,y);
+			drawbc(pp,x,y);
+		} else {
+			drawbs(pp,x,y);
+			drawwc(pp,x,y);
+		}
+		return;
+	}
+
+	if (nr) {
+		if (displayto && nr >= displayto)
+			goto skip;
+		if (displayfrom && nr < displayfrom)
+			nr = 0;
+		if (displayfrom && nr && displaynr0)
+			nr = nr-displayfrom+displaynr0;
+		if (optnonrs)
+			nr = 0;
+	}
+
+	if (!c && nr)
+		errexit("impossible: nr without player");
+	if (lb && nr) {
+		outwarn("move %d: don't know how to show both "
+			"number and label %s - ignored label\n",
+			nr, lb);
+		lb = 0;
+	}
+	if (nr)
+		sprintf(txt, "%d", nr);
+	if (lb)
+		sprintf(txt, "%s", lb);
+
+	if (nr || (c && lb)) {
+		if (c == 'O') {
+			drawws(pp,x,y);
+			drawbtext(pp,x,y,txt);
+		} else {
+			drawbs(pp,x,y);
+			drawwtext(pp,x,y,txt);
+		}
+		return;
+	}
+
+	if (lb) {
+		drawbbtext(pp,x,y,txt);
+		return;
+	}
+
+	if (c) {
+		if (c == 'O')
+			drawws(pp,x,y);
+		else
+			drawbs(pp,x,y);
+		return;
+	}
+skip:
+	if (!rp && rows == 19 && cols == 19 &&
+	    (i%6) == 3 && (j%6) == 3)
+		drawhoshi(pp,x,y);
+}
+
+/* read the sgf from in, and write the diagram to outfile */
+static void make_diagram(FILE *in, char *outfile) {
+	char *p = command;
+	int i,j;
+	char tmpfile[100];		/* TMP-NNN.png */
+	int tmpfct = 0;
+
+	reset_diagram();
+	read_game(in);
+
+	if (optview)
+		setview(optview);
+	setmargins(optcoord);
+	compute_dimensions();
+
+	pointsize = 14;
+	if (movenr > 99)
+		pointsize = 12;
+
+	/* -debug shows the convert command */
+	if (!optconvert && !optdebug && ends_in(outfile, ".png")) {
+		rp = new_board(NULL);
+	} else {
+		p += sprintf(p, "convert -size %dx%d xc:%s",
+			     bdwidth, bdheight, bgcolor);
+		p += sprintf(p, " -font '%s' -pointsize %d",
+			     optfont, pointsize);
+		drawgrid(&p);
+		if (optcoord)
+			drawcoords(&p);
+	}
+
+	for (i=xmin; i<=xmax; i++) for (j=ymin; j<=ymax; j++) {
+		/* break up long commands if requested */
+		if (!rp && maxcommandlinelength &&
+		    strlen(command) >= maxcommandlinelength-250) {
+			sprintf(tmpfile, "TMP-%d.png", ++tmpfct);
+			p += sprintf(p, " %s", quoted(tmpfile));
+			if (optdebug)
+				printf("%s\n", command);
+			else if (system(command))
+				errexit("(partial) draw command failed");
+			p = command;
+			p += sprintf(p, "convert %s", quoted(tmpfile));
+			p += sprintf(p, " -font '%s' -pointsize %d",
+				     optfont, pointsize);
+		}
+
+		drawpoint(&p, i, j);
+	}
+
+	if (rp) {
+		FILE *f = fopen(outfile, "w");
+
+		if (f == NULL)
+			errexit("cannot open %s for writing", outfile);
+		if (raster_write_png(rp, f) || fclose(f))
+			errexit("error writing %s", outfile);
+		raster_free(rp);
+		rp = NULL;
+		return;
+	}
+
+	p += sprintf(p, " %s", quoted(outfile));
+
+	if (optdebug)
+		printf("%s\n", command);	/* show, don't do */
+	else if (system(command))
+		errexit("draw command failed");
+
+	/* cleanup */
+	if (tmpfct) {
+		for (i=1; i <= tmpfct; i++) {
+			sprintf(tmpfile, "TMP-%d.png", i);
+			if (unlink(tmpfile))
+				fprintf(stderr, "cannot delete temp file %s\n",
+					tmpfile);
+		}
+	}
+}
+
+/*
+ * -sequence and -animate: a diagram after each move, made while
+ * reading the game. Only the points that changed since the previous
+ * frame are drawn again, on a copy of the empty board there
+ * (together with their neighbours, that may overlap them a little),
+ * so each frame is the same as a diagram drawn from scratch.
+ * An animated PNG gets only the rectangle that changed.
+ */
+__thread char *seqout;			/* OUTFILE */
+__thread struct raster *seqbg;		/* the empty board */
+__thread FILE *seqf;
+__thread struct raster_anim *seqanim;
+__thread int seqmove, seqframes;
+__thread char seqc[SZ][SZ], seqcirc[SZ][SZ];	/* as shown now */
+__thread char *seqlb[SZ][SZ];
+
+static void start_sequence() {
+	int i, j;
+
+	if (optview)
+		setview(optview);
+	setmargins(optcoord);
+	compute_dimensions();
+	pointsize = 14;
+	rp = new_board(&seqbg);
+	for (i=0; i<SZ; i++) for (j=0; j<SZ; j++) {
+		seqc[i][j] = seqcirc[i][j] = 0;
+		seqlb[i][j] = NULL;
+	}
+
+	if (optsequence == SEQ_ANIM) {
+		seqf = fopen(seqout, "w");
+		if (seqf == NULL)
+			errexit("cannot open %s for writing", seqout);
+		seqanim = raster_anim_start(seqf, bdwidth, bdheight);
+		if (seqanim == NULL)
+			errexit("out of memory");
+	}
+}
+
+/* finish the frames, also after an error; returns -1 on error */
+static int end_sequence() {
+	int err = 0;
+
+	if (seqanim && raster_anim_end(seqanim))
+		err = 1;
+	seqanim = NULL;
+	if (seqf && fclose(seqf))
+		err = 1;
+	seqf = NULL;
+	return err ? -1 : 0;
+}
+
+static void write_frame(int x1, int y1, int x2, int y2) {
+	char *fn;
+	FILE *f;
+	int n;
+
+	if (seqanim) {
+		if (raster_anim_frame(seqanim, rp, x1, y1, x2, y2, optdelay))
+			errexit("error writing %s", seqout);
+		return;
+	}
+
+	n = strlen(seqout) - 4;		/* without .png */
+	fn = xmalloc(n + 20);
+	sprintf(fn, "%.*s-%03d.png", n, seqout, movenr);
+	f = fopen(fn, "w");
+	if (f == NULL)
+		errexit("cannot open %s for writing", fn);
+	if (raster_write_png(rp, f) || fclose(f))
+		errexit("error writing %s", fn);
+	free(fn);
+}
+
+/* called at the start of each node, and at the end of the game */
+static void seqframe(int final) {
+	int i, j, ii, jj, circ, r, changed;
+	int x1, y1, x2, y2;
+
+	if (movenr == seqmove || (movenr == 0 && !final))
+		return;
+	if ((seqfrom && movenr < seqfrom) || (seqto && movenr >= seqto))
+		if (!final || seqframes)
+			return;
+	if (rp == NULL)
+		start_sequence();
+
+	r = rowspacing/2 + 2;	/* a stone and its outline */
+	x1 = bdwidth;
+	y1 = bdheight;
+	x2 = y2 = -1;
+	for (i=xmin; i<=xmax; i++) for (j=ymin; j<=ymax; j++) {
+		circ = (optcircle && boardnumber[i][j] == movenr);
+		changed = (board[i][j] != seqc[i][j] ||
+			   boardlabel[i][j] != seqlb[i][j] ||
+			   circ != seqcirc[i][j]);
+		if (!changed)
+			continue;
+		seqc[i][j] = board[i][j];
+		seqlb[i][j] = boardlabel[i][j];
+		seqcirc[i][j] = circ;
+
+		ii = horx(i-xmin);
+		jj = verty(j-ymin);
+		raster_clip(rp, ii-r, jj-r, ii+r, jj+r);
+		raster_copy(rp, seqbg, ii-r, jj-r, ii+r, jj+r);
+		for (ii=i-1; ii<=i+1; ii++) for (jj=j-1; jj<=j+1; jj++)
+			if (ii >= xmin && ii <= xmax &&
+			    jj >= ymin && jj <= ymax)
+				drawpoint(NULL, ii, jj);
+
+		if (x1 > rp->cx1)
+			x1 = rp->cx1;
+		if (y1 > rp->cy1)
+			y1 = rp->cy1;
+		if (x2 < rp->cx2)
+			x2 = rp->cx2;
+		if (y2 < rp->cy2)
+			y2 = rp->cy2;
+	}
+	raster_clip(rp, 0, 0, bdwidth-1, bdheight-1);
+
+	write_frame(x1, y1, x2, y2);
+	seqmove = movenr;
+	seqframes++;
+}
+
+static void make_sequence(FILE *in, char *outfile) {
+	reset_diagram();
+	seqout = outfile;
+	seqmove = -1;
+	seqframes = 0;
+	read_game(in);
+	seqframe(1);
+	if (end_sequence())
+		errexit("error writing %s", seqout);
+	raster_free(rp);
+	rp = NULL;
+}
+
+/*
+ * -batch SRCDIR DSTDIR: SRCDIR/.../name.sgf becomes DSTDIR/name.png,
+ * as sgfutils.sh names its output. The diagrams are made by
+ * nthreads workers; errors in one file are reported, and the
+ * others are done anyway.
+ */
+struct pngjob {
+	char *in, *out;
+	FILE *f;
+	int failed;
+};
+
+static char *dstdir;
+static struct workq *wq;
+static int nthreads = 1;
+static int diagramct, failct;
+
+int recursive = 1;
+char *file_extension = ".sgf";
+
+static void png_job(void *arg) {
+	struct pngjob *job = arg;
+
+	job->failed = 1;
+	infilename = job->in;
+	catch_errors = 1;
+	if (setjmp(jmpbuf))
+		goto ret;
+	have_jmpbuf = 1;
+
+	job->f = fopen(job->in, "r");
+	if (job->f == NULL)
+		errexit("cannot open for reading");
+	if (optsequence)
+		make_sequence(job->f, job->out);
+	else
+		make_diagram(job->f, job->out);
+	job->failed = 0;
+ret:
+	have_jmpbuf = 0;
+	if (seqf)
+		end_sequence();
+	if (rp) {
+		raster_free(rp);
+		rp = NULL;
+	}
+	if (job->f)
+		fclose(job->f);
+}
+
+static void done_job(void *arg) {
+	struct pngjob *job = arg;
+
+	if (job->failed)
+		failct++;
+	else
+		diagramct++;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/* called by do_infile() for each .sgf file, and for each line of stdin */
+void do_input(const char *fn) {
+	struct pngjob *job;
+	const char *base, *s;
+	int n;
+
+	base = fn;
+	for (s = fn; *s; s++)
+		if (*s == '/')
+			base = s+1;
+	n = strlen(base);
+	if (n < 4 || strcmp(base+n-4, ".sgf")) {
+		warn("%s is not a .sgf file - skipped", fn);
+		return;
+	}
+
+	job = xmalloc(sizeof(*job));
+	job->in = xstrdup((char *) fn);
+	job->out = xmalloc(strlen(dstdir) + n + 2);
+	sprintf(job->out, "%s/%.*s.png", dstdir, n-4, base);
+	job->f = NULL;
+	workq_submit(wq, job);
+}
+
+static void do_batch(char *srcdir) {
+	struct stat sb;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+
+	if (optinfo)
+		fatalexit("-info cannot be used with -batch");
+	if (maxcommandlinelength && nthreads > 1)
+		fatalexit("-maxcommandsz cannot be used with -j");
+	if (stat(dstdir, &sb) < 0 || !S_ISDIR(sb.st_mode))
+		fatalexit("%s is not a directory", dstdir);
+
+	wq = workq_start(nthreads, png_job, done_job);
+	if (strcmp(srcdir, "-"))
+		do_infile(srcdir);
+	else while ((n = getline(&line, &len, stdin)) > 0) {
+		/* one file name per line */
+		if (line[n-1] == '\n')
+			line[--n] = 0;
+		if (n)
+			do_input(line);
+	}
+	free(line);
+	workq_finish(wq);
+
+	fprintf(stderr, "%s: wrote %d diagram%s to %s", progname,
+		diagramct, (diagramct == 1) ? "" : "s", dstdir);
+	if (failct)
+		fprintf(stderr, ", %d file%s failed", failct,
+			(failct == 1) ? "" : "s");
+	fprintf(stderr, "\n");
+}
+
 /* not mentioned: -coord, -view */
 static void usage() {
 	fprintf(stderr, "\nCall:\n"
@@ -1032,31 +1554,27 @@ static void usage() {
 " sgftopng -info < in.sgf          -- write variationtree to stdout\n"
 " sgftopng -game M -var N ...      -- select game M variation N\n"
 "  -from 1                         -- number the numbered stones from 1\n"
+" sgftopng -batch srcdir dstdir -j N -- write srcdir/.../x.sgf to dstdir/x.png\n"
+"                                     using N threads; srcdir - reads\n"
+"                                     file names from stdin\n"
+" sgftopng -sequence -o x.png < in.sgf -- x-001.png, x-002.png, .. per move\n"
+" sgftopng -animate [-delay N] -o x.png < in.sgf -- animated png\n"
 "\n"
 "Default: game 1, variation 0 (the final one)\n"
 "Output format is determined by the name suffix: x.png, x.jpg, x.gif\n"
+"A .png is drawn directly, other formats (or -convert) use ImageMagick\n"
 	"\n");
 	exit(1);
 }
 
 int main(int argc, char **argv) {
-	char *p = command;
 	char *outfile = NULL;
 	char *infile = NULL;
+	char *srcdir = NULL;
 	char *argp;
-	char *optview = NULL;
-	char *optfont = NULL;
-	char *optcoord = NULL;
-	int optdebug = 0;
-	int optinfo = 0;
-	int i,j,c,nr;
-	char *lb;
-
-	/* use temporary files when commandsz is limited */
-	int maxcommandlinelength = 0;
-	char tmpfile[100];		/* TMP-NNN.png */
-	int tmpfct = 0;
+	int i;
 
+	progname = "sgftopng";
 	displaygame = 1;
 	displayvar = 0;
 	displayfrom = displayto = 0;
@@ -1085,6 +1603,21 @@ int main(int argc, char **argv) {
 				optdebug = 1;
 			else if (!strcmp(argp, "-info"))
 				optinfo = 1;
+			else if (!strcmp(argp, "-convert"))
+				optconvert = 1;
+			else if (!strcmp(argp, "-sequence"))
+				optsequence = SEQ_FILES;
+			else if (!strcmp(argp, "-animate"))
+				optsequence = SEQ_ANIM;
+			else if (!strcmp(argp, "-delay") && i < argc-1)
+				optdelay = atoi(argv[++i]);
+			else if (!strcmp(argp, "-batch") && i < argc-2) {
+				srcdir = argv[++i];
+				dstdir = argv[++i];
+			} else if (!strcmp(argp, "-j") && i < argc-1)
+				nthreads = atoi(argv[++i]);
+			else if (!strncmp(argp, "-j", 2) && argp[2])
+				nthreads = atoi(argp+2);
 			else if (!strcmp(argp, "-font") && i < argc-1)
 				optfont = argv[++i];
 			else if (!strncmp(argp, "-coord", 6))
@@ -1123,30 +1656,47 @@ int main(int argc, char **argv) {
 
 		if (ends_in(argp, ".sgf")) {
 			if (infile)
-				errexit("sgftopng: at most one inputfile");
+				errexit("at most one inputfile");
 			infile = argp;
 			continue;
 		}
 
 		if (outfile)
-			errexit("sgftopng: at most one outputfile");
+			errexit("at most one outputfile");
 		outfile = argp;
 	}
 
+	if (optsequence) {
+		if (optconvert || optdebug || optinfo)
+			fatalexit("-sequence and -animate draw .png only");
+		/* the range selects frames; no numbers, remove captures */
+		seqfrom = displayfrom;
+		seqto = displayto;
+		displayfrom = displayto = 0;
+		optnonrs = 1;
+	}
 	if (optnonrs && !displayfrom)
 		displayfrom = 10000;	/* infinity */
-	
+	if (!optfont)
+		optfont = "Times-Roman";
+
+	if (srcdir) {
+		if (infile || outfile)
+			fatalexit("no inputfile or outputfile with -batch");
+		do_batch(srcdir);
+		return failct ? 1 : 0;
+	}
+
 	if (infile) {
 		/* reopen as stdin */
 		FILE *f = freopen(infile, "r", stdin);
 		if (!f)
-			errexit("sgftopng: cannot open %s for reading",
-				infile);
+			errexit("cannot open %s for reading", infile);
 	}
 
 	if (optinfo) {
 		if (outfile)
-			errexit("sgftopng: no outputfile used with -info");
+			errexit("no outputfile used with -info");
 		outinfo();
 		return 0;
 	}
@@ -1156,137 +1706,12 @@ int main(int argc, char **argv) {
 	if (!index(outfile, '.'))
 		errexit("outputfile %s has no extension", outfile);
 
-	setrows(SZ);
-	setcols(SZ);
-	topedge = botedge = leftedge = rightedge = 1;
-
-	readsgf();
-
-	if (optview)
-		setview(optview);
-	setmargins(optcoord);
-	compute_dimensions();
-
-	pointsize = 14;
-	if (movenr > 99)
-		pointsize = 12;
-
-	p += sprintf(p, "convert -size %dx%d xc:%s",
-		     bdwidth, bdheight, bgcolor);
-
-	if (!optfont)
-		optfont = "Times-Roman";
-	p += sprintf(p, " -font '%s' -pointsize %d", optfont, pointsize);
-
-	drawgrid(&p);
-	if (optcoord)
-		drawcoords(&p);
-	for (i=xmin; i<=xmax; i++) for (j=ymin; j<=ymax; j++) {
-		int x,y;
-		char txt[10];
-
-		/* break up long commands if requested */
-		if (maxcommandlinelength &&
-		    strlen(command) >= maxcommandlinelength-250) {
-			sprintf(tmpfile, "TMP-%d.png", ++tmpfct);
-			p += sprintf(p, " %s", quoted(tmpfile));
-			if (optdebug)
-				printf("%s\n", command);
-			else if (system(command))
-				errexit("(partial) draw command failed");
-			p = command;
-			p += sprintf(p, "convert %s", quoted(tmpfile));
-			p += sprintf(p, " -font '%s' -pointsize %d",
-				     optfont, pointsize);
-		}
-
-		x = i-xmin;
-		y = j-ymin;
-
-		c = board[i][j];
-		nr = boardnumber[i][j];
-		lb = boardlabel[i][j];
-
-		if (nr && nr == movenr && optcircle) {
-			if (c == 'O') {
-				drawws(&p,x,y);
-				drawbc(&p,x,y);
-			} else {
-				drawbs(&p,x,y);
-				drawwc(&p,x,y);
-			}
-			continue;
-		}
-
-		if (nr) {
-			if (displayto && nr >= displayto)
-				goto skip;
-			if (displayfrom && nr < displayfrom)
-				nr = 0;
-			if (displayfrom && nr && displaynr0)
-				nr = nr-displayfrom+displaynr0;
-			if (optnonrs)
-				nr = 0;
-		}
-
-		if (!c && nr)
-			errexit("impossible: nr without player");
-		if (lb && nr) {
-			outwarn("move %d: don't know how to show both "
-				"number and label %s - ignored label\n",
-				nr, lb);
-			lb = 0;
-		}
-		if (nr)
-			sprintf(txt, "%d", nr);
-		if (lb)
-			sprintf(txt, "%s", lb);
-
-		if (nr || (c && lb)) {
-			if (c == 'O') {
-				drawws(&p,x,y);
-				drawbtext(&p,x,y,txt);
-			} else {
-				drawbs(&p,x,y);
-				drawwtext(&p,x,y,txt);
-			}
-			continue;
-		}
-
-		if (lb) {
-			drawbbtext(&p,x,y,txt);
-			continue;
-		}
-
-		if (c) {
-			if (c == 'O')
-				drawws(&p,x,y);
-			else
-				drawbs(&p,x,y);
-			continue;
-		}
-	skip:
-		if (rows == 19 && cols == 19 &&
-		    (i%6) == 3 && (j%6) == 3)
-			drawhoshi(&p,x,y);
-	}
-
-	p += sprintf(p, " %s", quoted(outfile));
-
-	if (optdebug)
-		printf("%s\n", command);	/* show, don't do */
-	else if (system(command))
-		errexit("draw command failed");
-
-	/* cleanup */
-	if (tmpfct) {
-		for (i=1; i <= tmpfct; i++) {
-			sprintf(tmpfile, "TMP-%d.png", i);
-			if (unlink(tmpfile))
-				fprintf(stderr, "cannot delete temp file %s\n",
-					tmpfile);
-		}
+	if (optsequence) {
+		if (!ends_in(outfile, ".png"))
+			errexit("-sequence and -animate write .png only");
+		make_sequence(stdin, outfile);
+		return 0;
 	}
-
+	make_diagram(stdin, outfile);
 	return 0;
 }
@@ -622,7 +622,7 @@ int main(int argc, char **argv) {
 	if (inct > 1)
 		errexit("at most one input file");
 
-	readsgf(infile, &g);
+	sgf_readsgf(sgf_parser_new(sgf_default_flags()), infile, &g);
 
 	ng = get_number_of_games(g);
 	if (out_ng)
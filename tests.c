@@ -156,6 +156,28 @@ int checkints() {
 	return 1;
 }
 
+/*
+ * intersection of the intervals given for val (UNSET: no bound)
+ * returns the number of such intervals
+ */
+int getinterval(int *val, int *min, int *max) {
+	struct testinterval *ti;
+	int i, n = 0;
+
+	*min = *max = UNSET;
+	for (i=0; i<tisct; i++) {
+		ti = tis+i;
+		if (ti->val != val)
+			continue;
+		n++;
+		if (ti->min != UNSET && (*min == UNSET || ti->min > *min))
+			*min = ti->min;
+		if (ti->max != UNSET && (*max == UNSET || ti->max < *max))
+			*max = ti->max;
+	}
+	return n;
+}
+
 static void setstringtest(char *needed, int (*fn)(char *, int), int flag) {
 	struct teststring *ts;
 
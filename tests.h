@@ -1,6 +1,7 @@
 extern char *getminmax(char *s, int *min, int *max);
 extern char *setminmax(char *s, int *val, char *msg);
 extern int checkints(void);
+extern int getinterval(int *val, int *min, int *max);
 extern int checkstrings(void);
 extern int checkstringfns(void);
 extern void set_int_to_report(char *fmt, int *val);
@@ -0,0 +1,156 @@
+/*
+ * workq.c - run jobs on nthreads worker threads
+ *
+ * workq_start(n, work, done): start n workers and one writer
+ * workq_submit(wq, job): queue a job; work(job) is called in some
+ *  worker thread, and afterwards done(job) in the writer thread,
+ *  strictly in the order in which the jobs were submitted
+ * workq_finish(wq): wait until all jobs are done, and clean up
+ *
+ * At most QDEPTH jobs per worker are in flight; workq_submit()
+ * blocks when the writer falls behind.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include "errexit.h"
+#include "xmalloc.h"
+#include "workq.h"
+
+#define QDEPTH	4
+
+#define QUEUED	1
+#define DONE	2
+
+struct workq {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	void (*work)(void *);
+	void (*done)(void *);
+	int nthreads;
+	pthread_t *workers;
+	pthread_t writer;
+	int depth;		/* size of the ring below */
+	void **jobs;
+	char *state;
+	long submitted;		/* jobs handed to workq_submit() */
+	long started;		/* jobs taken by a worker */
+	long completed;		/* jobs given to done() */
+	int finishing;
+};
+
+static void *
+worker(void *arg) {
+	struct workq *wq = arg;
+	long i;
+
+	pthread_mutex_lock(&wq->lock);
+	while (1) {
+		while (wq->started == wq->submitted && !wq->finishing)
+			pthread_cond_wait(&wq->cond, &wq->lock);
+		if (wq->started == wq->submitted)
+			break;
+		i = (wq->started++) % wq->depth;
+		pthread_mutex_unlock(&wq->lock);
+
+		wq->work(wq->jobs[i]);
+
+		pthread_mutex_lock(&wq->lock);
+		wq->state[i] = DONE;
+		pthread_cond_broadcast(&wq->cond);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+static void *
+writer(void *arg) {
+	struct workq *wq = arg;
+	long i;
+
+	pthread_mutex_lock(&wq->lock);
+	while (1) {
+		i = wq->completed % wq->depth;
+		while (wq->completed < wq->submitted
+		       ? wq->state[i] != DONE : !wq->finishing)
+			pthread_cond_wait(&wq->cond, &wq->lock);
+		if (wq->completed == wq->submitted)
+			break;
+		pthread_mutex_unlock(&wq->lock);
+
+		wq->done(wq->jobs[i]);
+
+		pthread_mutex_lock(&wq->lock);
+		wq->state[i] = 0;
+		wq->completed++;
+		pthread_cond_broadcast(&wq->cond);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+struct workq *
+workq_start(int nthreads, void (*work)(void *), void (*done)(void *)) {
+	struct workq *wq;
+	int i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+
+	wq = xmalloc(sizeof(*wq));
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+	wq->work = work;
+	wq->done = done;
+	wq->nthreads = nthreads;
+	wq->depth = QDEPTH * nthreads;
+	wq->jobs = xmalloc(wq->depth * sizeof(void *));
+	wq->state = xmalloc(wq->depth);
+	for (i = 0; i < wq->depth; i++)
+		wq->state[i] = 0;
+	wq->submitted = wq->started = wq->completed = 0;
+	wq->finishing = 0;
+
+	wq->workers = xmalloc(nthreads * sizeof(pthread_t));
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&wq->workers[i], NULL, worker, wq))
+			fatalexit("cannot create worker thread");
+	if (pthread_create(&wq->writer, NULL, writer, wq))
+		fatalexit("cannot create writer thread");
+	return wq;
+}
+
+void
+workq_submit(struct workq *wq, void *job) {
+	long i;
+
+	pthread_mutex_lock(&wq->lock);
+	while (wq->submitted - wq->completed == wq->depth)
+		pthread_cond_wait(&wq->cond, &wq->lock);
+	i = wq->submitted % wq->depth;
+	wq->jobs[i] = job;
+	wq->state[i] = QUEUED;
+	wq->submitted++;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+void
+workq_finish(struct workq *wq) {
+	int i;
+
+	pthread_mutex_lock(&wq->lock);
+	wq->finishing = 1;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+
+	for (i = 0; i < wq->nthreads; i++)
+		pthread_join(wq->workers[i], NULL);
+	pthread_join(wq->writer, NULL);
+
+	pthread_mutex_destroy(&wq->lock);
+	pthread_cond_destroy(&wq->cond);
+	free(wq->workers);
+	free(wq->jobs);
+	free(wq->state);
+	free(wq);
+}
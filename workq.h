@@ -0,0 +1,10 @@
+/*
+ * A few worker threads doing jobs, and a writer thread that
+ * gets the finished jobs back in the order they were submitted.
+ */
+struct workq;
+
+extern struct workq *workq_start(int nthreads, void (*work)(void *),
+				 void (*done)(void *));
+extern void workq_submit(struct workq *wq, void *job);
+extern void workq_finish(struct workq *wq);
@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "xmalloc.h"
 #include "errexit.h"
 
@@ -42,55 +43,145 @@ xstrdup(char *p) {
 
 /* much faster version when many small areas are allocated */
 #define YMALLOC_INCR	65536
+#define YALIGN		8		/* alignment of the areas handed out */
+#define HUGESZ		(2L << 20)	/* size of a huge page */
 
-static struct arena {
+struct arena {
 	struct arena *next;
-} *thisarena;
-static void *thisfree;
-static long int thisleft = -1L;
-static long int thislastsz = 0;
+	long size;		/* of the chunk, including this header */
+};
 
-#include <stdio.h>
-void *ymalloc(int n) {
-	void *p;
+/* with ya->huge: 2 MB aligned, so that the kernel may use huge pages */
+static struct arena *
+new_chunk(struct yarena *ya, long sz) {
 	struct arena *a;
+	char *p, *q;
+
+	if (ya->huge) {
+		sz = (sz + HUGESZ - 1) & ~(HUGESZ - 1);
+		p = mmap(NULL, sz + HUGESZ, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			fatal("ymalloc: out of memory");
+		q = (char *) (((unsigned long) p + HUGESZ - 1) & ~(HUGESZ - 1));
+		if (q > p)
+			munmap(p, q - p);
+		if (q + sz < p + sz + HUGESZ)
+			munmap(q + sz, p + HUGESZ - q);
+#ifdef MADV_HUGEPAGE
+		madvise(q, sz, MADV_HUGEPAGE);
+#endif
+		a = (struct arena *) q;
+	} else {
+		a = malloc(sz);
+		if (a == NULL)
+			fatal("ymalloc: out of memory");
+	}
+	a->size = sz;
+	return a;
+}
+
+static void
+free_chunk(struct yarena *ya, struct arena *a) {
+	if (ya->huge)
+		munmap(a, a->size);
+	else
+		free(a);
+}
 
-	while (1) {
-		p = thisfree;
-		thisfree += n;
-		thisleft -= n;
-		if (thisleft >= 0)
-			return p;
+void *yamalloc(struct yarena *ya, int n) {
+	struct arena *a;
+	long sz;
+	char *p;
 
+	n = (n + YALIGN - 1) & ~(YALIGN - 1);
+	if (ya->free == NULL || n > ya->left) {
 		/* no room */
-		thislastsz += YMALLOC_INCR;
-		p = malloc(thislastsz);
-		if (p == NULL)
-			fatal("ymalloc: out of memory");
-		a = p;
-		a->next = thisarena;
-		thisarena = a;
-		thisleft = thislastsz - sizeof(struct arena);
-		thisfree = p + sizeof(struct arena);
+		sz = n + sizeof(struct arena);
+		if (ya->spare && ya->spare->size >= sz) {
+			a = ya->spare;
+			ya->spare = NULL;
+		} else {
+			ya->lastsz += YMALLOC_INCR;
+			a = new_chunk(ya, (ya->lastsz > sz) ? ya->lastsz : sz);
+		}
+		a->next = ya->chain;
+		ya->chain = a;
+		ya->left = a->size - sizeof(struct arena);
+		ya->free = (char *) a + sizeof(struct arena);
 	}
+	p = ya->free;
+	ya->free += n;
+	ya->left -= n;
+	return p;
 }
 
-void yfree() {
-	void *p;
+/*
+ * Give back everything allocated after yamark(ya, m) was called,
+ * or everything (m NULL). The largest chunk freed is kept as spare,
+ * so that an arena that is filled and released over and over again
+ * does not go back to malloc() each time.
+ */
+void yamark(struct yarena *ya, struct yamark *m) {
+	m->chain = ya->chain;
+	m->free = ya->free;
+	m->left = ya->left;
+}
 
-	while ((p = thisarena) != NULL) {
-		thisarena = thisarena->next;
-		free(p);
+void yarelease(struct yarena *ya, struct yamark *m) {
+	struct arena *a, *stop = (m ? m->chain : NULL);
+
+	while ((a = ya->chain) != stop) {
+		ya->chain = a->next;
+		if (ya->spare && ya->spare->size >= a->size) {
+			free_chunk(ya, a);
+		} else {
+			if (ya->spare)
+				free_chunk(ya, ya->spare);
+			ya->spare = a;
+		}
 	}
-	thisleft = -1;
-	thislastsz = 0;
+	ya->free = (m ? m->free : NULL);
+	ya->left = (m ? m->left : 0);
 }
 
-char *ystrdup(char *p) {
+/* free all, also the spare chunk */
+void yafree(struct yarena *ya) {
+	yarelease(ya, NULL);
+	if (ya->spare)
+		free_chunk(ya, ya->spare);
+	ya->spare = NULL;
+	ya->lastsz = 0;
+}
+
+char *yastrdup(struct yarena *ya, char *p) {
 	int n = strlen(p);
-	char *q = ymalloc(n+1);
+	char *q = yamalloc(ya, n+1);
 
 	return strcpy(q,p);
 }
 
+/* one default arena per thread */
+static __thread struct yarena thisarena;
+
+void *ymalloc(int n) {
+	return yamalloc(&thisarena, n);
+}
+
+void yfree() {
+	yafree(&thisarena);
+}
+
+void ymark(struct yamark *m) {
+	yamark(&thisarena, m);
+}
+
+void yrelease(struct yamark *m) {
+	yarelease(&thisarena, m);
+}
+
+char *ystrdup(char *p) {
+	return yastrdup(&thisarena, p);
+}
+
 /* no yrealloc */
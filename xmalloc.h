@@ -6,3 +6,27 @@ extern char *xstrdup(char *p);
 extern void *ymalloc(int n);
 extern void yfree(void);
 extern char *ystrdup(char *p);
+
+/* the same, with an explicit arena; zero-initialize before first use */
+struct yarena {
+	struct arena *chain;
+	char *free;
+	long left;
+	long lastsz;
+	struct arena *spare;	/* kept by yarelease() for reuse */
+	int huge;		/* set before first use: huge page chunks */
+};
+extern void *yamalloc(struct yarena *ya, int n);
+extern void yafree(struct yarena *ya);
+extern char *yastrdup(struct yarena *ya, char *p);
+
+/* release back to a mark (NULL: to empty), keeping one chunk */
+struct yamark {
+	struct arena *chain;
+	char *free;
+	long left;
+};
+extern void yamark(struct yarena *ya, struct yamark *m);
+extern void yarelease(struct yarena *ya, struct yamark *m);
+extern void ymark(struct yamark *m);
+extern void yrelease(struct yamark *m);